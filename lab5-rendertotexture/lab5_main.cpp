@@ -19,6 +19,7 @@ using namespace glm;
 
 #include <Model.h>
 #include "hdr.h"
+#include "profiler.h"
 
 using std::min;
 using std::max;
@@ -343,32 +344,41 @@ void display()
 	///////////////////////////////////////////////////////////////////////////
 	// draw scene from security camera
 	///////////////////////////////////////////////////////////////////////////
-	// Task 2
-	// ...
+	{
+		PROFILE_SCOPE("Security camera pass");
+		// Task 2
+		// ...
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// draw scene from camera
 	///////////////////////////////////////////////////////////////////////////
-	glBindFramebuffer(GL_FRAMEBUFFER, 0); // to be replaced with another framebuffer when doing post processing
-	glViewport(0, 0, w, h);
-	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	{
+		PROFILE_SCOPE("Camera pass");
+		glBindFramebuffer(GL_FRAMEBUFFER, 0); // to be replaced with another framebuffer when doing post processing
+		glViewport(0, 0, w, h);
+		glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	drawScene(viewMatrix, projectionMatrix); // using both shaderProgram and backgroundProgram
+		drawScene(viewMatrix, projectionMatrix); // using both shaderProgram and backgroundProgram
 
-	// camera (obj-model)
-	drawCamera(securityCamViewMatrix, viewMatrix, projectionMatrix);
+		// camera (obj-model)
+		drawCamera(securityCamViewMatrix, viewMatrix, projectionMatrix);
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// Post processing pass(es)
 	///////////////////////////////////////////////////////////////////////////
-	// Task 3:
-	// 1. Bind and clear default framebuffer
-	// 2. Set postFxShader as active
-	// 3. Bind the framebuffer to texture unit 0
-	// 4. Draw a quad over the entire viewport
-
-	// Task 4: Set the required uniforms
+	{
+		PROFILE_SCOPE("Post processing");
+		// Task 3:
+		// 1. Bind and clear default framebuffer
+		// 2. Set postFxShader as active
+		// 3. Bind the framebuffer to texture unit 0
+		// 4. Draw a quad over the entire viewport
+
+		// Task 4: Set the required uniforms
+	}
 
 	glUseProgram(0);
 
@@ -500,6 +510,8 @@ void gui()
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
 	            ImGui::GetIO().Framerate);
 	// ----------------------------------------------------------
+
+	labhelper::profiler::drawOverlay();
 }
 
 int main(int argc, char* argv[])
@@ -518,6 +530,9 @@ int main(int argc, char* argv[])
 		deltaTime = timeSinceStart.count() - currentTime;
 		currentTime = timeSinceStart.count();
 
+		// Close the profiler statistics of the last frame
+		labhelper::profiler::beginFrame();
+
 		// Inform imgui of new frame
 		ImGui_ImplSdlGL3_NewFrame(g_window);
 
@@ -525,7 +540,10 @@ int main(int argc, char* argv[])
 		stopRendering = handleEvents();
 
 		// render to window
-		display();
+		{
+			PROFILE_SCOPE("display");
+			display();
+		}
 
 		// Render overlay GUI.
 		if(showUI)
@@ -534,7 +552,10 @@ int main(int argc, char* argv[])
 		}
 
 		// Render the GUI.
-		ImGui::Render();
+		{
+			PROFILE_SCOPE("ImGui::Render");
+			ImGui::Render();
+		}
 
 		// Swap front and back buffer. This frame will now been displayed.
 		SDL_GL_SwapWindow(g_window);
@@ -18,6 +18,7 @@ using namespace glm;
 #include <Model.h>
 #include "hdr.h"
 #include "fbo.h"
+#include "profiler.h"
 
 using std::min;
 using std::max;
@@ -346,18 +347,24 @@ void display(void)
 	///////////////////////////////////////////////////////////////////////////
 	// Draw Shadow Map
 	///////////////////////////////////////////////////////////////////////////
+	{
+		PROFILE_SCOPE("Shadow map pass");
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// Draw from camera
 	///////////////////////////////////////////////////////////////////////////
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, w, h);
-	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	drawBackground(viewMatrix, projMatrix);
-	drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
-	debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
+	{
+		PROFILE_SCOPE("Camera pass");
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, w, h);
+		glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		drawBackground(viewMatrix, projMatrix);
+		drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
+		debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
+	}
 
 
 	CHECK_GL_ERROR();
@@ -526,6 +533,8 @@ void gui()
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
 	            ImGui::GetIO().Framerate);
 	// ----------------------------------------------------------
+
+	labhelper::profiler::drawOverlay();
 }
 
 int main(int argc, char* argv[])
@@ -544,6 +553,9 @@ int main(int argc, char* argv[])
 		deltaTime = timeSinceStart.count() - currentTime;
 		currentTime = timeSinceStart.count();
 
+		// Close the profiler statistics of the last frame
+		labhelper::profiler::beginFrame();
+
 		// Inform imgui of new frame
 		ImGui_ImplSdlGL3_NewFrame(g_window);
 
@@ -551,7 +563,10 @@ int main(int argc, char* argv[])
 		stopRendering = handleEvents();
 
 		// render to window
-		display();
+		{
+			PROFILE_SCOPE("display");
+			display();
+		}
 
 		// Render overlay GUI.
 		if(showUI)
@@ -560,7 +575,10 @@ int main(int argc, char* argv[])
 		}
 
 		// Render the GUI.
-		ImGui::Render();
+		{
+			PROFILE_SCOPE("ImGui::Render");
+			ImGui::Render();
+		}
 
 		// Swap front and back buffer. This frame will now been displayed.
 		SDL_GL_SwapWindow(g_window);
@@ -1,5 +1,6 @@
 #include "Model.h"
 #include "labhelper.h"
+#include "profiler.h"
 #include <iostream>
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include <tiny_obj_loader.h>
@@ -483,6 +484,7 @@ void freeModel(Model* model)
 ///////////////////////////////////////////////////////////////////////
 void render(const Model* model, const bool submitMaterials)
 {
+	PROFILE_SCOPE("labhelper::render");
 	GLint current_program = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
 
@@ -18,6 +18,7 @@
 #include <stb_image_write.h>
 
 #include "labhelper.h"
+#include "profiler.h"
 
 #include <cmath>
 #include <cstring>
@@ -51,7 +52,7 @@ namespace
 	SDL_Window* g_window;
 }
 
-SDL_Window* init_window_SDL(std::string caption, int width, int height)
+SDL_Window* init_window_SDL(std::string caption, int width, int height, bool hidden)
 {
 	// Initialize SDL
 	if(SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -81,7 +82,8 @@ SDL_Window* init_window_SDL(std::string caption, int width, int height)
 
 	// Create the window
 	SDL_Window* window = SDL_CreateWindow(caption.c_str(), SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-	                                      width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+	                                      width, height,
+	                                      SDL_WINDOW_OPENGL | (hidden ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE));
 
 	if(window == nullptr)
 	{
@@ -842,6 +844,7 @@ void saveScreenshot()
 
 void drawFullScreenQuad()
 {
+	PROFILE_SCOPE("labhelper::drawFullScreenQuad");
 	GLboolean previous_depth_state;
 	glGetBooleanv(GL_DEPTH_TEST, &previous_depth_state);
 	glDisable(GL_DEPTH_TEST);
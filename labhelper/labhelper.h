@@ -89,8 +89,10 @@ void non_fatal_error(std::string errorString, std::string title = std::string())
 
 ///////////////////////////////////////////////////////////////////////////
 /// Initialize a window, an openGL context, and initiate async debug output.
+/// A hidden window still gives a GL context, for tools that only need to
+/// load models.
 ///////////////////////////////////////////////////////////////////////////
-SDL_Window* init_window_SDL(std::string caption, int width = 1280, int height = 720);
+SDL_Window* init_window_SDL(std::string caption, int width = 1280, int height = 720, bool hidden = false);
 
 ///////////////////////////////////////////////////////////////////////////
 /// Destroys that which have been initialized.
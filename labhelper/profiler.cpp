@@ -0,0 +1,378 @@
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <vector>
+#include <imgui.h>
+
+namespace labhelper
+{
+namespace profiler
+{
+///////////////////////////////////////////////////////////////////////////
+// Per-frame totals of one scope, over the last HISTORY_SIZE frames
+///////////////////////////////////////////////////////////////////////////
+const int HISTORY_SIZE = 256;
+
+struct History
+{
+	float values[HISTORY_SIZE];
+	int count = 0, next = 0;
+	void push(float v)
+	{
+		values[next] = v;
+		next = (next + 1) % HISTORY_SIZE;
+		count = std::min(count + 1, HISTORY_SIZE);
+	}
+	float average() const
+	{
+		float sum = 0.0f;
+		for(int i = 0; i < count; i++)
+			sum += values[i];
+		return count ? sum / count : 0.0f;
+	}
+	float percentile(float p) const
+	{
+		if(count == 0)
+			return 0.0f;
+		std::vector<float> sorted(values, values + count);
+		size_t n = std::min(size_t(p * count), sorted.size() - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+		return sorted[n];
+	}
+};
+
+struct ScopeData
+{
+	std::string name;
+	int calls = 0;      // this frame
+	double cpu_ms = 0.0; // this frame
+	int last_calls = 0;
+	History cpu, gpu;
+	int last_gpu_frame = -1;
+	double gpu_ms = 0.0; // of frame last_gpu_frame
+};
+
+struct GpuQuery
+{
+	int scope;
+	GLuint begin, end;
+};
+
+struct TraceEvent
+{
+	int scope;
+	double start_us, duration_us;
+	int track; // 0 = CPU, 1 = GPU
+};
+
+bool enabled = true;
+bool tracing = false;
+int frame = 0;
+std::thread::id main_thread;
+bool has_main_thread = false;
+
+std::vector<ScopeData> scopes;
+std::map<const char*, int> scope_by_pointer;
+std::map<std::string, int> scope_by_name;
+
+// Queries issued in the current and the previous frame. A slot is read back
+// just before it's reused, one full frame after its commands were issued.
+std::vector<GpuQuery> frame_queries[2];
+int frame_query_frame[2] = { -1, -1 };
+std::vector<GLuint> free_query_objects;
+std::vector<GpuQuery> open_gpu_scopes;
+
+// GL_TIMESTAMP (ns) to trace time (us)
+double gpu_to_cpu_offset_us = 0.0;
+
+const size_t MAX_TRACE_EVENTS = 1 << 22;
+std::vector<TraceEvent> trace_events;
+bool trace_truncated = false;
+
+static double nowUs()
+{
+	typedef std::chrono::steady_clock clock;
+	static const clock::time_point start = clock::now();
+	return std::chrono::duration<double, std::micro>(clock::now() - start).count();
+}
+
+static bool onMainThread()
+{
+	return has_main_thread && std::this_thread::get_id() == main_thread;
+}
+
+static int scopeIndex(const char* name)
+{
+	auto it = scope_by_pointer.find(name);
+	if(it != scope_by_pointer.end())
+		return it->second;
+	// The same name may come from string literals in different files
+	auto named = scope_by_name.find(name);
+	int index;
+	if(named != scope_by_name.end())
+	{
+		index = named->second;
+	}
+	else
+	{
+		index = int(scopes.size());
+		scopes.push_back(ScopeData());
+		scopes.back().name = name;
+		scope_by_name[name] = index;
+	}
+	scope_by_pointer[name] = index;
+	return index;
+}
+
+static void addTraceEvent(int scope, double start_us, double duration_us, int track)
+{
+	if(!tracing)
+		return;
+	if(trace_events.size() >= MAX_TRACE_EVENTS)
+	{
+		trace_truncated = true;
+		return;
+	}
+	trace_events.push_back({ scope, start_us, duration_us, track });
+}
+
+static GLuint allocateQuery()
+{
+	if(free_query_objects.empty())
+	{
+		GLuint ids[32];
+		glGenQueries(32, ids);
+		free_query_objects.insert(free_query_objects.end(), ids, ids + 32);
+	}
+	GLuint id = free_query_objects.back();
+	free_query_objects.pop_back();
+	return id;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Read back the queries of a slot (if they are ready, which they should be
+// a frame later; otherwise they are dropped rather than waited for)
+///////////////////////////////////////////////////////////////////////////
+static void resolveQueries(int slot)
+{
+	const int query_frame = frame_query_frame[slot];
+	for(const GpuQuery& q : frame_queries[slot])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(q.end, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available)
+		{
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(q.begin, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(q.end, GL_QUERY_RESULT, &end);
+			double duration_us = double(end - begin) * 1e-3;
+			ScopeData& s = scopes[q.scope];
+			if(s.last_gpu_frame != query_frame)
+			{
+				if(s.last_gpu_frame >= 0)
+					s.gpu.push(float(s.gpu_ms));
+				s.last_gpu_frame = query_frame;
+				s.gpu_ms = 0.0;
+			}
+			s.gpu_ms += duration_us * 1e-3;
+			addTraceEvent(q.scope, double(begin) * 1e-3 + gpu_to_cpu_offset_us, duration_us, 1);
+		}
+		free_query_objects.push_back(q.begin);
+		free_query_objects.push_back(q.end);
+	}
+	frame_queries[slot].clear();
+}
+
+void beginFrame()
+{
+	if(!has_main_thread)
+	{
+		main_thread = std::this_thread::get_id();
+		has_main_thread = true;
+	}
+
+	// Close the CPU statistics of the previous frame
+	for(ScopeData& s : scopes)
+	{
+		if(s.calls > 0)
+			s.cpu.push(float(s.cpu_ms));
+		s.last_calls = s.calls;
+		s.calls = 0;
+		s.cpu_ms = 0.0;
+	}
+	open_gpu_scopes.clear();
+	frame++;
+
+	// Reuse the query slot of two frames ago
+	const int slot = frame % 2;
+	resolveQueries(slot);
+	frame_query_frame[slot] = frame;
+
+	if(enabled)
+	{
+		// Keep the GPU clock aligned with ours for the trace
+		GLint64 gpu_now = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+		gpu_to_cpu_offset_us = nowUs() - double(gpu_now) * 1e-3;
+	}
+}
+
+CpuScope::CpuScope(const char* name) : scope(-1), start(0.0)
+{
+	if(!enabled || !onMainThread())
+		return;
+	scope = scopeIndex(name);
+	start = nowUs();
+}
+
+CpuScope::~CpuScope()
+{
+	if(scope < 0)
+		return;
+	double duration_us = nowUs() - start;
+	ScopeData& s = scopes[scope];
+	s.calls++;
+	s.cpu_ms += duration_us * 1e-3;
+	addTraceEvent(scope, start, duration_us, 0);
+}
+
+GpuScope::GpuScope(const char* name) : query(-1)
+{
+	if(!enabled || !onMainThread())
+		return;
+	GpuQuery q;
+	q.scope = scopeIndex(name);
+	q.begin = allocateQuery();
+	q.end = allocateQuery();
+	glQueryCounter(q.begin, GL_TIMESTAMP);
+	query = int(open_gpu_scopes.size());
+	open_gpu_scopes.push_back(q);
+}
+
+GpuScope::~GpuScope()
+{
+	if(query < 0 || query >= int(open_gpu_scopes.size()))
+		return;
+	GpuQuery q = open_gpu_scopes[query];
+	open_gpu_scopes.resize(query);
+	glQueryCounter(q.end, GL_TIMESTAMP);
+	frame_queries[frame % 2].push_back(q);
+}
+
+void setEnabled(bool e)
+{
+	enabled = e;
+}
+
+bool isEnabled()
+{
+	return enabled;
+}
+
+void startTrace()
+{
+	trace_events.clear();
+	trace_truncated = false;
+	tracing = true;
+}
+
+static std::string jsonEscape(const std::string& s)
+{
+	std::string r;
+	for(char c : s)
+	{
+		if(c == '"' || c == '\\')
+			r += '\\';
+		r += c;
+	}
+	return r;
+}
+
+bool stopTrace(const std::string& filename)
+{
+	tracing = false;
+	std::ofstream f(filename);
+	if(!f)
+		return false;
+	f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+	f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+	char buffer[64];
+	for(const TraceEvent& e : trace_events)
+	{
+		snprintf(buffer, sizeof(buffer), "\"ts\":%.3f,\"dur\":%.3f", e.start_us, e.duration_us);
+		f << ",\n{\"name\":\"" << jsonEscape(scopes[e.scope].name) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.track
+		  << "," << buffer << "}";
+	}
+	f << "\n]}\n";
+	trace_events.clear();
+	return bool(f);
+}
+
+bool isTracing()
+{
+	return tracing;
+}
+
+void drawOverlay()
+{
+	ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+	ImGui::Checkbox("Enabled", &enabled);
+	ImGui::SameLine();
+	static std::string status;
+	if(!tracing)
+	{
+		if(ImGui::Button("Start trace"))
+		{
+			startTrace();
+			status = "Recording...";
+		}
+	}
+	else if(ImGui::Button("Stop and save trace"))
+	{
+		bool truncated = trace_truncated;
+		status = stopTrace("trace.json") ? "Wrote trace.json" : "Could not write trace.json";
+		if(truncated)
+			status += " (truncated)";
+	}
+	ImGui::SameLine();
+	ImGui::Text("%s", status.c_str());
+
+	ImGui::Text("Times in ms per frame over the last %d frames", HISTORY_SIZE);
+	ImGui::Columns(4, "profiler_columns");
+	ImGui::Separator();
+	ImGui::Text("Scope");
+	ImGui::NextColumn();
+	ImGui::Text("Calls");
+	ImGui::NextColumn();
+	ImGui::Text("CPU avg / p50 / p95 / p99");
+	ImGui::NextColumn();
+	ImGui::Text("GPU avg / p50 / p95 / p99");
+	ImGui::NextColumn();
+	ImGui::Separator();
+	for(const ScopeData& s : scopes)
+	{
+		ImGui::Text("%s", s.name.c_str());
+		ImGui::NextColumn();
+		ImGui::Text("%d", s.last_calls);
+		ImGui::NextColumn();
+		ImGui::Text("%.3f / %.3f / %.3f / %.3f", s.cpu.average(), s.cpu.percentile(0.5f), s.cpu.percentile(0.95f),
+		            s.cpu.percentile(0.99f));
+		ImGui::NextColumn();
+		if(s.gpu.count > 0)
+			ImGui::Text("%.3f / %.3f / %.3f / %.3f", s.gpu.average(), s.gpu.percentile(0.5f),
+			            s.gpu.percentile(0.95f), s.gpu.percentile(0.99f));
+		else
+			ImGui::Text("-");
+		ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
+	ImGui::Separator();
+	ImGui::End();
+}
+} // namespace profiler
+} // namespace labhelper
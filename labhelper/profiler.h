@@ -0,0 +1,97 @@
+#pragma once
+
+// A small frame profiler for the labs: scoped CPU timers, GL timer queries,
+// an ImGui overlay with per-scope statistics and export to the Chrome
+// trace-event format (open in chrome://tracing or https://ui.perfetto.dev).
+//
+// Usage:
+//   labhelper::profiler::beginFrame();     // once per frame, in the main loop
+//   {
+//       PROFILE_SCOPE("Shadow map");       // CPU and GPU time of this block
+//       ...
+//   }
+//   labhelper::profiler::drawOverlay();    // in gui()
+//
+// Scopes may nest. Only the thread that calls beginFrame() is profiled,
+// scopes on other threads are ignored.
+
+#include <string>
+#include <GL/glew.h>
+
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+
+// CPU and GPU time of the enclosing scope
+#define PROFILE_SCOPE(name) labhelper::profiler::Scope PROFILER_CONCAT(profile_scope_, __LINE__)(name)
+// CPU time only, for code that doesn't issue GL commands
+#define PROFILE_CPU_SCOPE(name) labhelper::profiler::CpuScope PROFILER_CONCAT(profile_scope_, __LINE__)(name)
+
+namespace labhelper
+{
+namespace profiler
+{
+///////////////////////////////////////////////////////////////////////////
+/// Start a new frame: close the statistics of the previous one and collect
+/// the GL query results of the frame before that. GPU times therefore
+/// show up two frames late, but reading them never stalls the pipeline.
+///////////////////////////////////////////////////////////////////////////
+void beginFrame();
+
+///////////////////////////////////////////////////////////////////////////
+/// RAII timers. `name` must outlive the profiler (use string literals).
+///////////////////////////////////////////////////////////////////////////
+class CpuScope
+{
+public:
+	explicit CpuScope(const char* name);
+	~CpuScope();
+
+private:
+	int scope;
+	double start;
+};
+
+// Wraps the scope in a pair of GL_TIMESTAMP queries
+class GpuScope
+{
+public:
+	explicit GpuScope(const char* name);
+	~GpuScope();
+
+private:
+	int query;
+};
+
+class Scope
+{
+public:
+	explicit Scope(const char* name) : cpu(name), gpu(name)
+	{
+	}
+
+private:
+	CpuScope cpu;
+	GpuScope gpu;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Enable/disable all timing (enabled by default)
+///////////////////////////////////////////////////////////////////////////
+void setEnabled(bool enabled);
+bool isEnabled();
+
+///////////////////////////////////////////////////////////////////////////
+/// ImGui window with average, p50, p95 and p99 of the CPU and GPU time of
+/// every scope over the last frames, and buttons to record a trace.
+///////////////////////////////////////////////////////////////////////////
+void drawOverlay();
+
+///////////////////////////////////////////////////////////////////////////
+/// Record every scope into a trace, and write it as Chrome trace-event
+/// JSON when stopped. Returns false if the file could not be written.
+///////////////////////////////////////////////////////////////////////////
+void startTrace();
+bool stopTrace(const std::string& filename);
+bool isTracing();
+} // namespace profiler
+} // namespace labhelper
@@ -1,5 +1,6 @@
 #include "HDRImage.h"
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace glm;
@@ -21,3 +22,21 @@ vec3 HDRImage::sample(float u, float v)
 	int y = int(v * height) % height;
 	return vec3(data[(y * width + x) * 3 + 0], data[(y * width + x) * 3 + 1], data[(y * width + x) * 3 + 2]);
 }
+
+vec3 HDRImage::sampleBilinear(float u, float v) const
+{
+	float fx = u * width - 0.5f;
+	float fy = glm::clamp(v * height - 0.5f, 0.0f, float(height - 1));
+	float x0f = floor(fx);
+	float y0f = floor(fy);
+	float wx = fx - x0f;
+	float wy = fy - y0f;
+	int x0 = ((int(x0f) % width) + width) % width;
+	int x1 = (x0 + 1) % width;
+	int y0 = int(y0f);
+	int y1 = std::min(y0 + 1, height - 1);
+	auto texel = [&](int x, int y) {
+		return vec3(data[(y * width + x) * 3 + 0], data[(y * width + x) * 3 + 1], data[(y * width + x) * 3 + 2]);
+	};
+	return mix(mix(texel(x0, y0), texel(x1, y0), wx), mix(texel(x0, y1), texel(x1, y1), wx), wy);
+}
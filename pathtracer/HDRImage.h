@@ -18,4 +18,6 @@ struct HDRImage
 	};
 	void load(const std::string& filename);
 	glm::vec3 sample(float u, float v);
+	// Bilinear lookup, wrapping in u and clamping in v
+	glm::vec3 sampleBilinear(float u, float v) const;
 };
\ No newline at end of file
@@ -6,7 +6,13 @@
 #include "material.h"
 #include "embree.h"
 #include "sampling.h"
+#include "fastmath.h"
 #include "labhelper.h"
+#include "stats.h"
+#include "bdpt.h"
+#include "sppm.h"
+#include "guiding.h"
+#include "radiance_cache.h"
 #include <random>
 
 using namespace std;
@@ -24,13 +30,83 @@ Image rendered_image;
 PointLight point_light;
 std::vector<DiscLight> disc_lights;
 
+// Material features of the current scene (see selectLi()), found again
+// when the scene or its materials change
+static weak_ptr<EmbreeScene> features_scene;
+static bool features_stale = true;
+static unsigned scene_features = 0;
+
+// Primary hit cache (settings.primary_hit_cache): the surface that the
+// camera ray of stratum s of pixel p hit is hits[p * strata^2 + s], once
+// filled[s] is set. Misses keep their direction in wo and no material.
+// A cache larger than PRIMARY_CACHE_BUDGET is not kept: at 64 bytes per
+// hit, 4 x 4 strata of a 1920 x 1080 image already take 2 GB.
+const int MAX_PRIMARY_STRATA = 4;
+const size_t PRIMARY_CACHE_BUDGET = size_t(1) << 30;
+struct PrimaryHitCache
+{
+	typedef std::vector<Intersection, default_init_allocator<Intersection>> Buffer;
+	Buffer hits;
+	vector<char> filled;
+	int width = 0, height = 0, strata = 0;
+	mat4 V, P;
+	weak_ptr<EmbreeScene> scene;
+	size_t refused = 0; // size of the last cache over the budget, reported once
+};
+static PrimaryHitCache primary_cache;
+
 ///////////////////////////////////////////////////////////////////////////
 // Restart rendering of image
 ///////////////////////////////////////////////////////////////////////////
-void restart()
+void restart(RestartReason reason)
 {
 	// No need to clear image,
 	rendered_image.number_of_samples = 0;
+	stats::resetTotal();
+	// Objects or materials may have moved or changed without the view
+	primary_cache.filled.assign(primary_cache.filled.size(), 0);
+	if(reason == LightingChanged)
+	{
+		// Materials may have become glass or emissive, see selectLi()
+		features_stale = true;
+		// Meshes may have become light sources or stopped being them
+		updateEmissiveTriangles();
+		clearRadianceCache();
+		resetGuiding();
+	}
+}
+
+RenderContext currentRenderContext()
+{
+	RenderContext context;
+	context.settings = settings;
+	context.image = rendered_image;
+	context.point_light = point_light;
+	context.disc_lights = disc_lights;
+	context.environment_multiplier = environment.multiplier;
+	context.seed = getRandomSeed();
+	context.sppm = sppm_state;
+	return context;
+}
+
+void swapRenderContext(RenderContext& context)
+{
+	std::swap(settings, context.settings);
+	std::swap(rendered_image, context.image);
+	std::swap(point_light, context.point_light);
+	disc_lights.swap(context.disc_lights);
+	std::swap(environment.multiplier, context.environment_multiplier);
+	const uint32_t seed = getRandomSeed();
+	seedRandom(context.seed);
+	context.seed = seed;
+	sppm_state.pixels.swap(context.sppm.pixels);
+	std::swap(sppm_state.width, context.sppm.width);
+	std::swap(sppm_state.height, context.sppm.height);
+	// The new render may have other materials, and must not use what was
+	// learned for the old one
+	features_stale = true;
+	clearRadianceCache();
+	resetGuiding();
 }
 
 int getSampleCount()
@@ -44,20 +120,50 @@ int getSampleCount()
 ///////////////////////////////////////////////////////////////////////////
 void resize(int w, int h)
 {
-	rendered_image.width = w / settings.subsampling;
-	rendered_image.height = h / settings.subsampling;
-	rendered_image.data.resize(rendered_image.width * rendered_image.height);
+	rendered_image.width = std::max(1, int(float(w) / settings.subsampling));
+	rendered_image.height = std::max(1, int(float(h) / settings.subsampling));
+	const size_t size = size_t(rendered_image.width) * rendered_image.height;
+	if(settings.numa_first_touch)
+	{
+		// Give the old pages back and touch the new ones from the threads
+		// that will write them in tracePaths (same static row schedule), so
+		// that the OS places each row on that thread's NUMA node.
+		Image::Buffer().swap(rendered_image.data);
+		rendered_image.data.resize(size);
+#pragma omp parallel for schedule(static)
+		for(int y = 0; y < rendered_image.height; y++)
+		{
+			for(int x = 0; x < rendered_image.width; x++)
+				rendered_image.data[y * rendered_image.width + x] = vec3(0.0f);
+		}
+	}
+	else
+	{
+		rendered_image.data.assign(size, vec3(0.0f));
+	}
 	restart();
 }
 
+void buildEnvironmentLookup()
+{
+	cout << "Resampling environment map..." << flush;
+	environment.octahedral.build(environment.map);
+	cout << "done.\n";
+}
+
 ///////////////////////////////////////////////////////////////////////////
 /// Return the radiance from a certain direction wi from the environment
 /// map.
 ///////////////////////////////////////////////////////////////////////////
 vec3 Lenvironment(const vec3& wi)
 {
-	const float theta = acos(std::max(-1.0f, std::min(1.0f, wi.y)));
-	float phi = atan(wi.z, wi.x);
+	stats::ScopedCycles timer(stats::Environment);
+	if(environment.octahedral.valid())
+	{
+		return environment.multiplier * environment.octahedral.lookup(wi);
+	}
+	const float theta = fast_acos(std::max(-1.0f, std::min(1.0f, wi.y)));
+	float phi = fast_atan2(wi.z, wi.x);
 	if(phi < 0.0f)
 		phi = phi + 2.0f * M_PI;
 	vec2 lookup = vec2(phi / (2.0 * M_PI), 1 - theta / M_PI);
@@ -65,22 +171,179 @@ vec3 Lenvironment(const vec3& wi)
 }
 
 ///////////////////////////////////////////////////////////////////////////
-/// Calculate the radiance going from one point (r.hitPosition()) in one
-/// direction (-r.d), through path tracing.
+/// Environment radiance for 8 directions at once (SoA)
+///////////////////////////////////////////////////////////////////////////
+void Lenvironment8(const float* dx, const float* dy, const float* dz, vec3* result)
+{
+	stats::ScopedCycles timer(stats::Environment);
+	if(environment.octahedral.valid())
+	{
+		environment.octahedral.lookup8(dx, dy, dz, result);
+		for(int i = 0; i < 8; i++)
+			result[i] *= environment.multiplier;
+		return;
+	}
+	for(int i = 0; i < 8; i++)
+		result[i] = Lenvironment(vec3(dx[i], dy[i], dz[i]));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The bounces of a path that path guiding learns from: where the path
+// went and how much of what it found afterwards came in that way
+///////////////////////////////////////////////////////////////////////////
+struct GuidingPath
+{
+	struct Vertex
+	{
+		GuidingRegion* region;
+		vec3 wi;
+		float pdf;
+		vec3 throughput; // up to the next vertex
+		vec3 L;          // found up to and including this vertex
+	};
+	Vertex vertices[stats::MAX_DEPTH];
+	int count = 0;
+
+	void add(GuidingRegion* region, const vec3& wi, float pdf, const vec3& throughput, const vec3& L)
+	{
+		if(count < stats::MAX_DEPTH)
+			vertices[count++] = { region, wi, pdf, throughput, L };
+	}
+
+	// Record the radiance that came in at every vertex, and return L
+	vec3 finish(const vec3& L)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			const Vertex& v = vertices[i];
+			vec3 incident(0.0f);
+			for(int c = 0; c < 3; c++)
+				incident[c] = v.throughput[c] > 0.0f ? (L[c] - v.L[c]) / v.throughput[c] : 0.0f;
+			recordGuiding(*v.region, v.wi, (incident.x + incident.y + incident.z) / (3.0f * v.pdf));
+		}
+		return L;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The opaque vertices of a path, whose outgoing radiance the radiance cache
+// learns when the path ends
+///////////////////////////////////////////////////////////////////////////
+struct CachePath
+{
+	struct Vertex
+	{
+		vec3 position;
+		vec3 normal;
+		vec3 throughput; // up to this vertex
+		vec3 L;          // found before this vertex
+	};
+	Vertex vertices[stats::MAX_DEPTH];
+	int count = 0;
+
+	void add(const vec3& position, const vec3& normal, const vec3& throughput, const vec3& L)
+	{
+		if(count < stats::MAX_DEPTH)
+			vertices[count++] = { position, normal, throughput, L };
+	}
+
+	// Record the radiance that left every vertex, and return L
+	vec3 finish(const vec3& L)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			const Vertex& v = vertices[i];
+			vec3 outgoing(0.0f);
+			for(int c = 0; c < 3; c++)
+				outgoing[c] = v.throughput[c] > 0.0f ? (L[c] - v.L[c]) / v.throughput[c] : 0.0f;
+			recordRadianceCache(v.position, v.normal, outgoing);
+		}
+		return L;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Sample the diffuse part of a bounce from an even mix of the region's
+// learned distribution and the BSDF
+///////////////////////////////////////////////////////////////////////////
+WiSample sampleGuided(const GuidingRegion& region, const Diffuse& diffuse, const vec3& wo, const vec3& n)
+{
+	WiSample r;
+	if(randf() < 0.5f)
+		r.wi = sampleGuiding(region);
+	else
+		r.wi = labhelper::tangentSpace(n) * cosineSampleHemisphere();
+	r.pdf = 0.5f * guidingPdf(region, r.wi) + 0.5f * std::max(0.0f, dot(r.wi, n)) / M_PI;
+	r.f = diffuse.f(r.wi, wo, n);
+	return r;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// What a scene may leave out of Li(). Li() is compiled for every
+// combination (li_kernels below) and tracePaths() calls the one for what
+// the current scene uses, so the tests and material loads for the rest
+// are not in its inner loop.
+///////////////////////////////////////////////////////////////////////////
+enum LiFeature
+{
+	LiGlass = 1,       // a material with m_transparency > 0
+	LiEmission = 2,    // a material with m_emission != 0
+	LiPointLight = 4,  // point_light.intensity_multiplier > 0
+	LiEnvironment = 8, // environment.multiplier > 0
+	LiAllFeatures = 15,
+};
+
+static inline float luminance(const vec3& c)
+{
+	return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A path of Li(), up to the surface current_ray hit. Copied to split it.
 ///////////////////////////////////////////////////////////////////////////
-vec3 Li(Ray& primary_ray)
+struct LiPath
 {
 	vec3 L = vec3(0.0f);
-	vec3 path_throughput = vec3(1.0);
-	Ray current_ray = primary_ray;
+	vec3 throughput = vec3(1.0f);
+	Ray current_ray;
+	// The surface current_ray hit, when it is already known
+	const Intersection* next_hit = nullptr;
+	int bounces = 0;
+	GuidingPath guiding_path;
+	CachePath cache_path;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Trace a path on from the surface its current ray hit. With split > 1,
+// the rest of the path from the first opaque surface it hits is traced
+// `split` times and averaged. The branches start again at `resume`, the
+// hit whose direct light is already in their L.
+///////////////////////////////////////////////////////////////////////////
+template<unsigned Features>
+vec3 tracePath(LiPath& path, int split, const Intersection* resume = nullptr)
+{
+	const bool has_glass = (Features & LiGlass) != 0;
+	const bool has_emission = (Features & LiEmission) != 0;
+	const bool has_point_light = (Features & LiPointLight) != 0;
+	const bool has_environment = (Features & LiEnvironment) != 0;
+	vec3& L = path.L;
+	vec3& path_throughput = path.throughput;
+	Ray& current_ray = path.current_ray;
+	const Intersection*& next_hit = path.next_hit;
+	GuidingPath& guiding_path = path.guiding_path;
+	const bool learn = isGuidingRecording();
+	CachePath& cache_path = path.cache_path;
+	const bool cache = isRadianceCacheActive();
+	const bool end_at_cache = cache && !isRadianceCacheTrainingPath();
 
 	///////////////////////////////////////////////////////////////////
 	// Get the intersection information from the ray
 	///////////////////////////////////////////////////////////////////
-	int bounces = 0;
-	for (bounces = 0;bounces < settings.max_bounces;bounces++){
+	int& bounces = path.bounces;
+	for (;bounces < settings.max_bounces;bounces++){
 		//Get the intersection information from the ray
-		Intersection hit = getIntersection(current_ray);
+		Intersection hit = resume ? *resume : next_hit ? *next_hit : getIntersection(current_ray);
+		next_hit = nullptr;
 		//Create a Material tree
 		//Diffuse diffuse(hit.material->m_color);
 		//BTDF& mat = diffuse;
@@ -92,36 +355,116 @@ vec3 Li(Ray& primary_ray)
 
 		//Glass refrection
 		
-		GlassBTDF glass(hit.material->m_ior);
+		const float transparency = has_glass ? hit.material->m_transparency : 0.0f;
+		GlassBTDF glass(has_glass ? hit.material->m_ior : 1.0f);
 		Diffuse diffuse(hit.material->m_color);
-		BTDFLinearBlend glassblend(hit.material->m_transparency, &glass, &diffuse);
-		BTDF& mat = glassblend;
-		
+		BTDFLinearBlend glassblend(transparency, &glass, &diffuse);
+		// Without glass the blend is all diffuse
+		BTDF& mat = has_glass ? static_cast<BTDF&>(glassblend) : static_cast<BTDF&>(diffuse);
+
+		// Only opaque surfaces are cached, glass looks too different from
+		// every direction
+		if(!resume && cache && transparency == 0.0f)
+		{
+			vec3 cached;
+			if(end_at_cache && bounces >= settings.radiance_cache_bounces
+			   && lookupRadianceCache(hit.position, hit.shading_normal, cached))
+			{
+				stats::local().cache_terminations++;
+				stats::recordDepth(bounces + 1);
+				return cache_path.finish(guiding_path.finish(L + path_throughput * cached));
+			}
+			cache_path.add(hit.position, hit.shading_normal, path_throughput, L);
+		}
+
 		//Calculate direct illumination
-		Ray hit2lightray;
-		hit2lightray.o = hit.position + EPSILON * hit.shading_normal;
-		hit2lightray.d = normalize(point_light.position - hit.position);
-		if (!occluded(hit2lightray)) {
-			const float distance_to_light = length(point_light.position - hit.position);
-			const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
-			vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
-			vec3 wi = normalize(point_light.position - hit.position);
-			L += path_throughput * mat.f(wi, hit.wo, hit.shading_normal) * Li * std::max(0.0f, dot(wi, hit.shading_normal));
-		}
-		L += path_throughput * hit.material->m_emission;
+		if(!resume && has_point_light)
+		{
+			Ray hit2lightray;
+			hit2lightray.o = hit.position + EPSILON * hit.shading_normal;
+			hit2lightray.d = normalize(point_light.position - hit.position);
+			if (!occluded(hit2lightray)) {
+				stats::ScopedCycles timer(stats::Shading);
+				const float distance_to_light = length(point_light.position - hit.position);
+				const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
+				vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
+				vec3 wi = normalize(point_light.position - hit.position);
+				L += path_throughput * mat.f(wi, hit.wo, hit.shading_normal) * Li
+				     * std::max(0.0f, dot(wi, hit.shading_normal));
+			}
+		}
+		if(!resume && has_emission)
+			L += path_throughput * hit.material->m_emission;
+		resume = nullptr;
+
+		// Split at the first opaque surface, glass in front of it has only
+		// one way on. The vertices up to here are recorded once, with the
+		// average of the branches, each branch only records its own.
+		if(split > 1 && transparency == 0.0f)
+		{
+			vec3 sum(0.0f);
+			for(int i = 0; i < split; i++)
+			{
+				LiPath branch = path;
+				branch.guiding_path.count = 0;
+				branch.cache_path.count = 0;
+				sum += tracePath<Features>(branch, 1, &hit);
+			}
+			return cache_path.finish(guiding_path.finish(sum / float(split)));
+		}
 
 		//sample an incoming direction
-		WiSample r = mat.sample_wi(hit.wo, hit.shading_normal);
+		WiSample r;
+		GuidingRegion* region = findGuidingRegion(hit.position);
+		bool diffuse_bounce = false;
+		{
+			stats::ScopedCycles timer(stats::Shading);
+			if(region)
+			{
+				// Same lobe choice as glassblend, so that the diffuse one can
+				// be guided
+				diffuse_bounce = !has_glass || randf() >= transparency;
+				if(!diffuse_bounce)
+					r = glass.sample_wi(hit.wo, hit.shading_normal);
+				else if(hasGuidingDistribution(*region))
+					r = sampleGuided(*region, diffuse, hit.wo, hit.shading_normal);
+				else
+					r = diffuse.sample_wi(hit.wo, hit.shading_normal);
+			}
+			else
+			{
+				r = mat.sample_wi(hit.wo, hit.shading_normal);
+			}
+		}
 		//if the pdf is too close to zero,the current path is unlikely to exist
 		//avoid numerical instability
 		if (r.pdf<EPSILON) {
-			return L;
+			stats::local().pdf_terminations++;
+			stats::recordDepth(bounces + 1);
+			return cache_path.finish(guiding_path.finish(L));
 		}
 		float cosineterm = abs(dot(r.wi, hit.shading_normal));
 		path_throughput = path_throughput * (r.f * cosineterm) / r.pdf;
 		if (path_throughput == vec3(0.0f, 0.0f, 0.0f)) {
-			return L;
+			stats::recordDepth(bounces + 1);
+			return cache_path.finish(guiding_path.finish(L));
+		}
+		// Russian roulette: from roulette_depth bounces on, go on with a
+		// probability that follows the throughput, and weight the paths that
+		// do up by as much, so that the estimate stays unbiased
+		if(settings.russian_roulette && bounces >= settings.roulette_depth)
+		{
+			const float q = std::min(1.0f, luminance(path_throughput));
+			if(randf() >= q)
+			{
+				stats::local().roulette_terminations++;
+				stats::recordDepth(bounces + 1);
+				return cache_path.finish(guiding_path.finish(L));
+			}
+			path_throughput /= q;
 		}
+		if(learn && diffuse_bounce)
+			guiding_path.add(region, r.wi, r.pdf, path_throughput, L);
 		// Create next ray on path
 		Ray currentray;
 		current_ray = currentray;
@@ -133,11 +476,17 @@ vec3 Li(Ray& primary_ray)
 		else
 			current_ray.o += EPSILON * hit.geometry_normal;
 		//if there no intersection add environment contribution and finish
-		if (!intersect(current_ray))
-			return L + path_throughput * Lenvironment(current_ray.d);
+		stats::local().extension_rays++;
+		if (!intersect(current_ray)) {
+			stats::recordDepth(bounces + 1);
+			if(has_environment)
+				L += path_throughput * Lenvironment(current_ray.d);
+			return cache_path.finish(guiding_path.finish(L));
+		}
 
 	}
-	return L;
+	stats::recordDepth(bounces);
+	return cache_path.finish(guiding_path.finish(L));
 	//Intersection hit = getIntersection(current_ray);
 	/////////////////////////////////////////////////////////////////////
 	//// Create a Material tree for evaluating brdfs and calculating
@@ -176,6 +525,63 @@ vec3 Li(Ray& primary_ray)
 	//return L;
 }
 
+///////////////////////////////////////////////////////////////////////////
+/// Calculate the radiance going from one point (primary_hit.position) in
+/// one direction (primary_hit.wo), through path tracing.
+///////////////////////////////////////////////////////////////////////////
+template<unsigned Features>
+vec3 Li(const Intersection& primary_hit)
+{
+	LiPath path;
+	path.next_hit = &primary_hit;
+	return tracePath<Features>(path, std::max(1, settings.split_paths));
+}
+
+typedef vec3 (*LiFunction)(const Intersection& primary_hit);
+const LiFunction li_kernels[LiAllFeatures + 1] = {
+	Li<0>, Li<1>, Li<2>,  Li<3>,  Li<4>,  Li<5>,  Li<6>,  Li<7>,
+	Li<8>, Li<9>, Li<10>, Li<11>, Li<12>, Li<13>, Li<14>, Li<15>,
+};
+
+static unsigned materialFeatures(const labhelper::Material& m)
+{
+	return (m.m_transparency > 0.0f ? unsigned(LiGlass) : 0u)
+	       | (m.m_emission != vec3(0.0f) ? unsigned(LiEmission) : 0u);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The version of Li() for the current scene and lights
+///////////////////////////////////////////////////////////////////////////
+static LiFunction selectLi()
+{
+	if(!settings.specialize_li)
+		return li_kernels[LiAllFeatures];
+	const shared_ptr<EmbreeScene> scene = getCurrentScene();
+	if(features_stale || features_scene.lock() != scene)
+	{
+		unsigned features = 0;
+		if(scene)
+		{
+			for(const auto& m : scene->geom_ID_to_mesh)
+			{
+				const labhelper::Model* model = scene->geom_ID_to_model.at(m.first);
+				features |= materialFeatures(model->m_materials[m.second->m_material_idx]);
+			}
+			for(const auto& g : scene->geom_ID_to_primitives)
+				for(const Primitive& p : g.second)
+					features |= materialFeatures(*p.material);
+		}
+		features_scene = scene;
+		features_stale = false;
+		scene_features = features;
+	}
+	// The lights are cheap to look at, and can be changed without restart()
+	unsigned features = scene_features;
+	features |= point_light.intensity_multiplier > 0.0f ? unsigned(LiPointLight) : 0u;
+	features |= environment.multiplier > 0.0f ? unsigned(LiEnvironment) : 0u;
+	return li_kernels[features];
+}
+
 ///////////////////////////////////////////////////////////////////////////
 /// Used to homogenize points transformed with projection matrices
 ///////////////////////////////////////////////////////////////////////////
@@ -184,6 +590,77 @@ inline static glm::vec3 homogenize(const glm::vec4& p)
 	return glm::vec3(p * (1.f / p.w));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// The camera rays of a pass with the primary hit cache: the stratum of
+// each pixel they go through, and its cached hits (laid out with a stride
+// of strata^2 per pixel), which are still to be traced if `fill`
+///////////////////////////////////////////////////////////////////////////
+struct PrimaryPass
+{
+	Intersection* hits = nullptr; // nullptr: no cache, jitter over the pixel
+	int strata = 1;
+	int stratum = 0;
+	bool fill = false;
+};
+
+static PrimaryPass beginPrimaryPass(const mat4& V, const mat4& P, int sample_index)
+{
+	PrimaryHitCache& c = primary_cache;
+	PrimaryPass pass;
+	if(!settings.primary_hit_cache)
+	{
+		if(!c.hits.empty())
+		{
+			PrimaryHitCache::Buffer().swap(c.hits);
+			c.filled.clear();
+			c.strata = 0;
+		}
+		return pass;
+	}
+	pass.strata = std::max(1, std::min(settings.primary_strata, MAX_PRIMARY_STRATA));
+	const int count = pass.strata * pass.strata;
+	const size_t size = size_t(rendered_image.width) * rendered_image.height * count;
+	if(size * sizeof(Intersection) > PRIMARY_CACHE_BUDGET)
+	{
+		if(c.refused != size)
+		{
+			cout << "Camera ray hits not cached: " << ((size * sizeof(Intersection)) >> 20) << " MB is over "
+			     << (PRIMARY_CACHE_BUDGET >> 20) << " MB, use fewer strata or a smaller image" << endl;
+			c.refused = size;
+		}
+		PrimaryHitCache::Buffer().swap(c.hits);
+		c.filled.clear();
+		c.strata = 0;
+		return PrimaryPass();
+	}
+	c.refused = 0;
+	const shared_ptr<EmbreeScene> scene = getCurrentScene();
+	if(c.width != rendered_image.width || c.height != rendered_image.height || c.strata != pass.strata
+	   || c.V != V || c.P != P || c.scene.lock() != scene)
+	{
+		// Left untouched until the render threads fill them, see resize()
+		if(c.hits.size() != size)
+			PrimaryHitCache::Buffer(size).swap(c.hits);
+		c.filled.assign(count, 0);
+		c.width = rendered_image.width;
+		c.height = rendered_image.height;
+		c.strata = pass.strata;
+		c.V = V;
+		c.P = P;
+		c.scene = scene;
+	}
+	pass.stratum = sample_index % count;
+	pass.fill = !c.filled[pass.stratum];
+	pass.hits = &c.hits[pass.stratum];
+	return pass;
+}
+
+static void endPrimaryPass(const PrimaryPass& pass)
+{
+	if(pass.hits && pass.fill)
+		primary_cache.filled[pass.stratum] = 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 /// Trace one path per pixel and accumulate the result in an image
 ///////////////////////////////////////////////////////////////////////////
@@ -195,53 +672,176 @@ void tracePaths(const glm::mat4& V, const glm::mat4& P)
 	{
 		return;
 	}
-	vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
-	// Trace one path per pixel (the omp parallel stuf magically distributes the
-	// pathtracing on all cores of your CPU).
-	int num_rays = 0;
-	vector<vec4> local_image(rendered_image.width * rendered_image.height, vec4(0.0f));
+	tracePaths(V, P, rendered_image.number_of_samples);
+}
 
-#pragma omp parallel for
-	for(int y = 0; y < rendered_image.height; y++)
+///////////////////////////////////////////////////////////////////////////
+// Trace sample `sample_index` of the pixels of row y of an image seen
+// through V and P, and accumulate it
+///////////////////////////////////////////////////////////////////////////
+static void traceRow(Image& image, const mat4& V, const mat4& P, const vec3& camera_pos, int y,
+                     int sample_index, LiFunction li, const PrimaryPass& primary)
+{
+	const int strata_per_pixel = primary.strata * primary.strata;
+	// Accumulate the obtained radiance to the pixels color
+	const float n = float(image.number_of_samples);
+	auto accumulate = [&image, n](int pixel, const vec3& color) {
+		image.data[pixel] = image.data[pixel] * (n / (n + 1.0f)) + (1.0f / (n + 1.0f)) * color;
+	};
+
+	// Primary rays that miss the scene are collected and looked up in
+	// the environment 8 at a time.
+	int miss_pixel[8];
+	float miss_dx[8], miss_dy[8], miss_dz[8];
+	vec3 miss_color[8];
+	int num_misses = 0;
+
+	for(int x = 0; x < image.width; x++)
 	{
-		for(int x = 0; x < rendered_image.width; x++)
+		const int pixel = y * image.width + x;
+		beginSample(uint32_t(pixel), uint32_t(sample_index));
+		Intersection* cached = primary.hits ? primary.hits + size_t(pixel) * strata_per_pixel : nullptr;
+		Intersection traced;
+		const Intersection* hit = nullptr;
+		vec3 direction;
+		if(cached && !primary.fill)
+		{
+			stats::local().reused_camera_rays++;
+			hit = cached->material ? cached : nullptr;
+			direction = -cached->wo;
+		}
+		else
 		{
-			vec3 color;
 			Ray primaryRay;
 			primaryRay.o = camera_pos;
 			// Create a ray that starts in the camera position and points toward
 			// the current pixel on a virtual screen.
 			//Task1: Random offset within the pixel
-			// Jittered screen coordinates
+			// Jittered screen coordinates, within the stratum of this pass
+			// when the hits are cached
+			vec2 jitter = vec2(randf(), randf());
+			if(cached)
+			{
+				const vec2 stratum(primary.stratum % primary.strata, primary.stratum / primary.strata);
+				jitter = (stratum + jitter) / float(primary.strata);
+			}
 			vec2 screenCoord = vec2(
-				(float(x) + randf()) / float(rendered_image.width),
-				(float(y) + randf()) / float(rendered_image.height)
+				(float(x) + jitter.x) / float(image.width),
+				(float(y) + jitter.y) / float(image.height)
 			);
 
-			//vec2 screenCoord = vec2(float(x) / float(rendered_image.width),
-			//                        float(y) / float(rendered_image.height));
+			//vec2 screenCoord = vec2(float(x) / float(image.width),
+			//                        float(y) / float(image.height));
 			// Calculate direction
 			vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f, screenCoord.y * 2.0f - 1.0f, 1.0f, 1.0f);
 			vec3 p = homogenize(inverse(P * V) * viewCoord);
 			primaryRay.d = normalize(p - camera_pos);
+			direction = primaryRay.d;
 			// Intersect ray with scene
+			stats::local().camera_rays++;
 			if(intersect(primaryRay))
 			{
-				// If it hit something, evaluate the radiance from that point
-				color = Li(primaryRay);
+				traced = getIntersection(primaryRay);
+				hit = &traced;
 			}
-			else
+			if(cached)
+			{
+				*cached = hit ? traced : Intersection();
+				cached->wo = -direction;
+			}
+		}
+		if(hit)
+		{
+			// If it hit something, evaluate the radiance from that point
+			accumulate(pixel, li(*hit));
+		}
+		else
+		{
+			// Otherwise evaluate environment (batched)
+			stats::recordDepth(0);
+			miss_pixel[num_misses] = pixel;
+			miss_dx[num_misses] = direction.x;
+			miss_dy[num_misses] = direction.y;
+			miss_dz[num_misses] = direction.z;
+			if(++num_misses == 8)
 			{
-				// Otherwise evaluate environment
-				color = Lenvironment(primaryRay.d);
+				Lenvironment8(miss_dx, miss_dy, miss_dz, miss_color);
+				for(int i = 0; i < 8; i++)
+					accumulate(miss_pixel[i], miss_color[i]);
+				num_misses = 0;
 			}
-			// Accumulate the obtained radiance to the pixels color
-			float n = float(rendered_image.number_of_samples);
-			rendered_image.data[y * rendered_image.width + x] =
-			    rendered_image.data[y * rendered_image.width + x] * (n / (n + 1.0f))
-			    + (1.0f / (n + 1.0f)) * color;
 		}
 	}
+	for(int i = 0; i < num_misses; i++)
+	{
+		accumulate(miss_pixel[i], Lenvironment(vec3(miss_dx[i], miss_dy[i], miss_dz[i])));
+	}
+}
+
+void tracePaths(const glm::mat4& V, const glm::mat4& P, int sample_index)
+{
+	updateBVH();
+	stats::beginFrame();
+	prepareRandomThreads();
+	if(settings.integrator == Bidirectional || settings.integrator == PhotonMapping)
+	{
+		if(settings.integrator == Bidirectional)
+			traceBidirectional(V, P, sample_index);
+		else
+			traceSPPM(V, P, sample_index);
+		rendered_image.number_of_samples += 1;
+		stats::endFrame();
+		return;
+	}
+	const LiFunction li = selectLi();
+	const PrimaryPass primary = beginPrimaryPass(V, P, sample_index);
+	beginGuidingPass();
+	beginRadianceCachePass();
+	vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	// Trace one path per pixel (the omp parallel stuf magically distributes the
+	// pathtracing on all cores of your CPU).
+
+	// Rows are scheduled statically, matching the first-touch
+	// initialization in resize().
+#pragma omp parallel for schedule(static)
+	for(int y = 0; y < rendered_image.height; y++)
+	{
+		traceRow(rendered_image, V, P, camera_pos, y, sample_index, li, primary);
+	}
+	endPrimaryPass(primary);
+	endRadianceCachePass();
+	endGuidingPass();
 	rendered_image.number_of_samples += 1;
+	stats::endFrame();
+}
+
+void tracePaths(std::vector<View>& views, int sample_index)
+{
+	updateBVH();
+	stats::beginFrame();
+	prepareRandomThreads();
+	const LiFunction li = selectLi();
+	const PrimaryPass primary = PrimaryPass();
+	vector<vec3> camera_pos(views.size());
+	vector<std::pair<int, int>> rows;
+	for(size_t i = 0; i < views.size(); i++)
+	{
+		camera_pos[i] = vec3(glm::inverse(views[i].V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		for(int y = 0; y < views[i].image.height; y++)
+			rows.push_back(std::make_pair(int(i), y));
+	}
+	// The rows of all views in one loop, handed out as threads become
+	// free, so that the threads done with one view take rows of the others
+	// instead of waiting for the slowest row of each view in turn.
+#pragma omp parallel for schedule(dynamic)
+	for(int r = 0; r < int(rows.size()); r++)
+	{
+		View& view = views[rows[r].first];
+		traceRow(view.image, view.V, view.P, camera_pos[rows[r].first], rows[r].second, sample_index, li,
+		         primary);
+	}
+	for(View& view : views)
+		view.image.number_of_samples += 1;
+	stats::endFrame();
 }
 }; // namespace pathtracer
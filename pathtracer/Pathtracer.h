@@ -1,9 +1,13 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <memory>
+#include <utility>
 #include <vector>
 #include <Model.h>
 #include <omp.h>
 #include "HDRImage.h"
+#include "envmap.h"
+#include "sppm.h"
 
 #ifdef M_PI
 #undef M_PI
@@ -21,31 +25,125 @@ namespace pathtracer
 ///////////////////////////////////////////////////////////////////////////////
 // Path Tracer settings
 ///////////////////////////////////////////////////////////////////////////////
-extern struct Settings
+enum Integrator
 {
-	int subsampling;
+	PathTracing,
+	Bidirectional, // see bdpt.h
+	PhotonMapping, // see sppm.h
+};
+
+struct Settings
+{
+	// Algorithm used by tracePaths()
+	Integrator integrator;
+	// Sample indirect bounces of Li() partly from learned incident radiance
+	// (see guiding.h)
+	bool path_guiding;
+	// Let Li() end paths at a cached estimate of the radiance leaving the
+	// surface they hit, from bounce radiance_cache_bounces on (see
+	// radiance_cache.h). Biased.
+	bool radiance_cache;
+	int radiance_cache_bounces;
+	// Use the version of Li() compiled without the features (glass,
+	// emission, point light, environment) that the scene does not use,
+	// instead of the one that tests for all of them
+	bool specialize_li;
+	// Let Li() end paths at random from roulette_depth bounces on, with a
+	// probability that grows as their throughput drops (unbiased)
+	bool russian_roulette;
+	int roulette_depth;
+	// Trace this many continuations of each path from the first opaque
+	// surface it hits, and average them (1 = no splitting)
+	int split_paths;
+	// Keep the surface each camera ray hit and start the paths of later
+	// passes there instead of tracing the camera ray again. Pixels are
+	// then sampled at primary_strata x primary_strata fixed positions (one
+	// per pass, in turn), each chosen at random in its stratum when it is
+	// first traced. The hits are kept until restart(). At most 4 strata,
+	// and not cached at all if the hits would take more than 1 GB.
+	bool primary_hit_cache;
+	int primary_strata;
+	// Let buildPathtracerScene() start with a quickly built BVH, and swap
+	// in a high-quality one when its background build is done (see
+	// reinitScene())
+	bool preview_bvh;
+	// Window pixels per image pixel, along each axis
+	float subsampling;
 	int max_bounces;
 	int max_paths_per_pixel;
+	// Let the render threads initialize the image rows they render, so that
+	// on NUMA machines the pages end up on their node (see resize())
+	bool numa_first_touch;
+	// Interactive viewer: choose `subsampling` so that tracing a frame
+	// takes about target_frame_ms (see resolution.h), and upscale with a
+	// depth/normal guided filter instead of nearest neighbour
+	bool dynamic_resolution;
+	float target_frame_ms;
+	bool edge_aware_upscaling;
+	// Interactive viewer: while the camera moves, trace at most
+	// motion_max_bounces bounces (1 = direct light only) at
+	// motion_subsampling times coarser resolution. The camera counts as
+	// moving when it moved more than motion_threshold (world units plus
+	// radians) since the last frame, and as settled again once it has been
+	// still for settle_ms.
+	bool motion_adaptive;
+	int motion_max_bounces;
+	float motion_subsampling;
+	float motion_threshold;
+	float settle_ms;
 };
 extern Settings settings;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
 ///////////////////////////////////////////////////////////////////////////////
-extern struct Environment
+struct Environment
 {
 	float multiplier;
 	HDRImage map;
+	// `map` resampled for fast lookups, see buildEnvironmentLookup()
+	OctahedralMap octahedral;
 };
 extern Environment environment;
 
+///////////////////////////////////////////////////////////////////////////
+// Allocator that leaves elements default-initialized (i.e. untouched for
+// vec3) when a vector is resized, so that whoever writes them first decides
+// where the pages are placed.
+///////////////////////////////////////////////////////////////////////////
+template<class T>
+struct default_init_allocator : public std::allocator<T>
+{
+	template<class U>
+	struct rebind
+	{
+		typedef default_init_allocator<U> other;
+	};
+	default_init_allocator() = default;
+	template<class U>
+	default_init_allocator(const default_init_allocator<U>&)
+	{
+	}
+	template<class U>
+	void construct(U* p)
+	{
+		::new(static_cast<void*>(p)) U;
+	}
+	template<class U, class... Args>
+	void construct(U* p, Args&&... args)
+	{
+		::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+	}
+};
+
 ///////////////////////////////////////////////////////////////////////////
 // The rendered image
 ///////////////////////////////////////////////////////////////////////////
-extern struct Image
+struct Image
 {
+	typedef std::vector<glm::vec3, default_init_allocator<glm::vec3>> Buffer;
 	int width, height, number_of_samples = 0;
-	std::vector<glm::vec3> data;
+	Buffer data;
 	float* getPtr()
 	{
 		return &data[0].x;
@@ -75,9 +173,26 @@ struct DiscLight
 extern std::vector<DiscLight> disc_lights;
 
 ///////////////////////////////////////////////////////////////////////////
-/// Restart rendering of image
+/// Resample environment.map into the representation used for lookups.
+/// Call after loading a new environment map.
+///////////////////////////////////////////////////////////////////////////
+void buildEnvironmentLookup();
+
+///////////////////////////////////////////////////////////////////////////
+/// Radiance arriving from the environment map in direction wi
 ///////////////////////////////////////////////////////////////////////////
-void restart();
+vec3 Lenvironment(const vec3& wi);
+
+///////////////////////////////////////////////////////////////////////////
+/// Restart rendering of image. When the lighting changed (light sources,
+/// environment or materials), what was learned about it is forgotten too.
+///////////////////////////////////////////////////////////////////////////
+enum RestartReason
+{
+	ViewChanged,
+	LightingChanged,
+};
+void restart(RestartReason reason = ViewChanged);
 
 ///////////////////////////////////////////////////////////////////////////
 /// Get the amount of samples taken in the current image
@@ -94,4 +209,60 @@ void resize(int w, int h);
 /// Trace one path per pixel
 ///////////////////////////////////////////////////////////////////////////
 void tracePaths(const mat4& V, const mat4& P);
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace sample number `sample_index` of every pixel and add it to
+/// rendered_image. The random numbers of a path only depend on the seed,
+/// the pixel and `sample_index` (see beginSample()), so a render can be
+/// split by sample index over several processes and merged afterwards.
+///////////////////////////////////////////////////////////////////////////
+void tracePaths(const mat4& V, const mat4& P, int sample_index);
+
+///////////////////////////////////////////////////////////////////////////
+/// Several cameras looking at the current scene, each with its own image
+/// (of any size, its data sized width * height by the caller)
+///////////////////////////////////////////////////////////////////////////
+struct View
+{
+	mat4 V, P;
+	Image image;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace sample number `sample_index` of every pixel of every view, in one
+/// parallel loop over the rows of all of them, and add it to their images.
+/// A pixel gets the same path as from the single view tracePaths() with
+/// the same camera. Path tracing only, without path guiding, the radiance
+/// cache or the primary hit cache, which learn about one camera.
+///////////////////////////////////////////////////////////////////////////
+void tracePaths(std::vector<View>& views, int sample_index);
+
+///////////////////////////////////////////////////////////////////////////
+/// The globals that make up one render: settings, rendered_image, the
+/// point and disc lights, the environment multiplier, the random seed and
+/// the photon mapping state. A program can queue several renders and
+/// let them take turns, by giving each a context and swapping it in
+/// around its tracePaths() calls (see server.cpp). They still run one at
+/// a time, on the thread that swaps: the integrators work on the globals,
+/// so two renders cannot trace at once. The scene is not part of it, make
+/// it current with buildPathtracerScene(). What path guiding and the
+/// radiance cache learned belongs to the render it was learned in and is
+/// forgotten on every swap.
+///////////////////////////////////////////////////////////////////////////
+struct RenderContext
+{
+	Settings settings;
+	Image image;
+	PointLight point_light;
+	std::vector<DiscLight> disc_lights;
+	float environment_multiplier;
+	uint32_t seed;
+	SPPMState sppm;
+};
+
+// A copy of the current globals, image included
+RenderContext currentRenderContext();
+
+// Exchange the globals with `context`. Not thread safe, see above.
+void swapRenderContext(RenderContext& context);
 }; // namespace pathtracer
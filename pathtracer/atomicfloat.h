@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A float that many threads add to (guiding.cpp, radiance_cache.cpp).
+// Copies and assignments are relaxed loads and stores, only for whoever
+// owns the data while nobody adds.
+///////////////////////////////////////////////////////////////////////////
+struct AtomicFloat
+{
+	std::atomic<float> value;
+
+	AtomicFloat(float v = 0.0f) : value(v)
+	{
+	}
+	AtomicFloat(const AtomicFloat& o) : value(o.get())
+	{
+	}
+	AtomicFloat& operator=(const AtomicFloat& o)
+	{
+		value.store(o.get(), std::memory_order_relaxed);
+		return *this;
+	}
+	AtomicFloat& operator=(float v)
+	{
+		value.store(v, std::memory_order_relaxed);
+		return *this;
+	}
+	float get() const
+	{
+		return value.load(std::memory_order_relaxed);
+	}
+	void add(float v)
+	{
+		float old = value.load(std::memory_order_relaxed);
+		while(!value.compare_exchange_weak(old, old + v, std::memory_order_relaxed))
+			;
+	}
+};
+} // namespace pathtracer
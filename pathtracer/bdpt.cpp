@@ -0,0 +1,589 @@
+#include "bdpt.h"
+#include <algorithm>
+#include <vector>
+#include <labhelper.h>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "lights.h"
+#include "material.h"
+#include "sampling.h"
+#include "stats.h"
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+namespace
+{
+///////////////////////////////////////////////////////////////////////////
+// The pinhole camera, with its importance We = 1 / (A cos^4) for an image
+// plane of area A at distance 1, so that light tracing contributions
+// splatted per pass add up to the pixel values.
+///////////////////////////////////////////////////////////////////////////
+struct Camera
+{
+	vec3 position;
+	vec3 forward;
+	mat4 view_projection;
+	mat4 inverse_view_projection;
+	float image_area;
+	int width, height;
+
+	// Pixel that direction w from the camera goes through, false if none
+	bool raster(const vec3& w, int& x, int& y) const
+	{
+		vec4 clip = view_projection * vec4(position + w, 1.0f);
+		if(clip.w <= 0.0f)
+			return false;
+		float sx = (clip.x / clip.w) * 0.5f + 0.5f;
+		float sy = (clip.y / clip.w) * 0.5f + 0.5f;
+		if(sx < 0.0f || sx >= 1.0f || sy < 0.0f || sy >= 1.0f)
+			return false;
+		x = std::min(int(sx * width), width - 1);
+		y = std::min(int(sy * height), height - 1);
+		return true;
+	}
+
+	float We(const vec3& w) const
+	{
+		int x, y;
+		float c = dot(w, forward);
+		if(c <= 0.0f || !raster(w, x, y))
+			return 0.0f;
+		return 1.0f / (image_area * c * c * c * c);
+	}
+
+	float pdfDir(const vec3& w) const
+	{
+		int x, y;
+		float c = dot(w, forward);
+		if(c <= 0.0f || !raster(w, x, y))
+			return 0.0f;
+		return 1.0f / (image_area * c * c * c);
+	}
+};
+Camera camera;
+
+///////////////////////////////////////////////////////////////////////////
+// Path vertices. Densities are stored in area measure: pdf_fwd of sampling
+// the vertex from the previous one on its subpath, pdf_rev of sampling it
+// from the next one (i.e. in the other direction).
+///////////////////////////////////////////////////////////////////////////
+enum VertexType
+{
+	CameraVertex,
+	LightVertex,
+	SurfaceVertex,
+};
+
+struct Vertex
+{
+	VertexType type;
+	vec3 p;
+	vec3 ng; // zero for the camera and the point light
+	vec3 ns;
+	vec3 wo; // towards the previous vertex on the subpath
+	vec3 beta;
+	const labhelper::Material* material;
+	int light; // index in `lights` of light vertices and emissive surfaces, else -1
+	bool delta;
+	float pdf_fwd, pdf_rev;
+
+	bool onSurface() const
+	{
+		return ng != vec3(0.0f);
+	}
+};
+
+Vertex makeVertex(VertexType type, const vec3& p, const vec3& beta)
+{
+	Vertex v;
+	v.type = type;
+	v.p = p;
+	v.ng = v.ns = v.wo = vec3(0.0f);
+	v.beta = beta;
+	v.material = nullptr;
+	v.light = -1;
+	v.delta = false;
+	v.pdf_fwd = v.pdf_rev = 0.0f;
+	return v;
+}
+
+// Same material model as Li(): a blend of GlassBTDF and Diffuse. Only the
+// diffuse part can be connected to.
+bool isConnectible(const Vertex& v)
+{
+	if(v.type == SurfaceVertex)
+		return v.material->m_transparency < 1.0f;
+	return true;
+}
+
+bool isDeltaLight(const Vertex& v)
+{
+	return v.type == LightVertex && lights[v.light].type == PointLightSource;
+}
+
+vec3 surfaceF(const Vertex& v, const vec3& wi)
+{
+	Diffuse diffuse(v.material->m_color);
+	return (1.0f - v.material->m_transparency) * diffuse.f(wi, v.wo, v.ns);
+}
+
+// Density of sampling wi at v (solid angle), for the non-specular part
+float surfacePdf(const Vertex& v, const vec3& wi)
+{
+	return (1.0f - v.material->m_transparency) * std::max(0.0f, dot(wi, v.ns)) / M_PI;
+}
+
+vec3 f(const Vertex& v, const Vertex& next)
+{
+	if(v.type != SurfaceVertex)
+		return vec3(0.0f);
+	return surfaceF(v, normalize(next.p - v.p));
+}
+
+float convertDensity(float pdf, const Vertex& from, const Vertex& next)
+{
+	vec3 w = next.p - from.p;
+	float inv_dist2 = 1.0f / dot(w, w);
+	if(next.onSurface())
+		pdf *= abs(dot(next.ng, w * sqrt(inv_dist2)));
+	return pdf * inv_dist2;
+}
+
+// Density (area measure) of `v`, lit as a light source, emitting towards `to`
+float pdfLight(const Vertex& v, const Vertex& to)
+{
+	vec3 w = to.p - v.p;
+	float inv_dist2 = 1.0f / dot(w, w);
+	w *= sqrt(inv_dist2);
+	float pdf_pos, pdf_dir;
+	lightPdfLe(lights[v.light], v.ng, w, pdf_pos, pdf_dir);
+	float pdf = pdf_dir * inv_dist2;
+	if(to.onSurface())
+		pdf *= abs(dot(to.ng, w));
+	return pdf;
+}
+
+// Density (area measure) of choosing `v` as the start of a light path
+float pdfLightOrigin(const Vertex& v, const Vertex& to)
+{
+	float pdf_pos, pdf_dir;
+	lightPdfLe(lights[v.light], v.ng, normalize(to.p - v.p), pdf_pos, pdf_dir);
+	return pdf_pos * lights[v.light].selection_pdf;
+}
+
+// Density (area measure) of sampling `next` from `v`, having come from `prev`
+float pdf(const Vertex& v, const Vertex* prev, const Vertex& next)
+{
+	if(v.type == LightVertex)
+		return pdfLight(v, next);
+	vec3 wn = normalize(next.p - v.p);
+	float pdf_dir = v.type == CameraVertex ? camera.pdfDir(wn) : surfacePdf(v, wn);
+	(void)prev; // The diffuse density doesn't depend on where we came from
+	return convertDensity(pdf_dir, v, next);
+}
+
+bool visible(const Vertex& a, const Vertex& b)
+{
+	vec3 d = b.p - a.p;
+	float dist = length(d);
+	d /= dist;
+	Ray ray;
+	ray.o = a.p;
+	if(a.onSurface())
+		ray.o += (dot(d, a.ng) < 0.0f ? -EPSILON : EPSILON) * a.ng;
+	ray.d = d;
+	ray.tfar = dist * (1.0f - 1e-3f);
+	return !occluded(ray);
+}
+
+float G(const Vertex& a, const Vertex& b)
+{
+	vec3 d = a.p - b.p;
+	float g = 1.0f / dot(d, d);
+	d *= sqrt(g);
+	if(a.onSurface())
+		g *= abs(dot(a.ns, d));
+	if(b.onSurface())
+		g *= abs(dot(b.ns, d));
+	return visible(a, b) ? g : 0.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Extend a subpath from path[-1] by up to max_depth surface vertices.
+// Camera paths (`radiance`) add what they see of the environment when they
+// leave the scene to `L`: no other strategy can create those paths.
+///////////////////////////////////////////////////////////////////////////
+int randomWalk(Ray ray, vec3 beta, float pdf_dir, int max_depth, bool radiance, Vertex* path, vec3& L)
+{
+	if(max_depth == 0)
+		return 0;
+	int bounces = 0;
+	float pdf_fwd = pdf_dir;
+	while(true)
+	{
+		Vertex& prev = path[bounces - 1];
+		if(!intersect(ray))
+		{
+			if(radiance)
+				L += beta * Lenvironment(ray.d);
+			break;
+		}
+		Intersection hit = getIntersection(ray);
+		Vertex& vertex = path[bounces];
+		vertex = makeVertex(SurfaceVertex, hit.position, beta);
+		vertex.ng = hit.geometry_normal;
+		vertex.ns = hit.shading_normal;
+		vertex.wo = hit.wo;
+		vertex.material = hit.material;
+		if(hit.material->m_emission != vec3(0.0f))
+			vertex.light = findAreaLight(ray.geomID, ray.primID);
+		vertex.pdf_fwd = convertDensity(pdf_fwd, prev, vertex);
+		if(++bounces >= max_depth)
+			break;
+
+		// Sample the next direction like Li(): glass with probability
+		// m_transparency, else diffuse
+		vec3 wi;
+		float pdf_rev;
+		const float transparency = hit.material->m_transparency;
+		if(randf() < transparency)
+		{
+			GlassBTDF glass(hit.material->m_ior);
+			WiSample s;
+			{
+				stats::ScopedCycles timer(stats::Shading);
+				s = glass.sample_wi(hit.wo, hit.shading_normal);
+			}
+			// f * cos / pdf = 1, and the lobe choice cancels
+			wi = s.wi;
+			vertex.delta = true;
+			pdf_fwd = pdf_rev = 0.0f;
+		}
+		else
+		{
+			Diffuse diffuse(hit.material->m_color);
+			WiSample s;
+			{
+				stats::ScopedCycles timer(stats::Shading);
+				s = diffuse.sample_wi(hit.wo, hit.shading_normal);
+			}
+			if(s.pdf < EPSILON)
+			{
+				stats::local().pdf_terminations++;
+				break;
+			}
+			wi = s.wi;
+			pdf_fwd = (1.0f - transparency) * s.pdf;
+			beta *= (1.0f - transparency) * s.f * abs(dot(wi, hit.shading_normal)) / pdf_fwd;
+			pdf_rev = surfacePdf(vertex, hit.wo);
+		}
+		if(beta == vec3(0.0f))
+			break;
+		prev.pdf_rev = convertDensity(pdf_rev, vertex, prev);
+
+		ray = Ray();
+		ray.o = hit.position + (dot(wi, hit.geometry_normal) < 0.0f ? -EPSILON : EPSILON) * hit.geometry_normal;
+		ray.d = wi;
+		stats::local().extension_rays++;
+	}
+	return bounces;
+}
+
+int generateCameraSubpath(const Ray& primary_ray, int max_depth, Vertex* path, vec3& L)
+{
+	if(max_depth == 0)
+		return 0;
+	path[0] = makeVertex(CameraVertex, camera.position, vec3(1.0f));
+	stats::local().camera_rays++;
+	float pdf_dir = camera.pdfDir(primary_ray.d);
+	return randomWalk(primary_ray, vec3(1.0f), pdf_dir, max_depth - 1, true, path + 1, L) + 1;
+}
+
+int generateLightSubpath(int max_depth, Vertex* path)
+{
+	float light_pdf;
+	int light = sampleLight(randf(), light_pdf);
+	if(max_depth == 0 || light < 0)
+		return 0;
+	vec3 p, n, w, Le;
+	float pdf_pos, pdf_dir;
+	if(!sampleLe(lights[light], p, n, w, Le, pdf_pos, pdf_dir))
+		return 0;
+	path[0] = makeVertex(LightVertex, p, Le);
+	path[0].ng = path[0].ns = n;
+	path[0].light = light;
+	path[0].pdf_fwd = pdf_pos * light_pdf;
+
+	vec3 beta = Le / (light_pdf * pdf_pos * pdf_dir);
+	if(path[0].onSurface())
+		beta *= abs(dot(n, w));
+	Ray ray;
+	ray.o = p + (path[0].onSurface() ? (dot(w, n) < 0.0f ? -EPSILON : EPSILON) * n : vec3(0.0f));
+	ray.d = w;
+	vec3 unused;
+	return randomWalk(ray, beta, pdf_dir, max_depth - 1, false, path + 1, unused) + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Balance heuristic weight of connecting light_path[0..s) to
+// camera_path[0..t), computed from the ratios of the densities of all
+// other strategies that could have made the same path. For s == 1 and
+// t == 1 the connection vertex was sampled anew and is passed as `sampled`.
+///////////////////////////////////////////////////////////////////////////
+inline float remap0(float f)
+{
+	return f != 0.0f ? f : 1.0f;
+}
+
+float misWeight(Vertex* light_path, Vertex* camera_path, const Vertex& sampled, int s, int t)
+{
+	if(s + t == 2)
+		return 1.0f;
+	Vertex* qs = s > 0 ? &light_path[s - 1] : nullptr;
+	Vertex* pt = t > 0 ? &camera_path[t - 1] : nullptr;
+	Vertex* qs_minus = s > 1 ? &light_path[s - 2] : nullptr;
+	Vertex* pt_minus = t > 1 ? &camera_path[t - 2] : nullptr;
+
+	// Temporarily update the vertices to the path being weighted
+	Vertex saved_end;
+	Vertex* replaced = nullptr;
+	if(s == 1)
+		replaced = qs;
+	else if(t == 1)
+		replaced = pt;
+	if(replaced)
+	{
+		saved_end = *replaced;
+		*replaced = sampled;
+	}
+	const Vertex saved_pt = pt ? *pt : Vertex();
+	const Vertex saved_qs = qs ? *qs : Vertex();
+	const float saved_pt_minus_rev = pt_minus ? pt_minus->pdf_rev : 0.0f;
+	const float saved_qs_minus_rev = qs_minus ? qs_minus->pdf_rev : 0.0f;
+
+	// The connection vertices are not specular for this path
+	if(pt)
+		pt->delta = false;
+	if(qs)
+		qs->delta = false;
+	if(pt)
+		pt->pdf_rev = s > 0 ? pdf(*qs, qs_minus, *pt) : pdfLightOrigin(*pt, *pt_minus);
+	if(pt_minus)
+		pt_minus->pdf_rev = s > 0 ? pdf(*pt, qs, *pt_minus) : pdfLight(*pt, *pt_minus);
+	if(qs)
+		qs->pdf_rev = pdf(*pt, pt_minus, *qs);
+	if(qs_minus)
+		qs_minus->pdf_rev = pdf(*qs, pt, *qs_minus);
+
+	float sum_ri = 0.0f;
+	float ri = 1.0f;
+	for(int i = t - 1; i > 0; i--)
+	{
+		ri *= remap0(camera_path[i].pdf_rev) / remap0(camera_path[i].pdf_fwd);
+		if(!camera_path[i].delta && !camera_path[i - 1].delta)
+			sum_ri += ri;
+	}
+	ri = 1.0f;
+	for(int i = s - 1; i >= 0; i--)
+	{
+		ri *= remap0(light_path[i].pdf_rev) / remap0(light_path[i].pdf_fwd);
+		bool delta_light_vertex = i > 0 ? light_path[i - 1].delta : isDeltaLight(light_path[0]);
+		if(!light_path[i].delta && !delta_light_vertex)
+			sum_ri += ri;
+	}
+
+	// Restore
+	if(pt)
+		*pt = saved_pt;
+	if(qs)
+		*qs = saved_qs;
+	if(pt_minus)
+		pt_minus->pdf_rev = saved_pt_minus_rev;
+	if(qs_minus)
+		qs_minus->pdf_rev = saved_qs_minus_rev;
+	if(replaced)
+		*replaced = saved_end;
+	return 1.0f / (1.0f + sum_ri);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Contribution of the strategy (s, t). For t == 1 the contribution belongs
+// to pixel (splat_x, splat_y) instead of the one being traced.
+///////////////////////////////////////////////////////////////////////////
+vec3 connect(Vertex* light_path, Vertex* camera_path, int s, int t, int& splat_x, int& splat_y)
+{
+	vec3 L(0.0f);
+	Vertex sampled;
+	if(s == 0)
+	{
+		// The camera path hit an emissive triangle
+		const Vertex& pt = camera_path[t - 1];
+		if(pt.type == SurfaceVertex && pt.light >= 0)
+			L = pt.beta * pt.material->m_emission;
+	}
+	else if(t == 1)
+	{
+		// Light tracing: connect the light subpath to the camera
+		const Vertex& qs = light_path[s - 1];
+		if(!isConnectible(qs) || qs.type != SurfaceVertex)
+			return vec3(0.0f);
+		vec3 d = qs.p - camera.position;
+		float dist2 = dot(d, d);
+		vec3 w = d / sqrt(dist2);
+		float We = camera.We(w);
+		if(We == 0.0f || !camera.raster(w, splat_x, splat_y))
+			return vec3(0.0f);
+		// Pinhole: the density of the direction towards qs, in solid angle
+		// at qs, is dist^2 / cos
+		float pdf_camera = dist2 / dot(w, camera.forward);
+		sampled = makeVertex(CameraVertex, camera.position, vec3(We / pdf_camera));
+		L = qs.beta * f(qs, sampled) * sampled.beta * abs(dot(w, qs.ns));
+		if(L != vec3(0.0f) && !visible(qs, sampled))
+			L = vec3(0.0f);
+	}
+	else if(s == 1)
+	{
+		// Next event estimation: connect to a new point on a light
+		const Vertex& pt = camera_path[t - 1];
+		if(!isConnectible(pt))
+			return vec3(0.0f);
+		float light_pdf;
+		int light = sampleLight(randf(), light_pdf);
+		if(light < 0)
+			return vec3(0.0f);
+		vec3 p, n;
+		float pdf_pos;
+		sampleLightPoint(lights[light], p, n, pdf_pos);
+		vec3 d = p - pt.p;
+		float dist2 = dot(d, d);
+		vec3 wi = d / sqrt(dist2);
+		vec3 Li;
+		float pdf_solid;
+		if(lights[light].type == PointLightSource)
+		{
+			Li = lightLe(lights[light], n, -wi) / dist2;
+			pdf_solid = 1.0f;
+		}
+		else
+		{
+			float cos_light = abs(dot(n, wi));
+			Li = lightLe(lights[light], n, -wi);
+			pdf_solid = cos_light > 0.0f ? pdf_pos * dist2 / cos_light : 0.0f;
+		}
+		if(pdf_solid == 0.0f || Li == vec3(0.0f))
+			return vec3(0.0f);
+		sampled = makeVertex(LightVertex, p, Li / (pdf_solid * light_pdf));
+		sampled.ng = sampled.ns = n;
+		sampled.light = light;
+		sampled.pdf_fwd = pdfLightOrigin(sampled, pt);
+		L = pt.beta * f(pt, sampled) * sampled.beta * abs(dot(wi, pt.ns));
+		if(L != vec3(0.0f) && !visible(pt, sampled))
+			L = vec3(0.0f);
+	}
+	else
+	{
+		const Vertex& qs = light_path[s - 1];
+		const Vertex& pt = camera_path[t - 1];
+		if(!isConnectible(qs) || !isConnectible(pt))
+			return vec3(0.0f);
+		L = qs.beta * f(qs, pt) * f(pt, qs) * pt.beta;
+		if(L != vec3(0.0f))
+			L *= G(qs, pt);
+	}
+	if(L == vec3(0.0f))
+		return L;
+	return L * misWeight(light_path, camera_path, sampled, s, t);
+}
+
+inline void splat(vec3* buffer, int pixel, const vec3& c)
+{
+#pragma omp atomic
+	buffer[pixel].x += c.x;
+#pragma omp atomic
+	buffer[pixel].y += c.y;
+#pragma omp atomic
+	buffer[pixel].z += c.z;
+}
+
+// Path depth is limited by the "Max Bounces" slider, up to stats::MAX_DEPTH
+const int MAX_VERTICES = stats::MAX_DEPTH + 2;
+
+vector<vec3> pass_radiance;
+vector<vec3> splats;
+} // namespace
+
+void traceBidirectional(const mat4& V, const mat4& P, int sample_index)
+{
+	buildLights();
+	camera.position = vec3(inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	camera.forward = normalize(vec3(inverse(V) * vec4(0.0f, 0.0f, -1.0f, 0.0f)));
+	camera.view_projection = P * V;
+	camera.inverse_view_projection = inverse(P * V);
+	// Image plane at distance 1 spans [-1/P00, 1/P00] x [-1/P11, 1/P11]
+	camera.image_area = 4.0f / (P[0][0] * P[1][1]);
+	camera.width = rendered_image.width;
+	camera.height = rendered_image.height;
+
+	const int max_depth = std::min(settings.max_bounces, stats::MAX_DEPTH);
+	const size_t pixels = size_t(rendered_image.width) * rendered_image.height;
+	pass_radiance.resize(pixels);
+	splats.assign(pixels, vec3(0.0f));
+
+#pragma omp parallel for schedule(dynamic, 4)
+	for(int y = 0; y < rendered_image.height; y++)
+	{
+		Vertex camera_path[MAX_VERTICES];
+		Vertex light_path[MAX_VERTICES];
+		for(int x = 0; x < rendered_image.width; x++)
+		{
+			const int pixel = y * rendered_image.width + x;
+			beginSample(uint32_t(pixel), uint32_t(sample_index));
+			vec2 screen = vec2((float(x) + randf()) / float(rendered_image.width),
+			                   (float(y) + randf()) / float(rendered_image.height));
+			vec4 target = camera.inverse_view_projection * vec4(screen * 2.0f - 1.0f, 1.0f, 1.0f);
+			Ray primary_ray;
+			primary_ray.o = camera.position;
+			primary_ray.d = normalize(vec3(target) / target.w - camera.position);
+
+			vec3 L(0.0f);
+			int t_max = generateCameraSubpath(primary_ray, max_depth + 2, camera_path, L);
+			int s_max = generateLightSubpath(max_depth + 1, light_path);
+			stats::recordDepth(t_max - 1);
+
+			for(int t = 1; t <= t_max; t++)
+			{
+				for(int s = 0; s <= s_max; s++)
+				{
+					int depth = t + s - 2;
+					if((s == 1 && t == 1) || depth < 0 || depth > max_depth)
+						continue;
+					int splat_x = 0, splat_y = 0;
+					vec3 c = connect(light_path, camera_path, s, t, splat_x, splat_y);
+					if(c == vec3(0.0f) || any(isnan(c)) || any(isinf(c)))
+						continue;
+					if(t == 1)
+						splat(&splats[0], splat_y * rendered_image.width + splat_x, c);
+					else
+						L += c;
+				}
+			}
+			pass_radiance[pixel] = L;
+		}
+	}
+
+	const float n = float(rendered_image.number_of_samples);
+#pragma omp parallel for schedule(static)
+	for(int y = 0; y < rendered_image.height; y++)
+	{
+		for(int x = 0; x < rendered_image.width; x++)
+		{
+			const int pixel = y * rendered_image.width + x;
+			vec3 color = pass_radiance[pixel] + splats[pixel];
+			rendered_image.data[pixel] = rendered_image.data[pixel] * (n / (n + 1.0f)) + (1.0f / (n + 1.0f)) * color;
+		}
+	}
+}
+} // namespace pathtracer
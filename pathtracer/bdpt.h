@@ -0,0 +1,25 @@
+#pragma once
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Bidirectional path tracing (settings.integrator == Bidirectional).
+//
+// For every pixel sample a camera subpath and a light subpath are traced,
+// the light subpath starting on the point light, a disc light or an
+// emissive triangle (chosen by power). Every prefix of one is connected to
+// every prefix of the other, and the strategies are combined with the
+// balance heuristic. Light subpath vertices connected directly to the
+// camera (light tracing) land on arbitrary pixels and are splatted into a
+// shared buffer with atomic adds.
+//
+// This finds caustics through specular chains (GlassBTDF) that the
+// unidirectional Li() only hits by chance. Glass is treated as purely
+// specular, so connections only use the diffuse part of a material.
+///////////////////////////////////////////////////////////////////////////
+
+// Trace sample `sample_index` of every pixel and add it to rendered_image.
+// Called by tracePaths().
+void traceBidirectional(const glm::mat4& V, const glm::mat4& P, int sample_index);
+} // namespace pathtracer
@@ -0,0 +1,441 @@
+///////////////////////////////////////////////////////////////////////////
+// pathtracer_bench: measures the hot functions of the pathtracer in
+// isolation, over fixed-seed inputs taken from the real scenes.
+//
+// Usage: pathtracer_bench [--out file.json] [--reps N] [--scene name]
+//                         [--resolution N] [--label text]
+//
+// Each benchmark is run once to warm up, then `reps` times. The median,
+// minimum and mean ns/op and the throughput are printed and written as
+// JSON, so runs can be diffed across commits and machines.
+///////////////////////////////////////////////////////////////////////////
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <labhelper.h>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "fastmath.h"
+#include "material.h"
+#include "sampling.h"
+#include "scenes.h"
+
+using namespace glm;
+using namespace std;
+using namespace pathtracer;
+
+namespace
+{
+struct BenchResult
+{
+	string name;
+	string scene;
+	size_t ops_per_rep;
+	int reps;
+	double ns_median, ns_min, ns_mean;
+};
+
+struct BenchOptions
+{
+	string out = "pathtracer_bench.json";
+	string scene;
+	string label;
+	int reps = 10;
+	int resolution = 128;
+};
+
+vector<BenchResult> results;
+BenchOptions options;
+// Results are summed into this so that the compiler can't remove the work
+volatile float sink;
+
+///////////////////////////////////////////////////////////////////////////
+// Run `body` (which performs `ops` operations and returns some value
+// derived from them) once for warm-up and then options.reps times.
+///////////////////////////////////////////////////////////////////////////
+void measure(const string& name, const string& scene, size_t ops, const function<float()>& body)
+{
+	typedef chrono::high_resolution_clock clock;
+	if(ops == 0)
+		return;
+	sink = sink + body();
+	vector<double> ns_per_op;
+	for(int r = 0; r < options.reps; r++)
+	{
+		auto start = clock::now();
+		float s = body();
+		double ns = chrono::duration<double, nano>(clock::now() - start).count();
+		sink = sink + s;
+		ns_per_op.push_back(ns / double(ops));
+	}
+	sort(ns_per_op.begin(), ns_per_op.end());
+	BenchResult result;
+	result.name = name;
+	result.scene = scene;
+	result.ops_per_rep = ops;
+	result.reps = options.reps;
+	result.ns_median = ns_per_op[ns_per_op.size() / 2];
+	result.ns_min = ns_per_op.front();
+	double sum = 0.0;
+	for(double ns : ns_per_op)
+		sum += ns;
+	result.ns_mean = sum / double(ns_per_op.size());
+	results.push_back(result);
+	printf("%-34s %-12s %10.2f ns/op (min %8.2f) %10.3f Mops/s\n", name.c_str(), scene.c_str(),
+	       result.ns_median, result.ns_min, 1e3 / result.ns_median);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Inputs recorded from one scene
+///////////////////////////////////////////////////////////////////////////
+struct ShadeInput
+{
+	vec3 wi, wo, n;
+	const labhelper::Material* material;
+};
+
+struct SceneInputs
+{
+	vector<Ray> primary_rays; // Not yet intersected
+	vector<Ray> hit_rays;     // Intersected, and hit something
+	vector<Ray> shadow_rays;  // From hit points toward the point light
+	vector<vec3> directions;  // All primary ray directions
+	vector<ShadeInput> shading;
+};
+
+SceneInputs recordInputs(const scene_t& scene)
+{
+	const int res = options.resolution;
+	mat4 V = lookAt(scene.camera.position, scene.camera.position + scene.camera.direction, vec3(0, 1, 0));
+	mat4 P = perspective(radians(45.0f), 1.0f, 0.1f, 100.0f);
+	mat4 inv_PV = inverse(P * V);
+
+	std::mt19937 rng(4711);
+	std::uniform_real_distribution<float> uniform;
+	SceneInputs in;
+	for(int y = 0; y < res; y++)
+	{
+		for(int x = 0; x < res; x++)
+		{
+			vec2 screen = vec2((x + uniform(rng)) / res, (y + uniform(rng)) / res);
+			vec4 p = inv_PV * vec4(screen * 2.0f - 1.0f, 1.0f, 1.0f);
+			Ray r(scene.camera.position, normalize(vec3(p) / p.w - scene.camera.position));
+			in.primary_rays.push_back(r);
+			in.directions.push_back(r.d);
+			if(!intersect(r))
+				continue;
+			in.hit_rays.push_back(r);
+			Intersection hit = getIntersection(r);
+			Ray shadow(hit.position + EPSILON * hit.shading_normal,
+			           normalize(point_light.position - hit.position));
+			in.shadow_rays.push_back(shadow);
+			// Half of the wi toward the light, half random above the surface
+			ShadeInput s;
+			s.wo = hit.wo;
+			s.n = hit.shading_normal;
+			s.material = hit.material;
+			if(uniform(rng) < 0.5f)
+			{
+				s.wi = shadow.d;
+			}
+			else
+			{
+				vec3 d = normalize(vec3(uniform(rng), uniform(rng), uniform(rng)) * 2.0f - 1.0f);
+				s.wi = dot(d, s.n) < 0.0f ? -d : d;
+			}
+			in.shading.push_back(s);
+		}
+	}
+	return in;
+}
+
+void benchScene(const string& name, const SceneInputs& in)
+{
+	measure("intersect", name, in.primary_rays.size(), [&]() {
+		int hits = 0;
+		for(Ray r : in.primary_rays)
+			hits += intersect(r) ? 1 : 0;
+		return float(hits);
+	});
+	measure("occluded", name, in.shadow_rays.size(), [&]() {
+		int hits = 0;
+		for(Ray r : in.shadow_rays)
+			hits += occluded(r) ? 1 : 0;
+		return float(hits);
+	});
+	measure("getIntersection", name, in.hit_rays.size(), [&]() {
+		float s = 0.0f;
+		for(const Ray& r : in.hit_rays)
+			s += getIntersection(r).position.x;
+		return s;
+	});
+	measure("Lenvironment", name, in.directions.size(), [&]() {
+		float s = 0.0f;
+		for(const vec3& d : in.directions)
+			s += Lenvironment(d).x;
+		return s;
+	});
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Material benchmarks, over the shading inputs of all scenes. Each Build*
+// struct constructs the material (tree) for one shading point on the
+// stack, as Li does, and hands it to an Eval* functor.
+///////////////////////////////////////////////////////////////////////////
+struct EvalF
+{
+	const ShadeInput& in;
+	template<class M>
+	float operator()(const M& m) const
+	{
+		return m.f(in.wi, in.wo, in.n).x;
+	}
+};
+
+struct EvalSample
+{
+	const ShadeInput& in;
+	template<class M>
+	float operator()(const M& m) const
+	{
+		return m.sample_wi(in.wo, in.n).pdf;
+	}
+};
+
+struct BuildDiffuse
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		return eval(Diffuse(in.material->m_color));
+	}
+};
+
+struct BuildMicrofacet
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		return eval(MicrofacetBRDF(in.material->m_shininess));
+	}
+};
+
+struct BuildDielectric
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		Diffuse diffuse(in.material->m_color);
+		MicrofacetBRDF microfacet(in.material->m_shininess);
+		return eval(DielectricBSDF(&microfacet, &diffuse, in.material->m_fresnel));
+	}
+};
+
+struct BuildMetal
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		MicrofacetBRDF microfacet(in.material->m_shininess);
+		return eval(MetalBSDF(&microfacet, in.material->m_color, in.material->m_fresnel));
+	}
+};
+
+struct BuildBSDFBlend
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		Diffuse diffuse(in.material->m_color);
+		MicrofacetBRDF microfacet(in.material->m_shininess);
+		DielectricBSDF dielectric(&microfacet, &diffuse, in.material->m_fresnel);
+		MetalBSDF metal(&microfacet, in.material->m_color, in.material->m_fresnel);
+		return eval(BSDFLinearBlend(in.material->m_metalness, &metal, &dielectric));
+	}
+};
+
+struct BuildGlass
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		return eval(GlassBTDF(in.material->m_ior));
+	}
+};
+
+struct BuildBTDFBlend
+{
+	template<class Eval>
+	float operator()(const ShadeInput& in, const Eval& eval) const
+	{
+		GlassBTDF glass(in.material->m_ior);
+		Diffuse diffuse(in.material->m_color);
+		return eval(BTDFLinearBlend(in.material->m_transparency, &glass, &diffuse));
+	}
+};
+
+template<class Build>
+void benchMaterial(const string& name, const vector<ShadeInput>& shading, Build build)
+{
+	measure(name + "::f", "all", shading.size(), [&]() {
+		float s = 0.0f;
+		for(const ShadeInput& in : shading)
+			s += build(in, EvalF{ in });
+		return s;
+	});
+	measure(name + "::sample_wi", "all", shading.size(), [&]() {
+		float s = 0.0f;
+		for(const ShadeInput& in : shading)
+			s += build(in, EvalSample{ in });
+		return s;
+	});
+}
+
+void benchMaterials(const vector<ShadeInput>& shading)
+{
+	const size_t n = shading.size();
+	measure("randf", "all", n, [&]() {
+		float s = 0.0f;
+		for(size_t i = 0; i < n; i++)
+			s += randf();
+		return s;
+	});
+	measure("concentricSampleDisk", "all", n, [&]() {
+		float s = 0.0f;
+		for(size_t i = 0; i < n; i++)
+			s += concentricSampleDisk().x;
+		return s;
+	});
+	measure("tangentSpace", "all", n, [&]() {
+		float s = 0.0f;
+		for(const ShadeInput& in : shading)
+			s += labhelper::tangentSpace(in.n)[0].x;
+		return s;
+	});
+
+	benchMaterial("Diffuse", shading, BuildDiffuse());
+	benchMaterial("MicrofacetBRDF", shading, BuildMicrofacet());
+	benchMaterial("DielectricBSDF", shading, BuildDielectric());
+	benchMaterial("MetalBSDF", shading, BuildMetal());
+	benchMaterial("BSDFLinearBlend", shading, BuildBSDFBlend());
+	benchMaterial("GlassBTDF", shading, BuildGlass());
+	benchMaterial("BTDFLinearBlend", shading, BuildBTDFBlend());
+}
+
+string jsonEscape(const string& s)
+{
+	string r;
+	for(char c : s)
+	{
+		if(c == '"' || c == '\\')
+			r += '\\';
+		r += c;
+	}
+	return r;
+}
+
+void writeJSON(const string& filename)
+{
+	ofstream f(filename);
+	if(!f)
+	{
+		cout << "Could not write " << filename << "\n";
+		return;
+	}
+	char date[64];
+	time_t now = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	f << "{\n  \"meta\": {\n";
+	f << "    \"label\": \"" << jsonEscape(options.label) << "\",\n";
+	f << "    \"date\": \"" << date << "\",\n";
+#if defined(_MSC_VER)
+	f << "    \"compiler\": \"MSVC " << _MSC_VER << "\",\n";
+#else
+	f << "    \"compiler\": \"" << jsonEscape(__VERSION__) << "\",\n";
+#endif
+#if defined(__AVX2__)
+	f << "    \"avx2\": true,\n";
+#else
+	f << "    \"avx2\": false,\n";
+#endif
+	f << "    \"fast_math\": " << (PATHTRACER_FAST_MATH ? "true" : "false") << ",\n";
+	f << "    \"resolution\": " << options.resolution << ",\n";
+	f << "    \"reps\": " << options.reps << "\n  },\n";
+	f << "  \"results\": [\n";
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		f << "    { \"name\": \"" << jsonEscape(r.name) << "\", \"scene\": \"" << jsonEscape(r.scene)
+		  << "\", \"ops_per_rep\": " << r.ops_per_rep << ", \"reps\": " << r.reps
+		  << ", \"ns_per_op\": " << r.ns_median << ", \"ns_per_op_min\": " << r.ns_min
+		  << ", \"ns_per_op_mean\": " << r.ns_mean << ", \"ops_per_sec\": " << 1e9 / r.ns_median << " }"
+		  << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	f << "  ]\n}\n";
+	cout << "Wrote " << filename << "\n";
+}
+
+void parseArguments(int argc, char* argv[])
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if(arg == "--out" && has_value)
+			options.out = argv[++i];
+		else if(arg == "--reps" && has_value)
+			options.reps = std::max(1, atoi(argv[++i]));
+		else if(arg == "--scene" && has_value)
+			options.scene = argv[++i];
+		else if(arg == "--resolution" && has_value)
+			options.resolution = std::max(8, atoi(argv[++i]));
+		else if(arg == "--label" && has_value)
+			options.label = argv[++i];
+		else
+		{
+			cout << "Usage: pathtracer_bench [--out file.json] [--reps N] [--scene name] "
+			        "[--resolution N] [--label text]\n";
+			exit(1);
+		}
+	}
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	parseArguments(argc, argv);
+
+	// Models are uploaded to GL when loaded, so we need a (hidden) context
+	SDL_Window* window = labhelper::init_window_SDL("pathtracer_bench", 64, 64, true);
+
+	initPathtracerDefaults();
+	std::map<std::string, scene_t> scenes;
+	loadScenes(scenes);
+
+	vector<ShadeInput> shading;
+	for(auto& it : scenes)
+	{
+		if(!options.scene.empty() && it.first != options.scene)
+			continue;
+		buildPathtracerScene(it.second);
+		SceneInputs inputs = recordInputs(it.second);
+		benchScene(it.first, inputs);
+		shading.insert(shading.end(), inputs.shading.begin(), inputs.shading.end());
+	}
+	benchMaterials(shading);
+	writeJSON(options.out);
+
+	cleanupScenes(scenes);
+	labhelper::shutDown(window);
+	return 0;
+}
@@ -0,0 +1,264 @@
+#include "bsdf8.h"
+#include "sampling.h"
+
+using namespace glm;
+using namespace pathtracer::fastmath;
+
+namespace pathtracer
+{
+static const float PI = 3.14159265359f;
+
+void vec3_8::set(int lane, const vec3& v)
+{
+	float tx[8], ty[8], tz[8];
+	x.store(tx);
+	y.store(ty);
+	z.store(tz);
+	tx[lane] = v.x;
+	ty[lane] = v.y;
+	tz[lane] = v.z;
+	x = float8::load(tx);
+	y = float8::load(ty);
+	z = float8::load(tz);
+}
+
+vec3 vec3_8::get(int lane) const
+{
+	float tx[8], ty[8], tz[8];
+	x.store(tx);
+	y.store(ty);
+	z.store(tz);
+	return vec3(tx[lane], ty[lane], tz[lane]);
+}
+
+BSDFRandom8 randomBSDF8()
+{
+	BSDFRandom8 r;
+	for(int i = 0; i < 5; i++)
+	{
+		float u[8];
+		for(int lane = 0; lane < 8; lane++)
+			u[lane] = randf();
+		r.u[i] = float8::load(u);
+	}
+	return r;
+}
+
+void tangentSpace8(const vec3_8& n, vec3_8& t, vec3_8& b)
+{
+	float8 sign = xorsign(float8(1.0f), n.z);
+	float8 a = float8(-1.0f) / (sign + n.z);
+	float8 c = n.x * n.y * a;
+	t = vec3_8(float8(1.0f) + sign * n.x * n.x * a, sign * c, -sign * n.x);
+	b = vec3_8(c, sign + n.y * n.y * a, -n.y);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// concentricSampleDisk() with all four regions evaluated and selected
+///////////////////////////////////////////////////////////////////////////
+static void concentricSampleDisk8(float8 u0, float8 u1, float8& dx, float8& dy)
+{
+	float8 sx = float8(2.0f) * u0 - float8(1.0f);
+	float8 sy = float8(2.0f) * u1 - float8(1.0f);
+	float8 upper = sx >= -sy;
+	float8 first = sx > sy;
+	float8 third = sx <= sy;
+	float8 r = select(upper, select(first, sx, sy), select(third, -sx, -sy));
+	float8 inv_r = float8(1.0f) / select(r == float8(0.0f), float8(1.0f), r);
+	float8 theta_first = select(sy > float8(0.0f), sy * inv_r, float8(8.0f) + sy * inv_r);
+	float8 theta_upper = select(first, theta_first, float8(2.0f) - sx * inv_r);
+	float8 theta_lower = select(third, float8(4.0f) - sy * inv_r, float8(6.0f) + sx * inv_r);
+	float8 theta = select(upper, theta_upper, theta_lower) * float8(PI / 4.0f);
+	float8 s, c;
+	sincos(theta, s, c);
+	dx = r * c;
+	dy = r * s;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Diffuse
+///////////////////////////////////////////////////////////////////////////
+vec3_8 diffuse_f8(const vec3_8& color, const vec3_8& wi, const vec3_8& wo, const vec3_8& n)
+{
+	float8 valid = (dot(wi, n) > float8(0.0f)) & (dot(wo, n) > float8(0.0f));
+	return select(valid, float8(1.0f / PI) * color, vec3_8(0.0f));
+}
+
+float8 diffuse_pdf8(const vec3_8& wi, const vec3_8& n)
+{
+	return max(dot(wi, n), float8(0.0f)) * float8(1.0f / PI);
+}
+
+WiSample8 diffuse_sample_wi8(const vec3_8& color, const vec3_8& wo, const vec3_8& n, float8 u0, float8 u1)
+{
+	vec3_8 t, b;
+	tangentSpace8(n, t, b);
+	float8 dx, dy;
+	concentricSampleDisk8(u0, u1, dx, dy);
+	float8 dz = sqrt(max(float8(0.0f), float8(1.0f) - dx * dx - dy * dy));
+	WiSample8 r;
+	r.wi = dx * t + dy * b + dz * n;
+	float8 cos_theta = dot(r.wi, n);
+	r.pdf = select(cos_theta > float8(0.0f), cos_theta * float8(1.0f / PI), float8(0.0f));
+	r.f = diffuse_f8(color, r.wi, wo, n);
+	return r;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Microfacet
+///////////////////////////////////////////////////////////////////////////
+vec3_8 microfacet_f8(float8 shininess, const vec3_8& wi, const vec3_8& wo, const vec3_8& n)
+{
+	vec3_8 wh = normalize(wi + wo);
+	float8 wodotwh = max(dot(wo, wh), float8(0.001f));
+	float8 ndotwh = max(dot(n, wh), float8(0.001f));
+	float8 ndotwi = max(dot(n, wi), float8(0.001f));
+	float8 ndotwo = max(dot(n, wo), float8(0.001f));
+	float8 D = (shininess + float8(2.0f)) * float8(1.0f / (2.0f * PI)) * pow(ndotwh, shininess);
+	float8 G = min(float8(1.0f), min(float8(2.0f) * ndotwh * ndotwo / wodotwh,
+	                                 float8(2.0f) * ndotwh * ndotwi / wodotwh));
+	float8 denominator = float8(4.0f) * min(max(ndotwo * ndotwi, float8(0.001f)), float8(1.0f));
+	float8 valid = (dot(wi, n) > float8(0.0f)) & (dot(wo, n) > float8(0.0f));
+	float8 brdf = select(valid, D * G / denominator, float8(0.0f));
+	return vec3_8(brdf, brdf, brdf);
+}
+
+float8 microfacet_pdf8(float8 shininess, const vec3_8& wi, const vec3_8& wo, const vec3_8& n)
+{
+	vec3_8 h = wi + wo;
+	float8 ndotwo = dot(n, wo);
+	// Keep the invalid lanes finite, they are masked out below
+	vec3_8 wh = normalize(select(dot(h, h) >= float8(1e-12f), h, n));
+	float8 ndotwh = dot(n, wh);
+	float8 wodotwh = dot(wo, wh);
+	float8 valid = (dot(h, h) >= float8(1e-12f)) & (ndotwo > float8(0.0f)) & (ndotwh > float8(0.0f))
+	               & (wodotwh > float8(0.0f));
+	float8 D = (shininess + float8(2.0f)) * float8(1.0f / (2.0f * PI)) * pow(ndotwh, shininess);
+	float8 G1 = min(float8(1.0f), float8(2.0f) * ndotwh * ndotwo / select(valid, wodotwh, float8(1.0f)));
+	return select(valid, D * G1 / (float8(4.0f) * select(valid, ndotwo, float8(1.0f))), float8(0.0f));
+}
+
+WiSample8 microfacet_sample_wi8(float8 shininess, const vec3_8& wo, const vec3_8& n, float8 u0, float8 u1,
+                                float8 u2)
+{
+	// The normals visible from wo, with the other facet of the V-cavity,
+	// as MicrofacetBRDF::sample_wi
+	vec3_8 t, b;
+	tangentSpace8(n, t, b);
+	float8 phi = float8(2.0f * PI) * u0;
+	float8 cos_theta = pow(u1, float8(1.0f) / (shininess + float8(2.0f)));
+	float8 sin_theta = sqrt(max(float8(0.0f), float8(1.0f) - cos_theta * cos_theta));
+	float8 sin_phi, cos_phi;
+	sincos(phi, sin_phi, cos_phi);
+	vec3_8 side = (sin_theta * cos_phi) * t + (sin_theta * sin_phi) * b;
+	vec3_8 wh = normalize(side + cos_theta * n);
+	vec3_8 wh_other = normalize(cos_theta * n - side);
+	float8 seen = max(float8(0.0f), dot(wo, wh));
+	float8 seen_other = max(float8(0.0f), dot(wo, wh_other));
+	wh = select(u2 * (seen + seen_other) < seen_other, wh_other, wh);
+
+	WiSample8 r;
+	r.wi = normalize((float8(2.0f) * dot(wh, wo)) * wh - wo);
+	r.f = microfacet_f8(shininess, r.wi, wo, n);
+	r.pdf = microfacet_pdf8(shininess, r.wi, wo, n);
+	return r;
+}
+
+float8 fresnel8(float8 R0, const vec3_8& wi, const vec3_8& wo)
+{
+	vec3_8 wh = normalize(wi + wo);
+	float8 c = float8(1.0f) - max(float8(0.001f), dot(wh, wi));
+	float8 c2 = c * c;
+	return R0 + (float8(1.0f) - R0) * c2 * c2 * c;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Dielectric and metal. Both lobes are sampled for every lane and the
+// result picked per lane.
+///////////////////////////////////////////////////////////////////////////
+vec3_8 dielectric_f8(const MaterialParams8& m, const vec3_8& wi, const vec3_8& wo, const vec3_8& n)
+{
+	float8 F = fresnel8(m.fresnel, wi, wo);
+	return F * microfacet_f8(m.shininess, wi, wo, n) + (float8(1.0f) - F) * diffuse_f8(m.color, wi, wo, n);
+}
+
+// DielectricBSDF's probability of sampling the reflective lobe
+static float8 reflectProbability8(float8 R0, const vec3_8& wo, const vec3_8& n)
+{
+	float8 c = float8(1.0f) - min(max(dot(wo, n), float8(0.0f)), float8(1.0f));
+	float8 c2 = c * c;
+	return min(max(R0 + (float8(1.0f) - R0) * c2 * c2 * c, float8(0.05f)), float8(0.95f));
+}
+
+static WiSample8 dielectricFromLobes(const MaterialParams8& m,
+                                     const vec3_8& wo,
+                                     const vec3_8& n,
+                                     const WiSample8& reflected,
+                                     const WiSample8& transmitted,
+                                     float8 u)
+{
+	float8 p = reflectProbability8(m.fresnel, wo, n);
+	WiSample8 r;
+	r.wi = select(u < p, reflected.wi, transmitted.wi);
+	r.f = dielectric_f8(m, r.wi, wo, n);
+	r.pdf = p * microfacet_pdf8(m.shininess, r.wi, wo, n)
+	        + (float8(1.0f) - p) * diffuse_pdf8(r.wi, n);
+	return r;
+}
+
+WiSample8 dielectric_sample_wi8(const MaterialParams8& m, const vec3_8& wo, const vec3_8& n, const BSDFRandom8& r)
+{
+	WiSample8 reflected = microfacet_sample_wi8(m.shininess, wo, n, r.u[2], r.u[3], r.u[4]);
+	WiSample8 transmitted = diffuse_sample_wi8(m.color, wo, n, r.u[2], r.u[3]);
+	return dielectricFromLobes(m, wo, n, reflected, transmitted, r.u[1]);
+}
+
+vec3_8 metal_f8(const MaterialParams8& m, const vec3_8& wi, const vec3_8& wo, const vec3_8& n)
+{
+	float8 F = fresnel8(m.fresnel, wi, wo);
+	return F * microfacet_f8(m.shininess, wi, wo, n) * m.color;
+}
+
+static WiSample8 metalFromLobe(const MaterialParams8& m, const vec3_8& wo, WiSample8 r)
+{
+	r.f = fresnel8(m.fresnel, r.wi, wo) * r.f * m.color;
+	return r;
+}
+
+WiSample8 metal_sample_wi8(const MaterialParams8& m, const vec3_8& wo, const vec3_8& n, const BSDFRandom8& r)
+{
+	return metalFromLobe(m, wo, microfacet_sample_wi8(m.shininess, wo, n, r.u[2], r.u[3], r.u[4]));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// BSDFLinearBlend(metalness, metal, dielectric)
+///////////////////////////////////////////////////////////////////////////
+vec3_8 material_f8(const MaterialParams8& m, const vec3_8& wi, const vec3_8& wo, const vec3_8& n)
+{
+	float8 F = fresnel8(m.fresnel, wi, wo);
+	vec3_8 brdf = microfacet_f8(m.shininess, wi, wo, n);
+	vec3_8 metal = F * brdf * m.color;
+	vec3_8 dielectric = F * brdf + (float8(1.0f) - F) * diffuse_f8(m.color, wi, wo, n);
+	return m.metalness * metal + (float8(1.0f) - m.metalness) * dielectric;
+}
+
+WiSample8 material_sample_wi8(const MaterialParams8& m, const vec3_8& wo, const vec3_8& n, const BSDFRandom8& r)
+{
+	// The microfacet lobe is shared by the metal and the reflective part of
+	// the dielectric, so each lobe is sampled only once. Like
+	// BSDFLinearBlend::sample_wi, the result is the whole material with the
+	// mixture of the pdfs of the three ways to reach wi.
+	WiSample8 reflected = microfacet_sample_wi8(m.shininess, wo, n, r.u[2], r.u[3], r.u[4]);
+	WiSample8 transmitted = diffuse_sample_wi8(m.color, wo, n, r.u[2], r.u[3]);
+	float8 p = reflectProbability8(m.fresnel, wo, n);
+	float8 choose_reflected = (r.u[0] < m.metalness) | (r.u[1] < p);
+
+	WiSample8 result;
+	result.wi = select(choose_reflected, reflected.wi, transmitted.wi);
+	result.f = material_f8(m, result.wi, wo, n);
+	float8 p_reflected = m.metalness + (float8(1.0f) - m.metalness) * p;
+	result.pdf = p_reflected * microfacet_pdf8(m.shininess, result.wi, wo, n)
+	             + (float8(1.0f) - p_reflected) * diffuse_pdf8(result.wi, n);
+	return result;
+}
+} // namespace pathtracer
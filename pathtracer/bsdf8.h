@@ -0,0 +1,106 @@
+#pragma once
+#include <glm/glm.hpp>
+#include "fastmath.h"
+
+///////////////////////////////////////////////////////////////////////////
+// 8-wide (AVX2) versions of the BSDFs in material.h, working on 8 shading
+// points at once in SoA form. They compute exactly what the scalar classes
+// do (see bsdf8_bench.cpp for the comparison), but take their random
+// numbers as arguments and select between lobes with masks instead of
+// branches, so that divergent lanes cost no more than coherent ones.
+///////////////////////////////////////////////////////////////////////////
+
+namespace pathtracer
+{
+using fastmath::float8;
+
+struct vec3_8
+{
+	float8 x, y, z;
+	vec3_8() = default;
+	vec3_8(float8 _x, float8 _y, float8 _z) : x(_x), y(_y), z(_z)
+	{
+	}
+	vec3_8(float s) : x(s), y(s), z(s)
+	{
+	}
+	// Set/get a single lane
+	void set(int lane, const glm::vec3& v);
+	glm::vec3 get(int lane) const;
+};
+
+inline vec3_8 operator+(const vec3_8& a, const vec3_8& b) { return vec3_8(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline vec3_8 operator-(const vec3_8& a, const vec3_8& b) { return vec3_8(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline vec3_8 operator-(const vec3_8& a) { return vec3_8(-a.x, -a.y, -a.z); }
+inline vec3_8 operator*(const vec3_8& a, const vec3_8& b) { return vec3_8(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline vec3_8 operator*(float8 s, const vec3_8& a) { return vec3_8(s * a.x, s * a.y, s * a.z); }
+inline float8 dot(const vec3_8& a, const vec3_8& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline vec3_8 normalize(const vec3_8& a) { return (float8(1.0f) / fastmath::sqrt(dot(a, a))) * a; }
+inline vec3_8 select(float8 mask, const vec3_8& a, const vec3_8& b)
+{
+	return vec3_8(fastmath::select(mask, a.x, b.x), fastmath::select(mask, a.y, b.y),
+	              fastmath::select(mask, a.z, b.z));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Material parameters for 8 shading points, as read from
+// labhelper::Material
+///////////////////////////////////////////////////////////////////////////
+struct MaterialParams8
+{
+	vec3_8 color;
+	float8 shininess;
+	float8 fresnel;
+	float8 metalness;
+};
+
+struct WiSample8
+{
+	vec3_8 wi;
+	vec3_8 f;
+	float8 pdf;
+};
+
+// Random numbers for one sample_wi8 call. u[0] picks the lobe of the
+// metal/dielectric blend, u[1] reflection vs transmission of the
+// dielectric, u[2], u[3] the direction within the lobe and u[4] the facet
+// of the microfacet V-cavity.
+struct BSDFRandom8
+{
+	float8 u[5];
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The individual models (Diffuse, MicrofacetBRDF, BSDF::fresnel,
+// DielectricBSDF, MetalBSDF)
+///////////////////////////////////////////////////////////////////////////
+vec3_8 diffuse_f8(const vec3_8& color, const vec3_8& wi, const vec3_8& wo, const vec3_8& n);
+WiSample8 diffuse_sample_wi8(const vec3_8& color, const vec3_8& wo, const vec3_8& n, float8 u0, float8 u1);
+float8 diffuse_pdf8(const vec3_8& wi, const vec3_8& n);
+
+vec3_8 microfacet_f8(float8 shininess, const vec3_8& wi, const vec3_8& wo, const vec3_8& n);
+WiSample8 microfacet_sample_wi8(float8 shininess, const vec3_8& wo, const vec3_8& n, float8 u0, float8 u1,
+                                float8 u2);
+float8 microfacet_pdf8(float8 shininess, const vec3_8& wi, const vec3_8& wo, const vec3_8& n);
+
+float8 fresnel8(float8 R0, const vec3_8& wi, const vec3_8& wo);
+
+vec3_8 dielectric_f8(const MaterialParams8& m, const vec3_8& wi, const vec3_8& wo, const vec3_8& n);
+WiSample8 dielectric_sample_wi8(const MaterialParams8& m, const vec3_8& wo, const vec3_8& n, const BSDFRandom8& r);
+
+vec3_8 metal_f8(const MaterialParams8& m, const vec3_8& wi, const vec3_8& wo, const vec3_8& n);
+WiSample8 metal_sample_wi8(const MaterialParams8& m, const vec3_8& wo, const vec3_8& n, const BSDFRandom8& r);
+
+///////////////////////////////////////////////////////////////////////////
+// The full material tree, BSDFLinearBlend(metalness, metal, dielectric),
+// as used by Li for non-transparent materials
+///////////////////////////////////////////////////////////////////////////
+vec3_8 material_f8(const MaterialParams8& m, const vec3_8& wi, const vec3_8& wo, const vec3_8& n);
+WiSample8 material_sample_wi8(const MaterialParams8& m, const vec3_8& wo, const vec3_8& n, const BSDFRandom8& r);
+
+// Fill with randf() from the calling thread
+BSDFRandom8 randomBSDF8();
+
+// Orthonormal basis around n, as labhelper::tangentSpace
+void tangentSpace8(const vec3_8& n, vec3_8& t, vec3_8& b);
+} // namespace pathtracer
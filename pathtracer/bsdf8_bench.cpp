@@ -0,0 +1,232 @@
+///////////////////////////////////////////////////////////////////////////
+// Compares the 8-wide BSDFs in bsdf8.h against the scalar classes in
+// material.h and measures the throughput of both, in evaluations per
+// second.
+///////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "bsdf8.h"
+#include "material.h"
+
+using namespace glm;
+using namespace pathtracer;
+
+struct Input
+{
+	vec3 wi, wo, n;
+	vec3 color;
+	float shininess, fresnel, metalness;
+};
+
+static vec3 randomDirection(std::mt19937& rng)
+{
+	std::normal_distribution<float> normal;
+	return normalize(vec3(normal(rng), normal(rng), normal(rng)));
+}
+
+static std::vector<Input> makeInputs(int count)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> uniform;
+	std::vector<Input> inputs(count);
+	for(auto& in : inputs)
+	{
+		in.n = randomDirection(rng);
+		in.wo = randomDirection(rng);
+		in.wi = randomDirection(rng);
+		// Most interesting configurations have wo and wi above the surface
+		if(dot(in.wo, in.n) < 0.0f && uniform(rng) < 0.8f)
+			in.wo = -in.wo;
+		if(dot(in.wi, in.n) < 0.0f && uniform(rng) < 0.8f)
+			in.wi = -in.wi;
+		in.color = vec3(uniform(rng), uniform(rng), uniform(rng));
+		in.shininess = 1.0f + 2000.0f * uniform(rng) * uniform(rng);
+		in.fresnel = uniform(rng);
+		in.metalness = uniform(rng);
+	}
+	return inputs;
+}
+
+static void load8(const Input* in, vec3_8& wi, vec3_8& wo, vec3_8& n, MaterialParams8& m)
+{
+	float s[8], f[8], w[8];
+	for(int lane = 0; lane < 8; lane++)
+	{
+		wi.set(lane, in[lane].wi);
+		wo.set(lane, in[lane].wo);
+		n.set(lane, in[lane].n);
+		m.color.set(lane, in[lane].color);
+		s[lane] = in[lane].shininess;
+		f[lane] = in[lane].fresnel;
+		w[lane] = in[lane].metalness;
+	}
+	m.shininess = float8::load(s);
+	m.fresnel = float8::load(f);
+	m.metalness = float8::load(w);
+}
+
+static vec3 scalarF(const Input& in)
+{
+	Diffuse diffuse(in.color);
+	MicrofacetBRDF microfacet(in.shininess);
+	DielectricBSDF dielectric(&microfacet, &diffuse, in.fresnel);
+	MetalBSDF metal(&microfacet, in.color, in.fresnel);
+	BSDFLinearBlend blend(in.metalness, &metal, &dielectric);
+	return blend.f(in.wi, in.wo, in.n);
+}
+
+static WiSample scalarSample(const Input& in)
+{
+	Diffuse diffuse(in.color);
+	MicrofacetBRDF microfacet(in.shininess);
+	DielectricBSDF dielectric(&microfacet, &diffuse, in.fresnel);
+	MetalBSDF metal(&microfacet, in.color, in.fresnel);
+	BSDFLinearBlend blend(in.metalness, &metal, &dielectric);
+	return blend.sample_wi(in.wo, in.n);
+}
+
+static float relativeError(const vec3& a, const vec3& b)
+{
+	vec3 d = abs(a - b) / max(abs(b), vec3(1e-3f));
+	return max(d.x, max(d.y, d.z));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// f() must agree lane by lane. The sampling routines consume random
+// numbers differently, so they are compared through their estimate of the
+// directional albedo, sum(f * cos / pdf) / N, which must agree within a few
+// standard errors.
+///////////////////////////////////////////////////////////////////////////
+static bool compare(const std::vector<Input>& inputs)
+{
+	float max_error = 0.0f;
+	for(size_t i = 0; i + 8 <= inputs.size(); i += 8)
+	{
+		vec3_8 wi, wo, n;
+		MaterialParams8 m;
+		load8(&inputs[i], wi, wo, n, m);
+		vec3_8 f = material_f8(m, wi, wo, n);
+		for(int lane = 0; lane < 8; lane++)
+		{
+			max_error = std::max(max_error, relativeError(f.get(lane), scalarF(inputs[i + lane])));
+		}
+	}
+	printf("f: max relative error %g over %d evaluations\n", max_error, int(inputs.size()));
+	bool ok = max_error < 1e-3f;
+
+	const int num_configurations = 16;
+	const int samples = 1 << 16;
+	int num_outliers = 0;
+	for(int c = 0; c < num_configurations; c++)
+	{
+		Input in = inputs[c];
+		if(dot(in.wo, in.n) < 0.0f)
+			in.wo = -in.wo;
+		double sum_scalar = 0.0, sum2_scalar = 0.0, sum_batched = 0.0, sum2_batched = 0.0;
+		for(int s = 0; s < samples; s++)
+		{
+			WiSample r = scalarSample(in);
+			double e = r.pdf > EPSILON ? dot(r.f, vec3(1.0f / 3.0f)) * abs(dot(r.wi, in.n)) / r.pdf : 0.0;
+			sum_scalar += e;
+			sum2_scalar += e * e;
+		}
+		Input lanes[8] = { in, in, in, in, in, in, in, in };
+		vec3_8 wi, wo, n;
+		MaterialParams8 m;
+		load8(lanes, wi, wo, n, m);
+		for(int s = 0; s < samples; s += 8)
+		{
+			WiSample8 r = material_sample_wi8(m, wo, n, randomBSDF8());
+			float pdf[8];
+			r.pdf.store(pdf);
+			for(int lane = 0; lane < 8; lane++)
+			{
+				double e = pdf[lane] > EPSILON ? dot(r.f.get(lane), vec3(1.0f / 3.0f))
+				                                     * abs(dot(r.wi.get(lane), in.n)) / pdf[lane] :
+				                                 0.0;
+				sum_batched += e;
+				sum2_batched += e * e;
+			}
+		}
+		double mean_scalar = sum_scalar / samples;
+		double mean_batched = sum_batched / samples;
+		double var = (sum2_scalar / samples - mean_scalar * mean_scalar)
+		             + (sum2_batched / samples - mean_batched * mean_batched);
+		double standard_error = sqrt(std::max(var, 0.0) / samples);
+		bool outlier = fabs(mean_scalar - mean_batched) > 4.0 * standard_error + 1e-4;
+		num_outliers += outlier ? 1 : 0;
+		printf("sample_wi: config %2d albedo scalar %.5f batched %.5f (std. err %.5f)%s\n", c, mean_scalar,
+		       mean_batched, standard_error, outlier ? "  <-- MISMATCH" : "");
+	}
+	return ok && num_outliers == 0;
+}
+
+static double secondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void benchmark(const std::vector<Input>& inputs, int repetitions)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	const double evaluations = double(inputs.size()) * repetitions;
+	float sink = 0.0f;
+
+	auto start = clock::now();
+	for(int r = 0; r < repetitions; r++)
+		for(const Input& in : inputs)
+			sink += scalarF(in).x;
+	double scalar_f = evaluations / secondsSince(start);
+
+	start = clock::now();
+	for(int r = 0; r < repetitions; r++)
+		for(const Input& in : inputs)
+			sink += scalarSample(in).pdf;
+	double scalar_sample = evaluations / secondsSince(start);
+
+	// Convert to SoA up front, as a batched integrator would keep it
+	typedef std::vector<vec3_8, fastmath::aligned_allocator<vec3_8>> vec3_8_array;
+	vec3_8_array wi(inputs.size() / 8), wo(inputs.size() / 8), n(inputs.size() / 8);
+	std::vector<MaterialParams8, fastmath::aligned_allocator<MaterialParams8>> m(inputs.size() / 8);
+	for(size_t i = 0; i < inputs.size() / 8; i++)
+		load8(&inputs[i * 8], wi[i], wo[i], n[i], m[i]);
+	BSDFRandom8 u = randomBSDF8();
+
+	start = clock::now();
+	for(int r = 0; r < repetitions; r++)
+		for(size_t i = 0; i < wi.size(); i++)
+			sink += material_f8(m[i], wi[i], wo[i], n[i]).get(0).x;
+	double batched_f = evaluations / secondsSince(start);
+
+	start = clock::now();
+	for(int r = 0; r < repetitions; r++)
+		for(size_t i = 0; i < wi.size(); i++)
+		{
+			float pdf[8];
+			material_sample_wi8(m[i], wo[i], n[i], u).pdf.store(pdf);
+			sink += pdf[0];
+		}
+	double batched_sample = evaluations / secondsSince(start);
+
+	printf("f:         scalar %8.2f M evals/s, batched %8.2f M evals/s (%.2fx)\n", scalar_f * 1e-6,
+	       batched_f * 1e-6, batched_f / scalar_f);
+	printf("sample_wi: scalar %8.2f M evals/s, batched %8.2f M evals/s (%.2fx)\n", scalar_sample * 1e-6,
+	       batched_sample * 1e-6, batched_sample / scalar_sample);
+	printf("(sink %g)\n", sink);
+}
+
+int main(int argc, char* argv[])
+{
+#if defined(__AVX2__)
+	printf("bsdf8: AVX2\n");
+#else
+	printf("bsdf8: SSE2 fallback (2x4 wide)\n");
+#endif
+	std::vector<Input> inputs = makeInputs(1 << 16);
+	bool ok = compare(inputs);
+	benchmark(inputs, 20);
+	printf("%s\n", ok ? "PASSED" : "FAILED");
+	return ok ? 0 : 1;
+}
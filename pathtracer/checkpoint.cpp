@@ -0,0 +1,264 @@
+#include "checkpoint.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "Pathtracer.h"
+#include "sampling.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// File layout: the header, then width * height RGB float sums
+///////////////////////////////////////////////////////////////////////////
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	int32_t width, height;
+	int32_t samples;
+	uint32_t seed;
+	uint32_t padding;
+	uint64_t hash;
+};
+const char CHECKPOINT_MAGIC[8] = { 'P', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+const uint32_t CHECKPOINT_VERSION = 1;
+
+typedef chrono::high_resolution_clock timer_clock;
+
+static double millisecondsSince(timer_clock::time_point start)
+{
+	return chrono::duration<double, milli>(timer_clock::now() - start).count();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Create `filename` with `size` bytes, map it and let `fill` write it
+///////////////////////////////////////////////////////////////////////////
+template<class Fill>
+static bool writeMapped(const string& filename, size_t size, Fill fill)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+	                          FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32),
+	                                    DWORD(size & 0xffffffffu), nullptr);
+	void* memory = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+	bool ok = memory != nullptr;
+	if(ok)
+	{
+		fill(static_cast<char*>(memory));
+		ok = FlushViewOfFile(memory, size) != 0;
+		UnmapViewOfFile(memory);
+	}
+	if(mapping)
+		CloseHandle(mapping);
+	ok = ok && FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return ok;
+#else
+	int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return false;
+	bool ok = ftruncate(fd, off_t(size)) == 0;
+	void* memory = ok ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	ok = memory != MAP_FAILED;
+	if(ok)
+	{
+		fill(static_cast<char*>(memory));
+		ok = msync(memory, size, MS_SYNC) == 0;
+		munmap(memory, size);
+	}
+	close(fd);
+	return ok;
+#endif
+}
+
+static bool replaceFile(const string& from, const string& to)
+{
+#if defined(_WIN32)
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+Checkpointer::Checkpointer(const string& filename, uint64_t hash) : filename(filename), hash(hash), writing(false)
+{
+}
+
+Checkpointer::~Checkpointer()
+{
+	wait();
+}
+
+bool Checkpointer::resume()
+{
+	FILE* f = fopen(filename.c_str(), "rb");
+	if(!f)
+		return false;
+	CheckpointHeader header;
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, CHECKPOINT_MAGIC, 8) == 0
+	          && header.version == CHECKPOINT_VERSION && header.hash == hash && header.seed == getRandomSeed()
+	          && header.width == rendered_image.width && header.height == rendered_image.height
+	          && header.samples > 0;
+	if(!ok)
+	{
+		fclose(f);
+		cout << filename << " is not a checkpoint of this render, starting over\n";
+		return false;
+	}
+	vector<vec3> sums(rendered_image.data.size());
+	ok = fread(&sums[0].x, sizeof(vec3), sums.size(), f) == sums.size();
+	fclose(f);
+	if(!ok)
+		return false;
+
+	const float inv_samples = 1.0f / float(header.samples);
+	for(size_t i = 0; i < sums.size(); i++)
+		rendered_image.data[i] = sums[i] * inv_samples;
+	rendered_image.number_of_samples = header.samples;
+	seedRandom(header.seed);
+	return true;
+}
+
+bool Checkpointer::save()
+{
+	if(writing)
+	{
+		stats.skipped++;
+		return false;
+	}
+	wait();
+
+	auto start = timer_clock::now();
+	const float n = float(rendered_image.number_of_samples);
+	snapshot.resize(rendered_image.data.size());
+#pragma omp parallel for schedule(static)
+	for(int y = 0; y < rendered_image.height; y++)
+	{
+		for(int x = 0; x < rendered_image.width; x++)
+		{
+			const int i = y * rendered_image.width + x;
+			snapshot[i] = rendered_image.data[i] * n;
+		}
+	}
+	snapshot_width = rendered_image.width;
+	snapshot_height = rendered_image.height;
+	snapshot_samples = rendered_image.number_of_samples;
+	stats.snapshot_ms_last = millisecondsSince(start);
+	stats.snapshot_ms_max = std::max(stats.snapshot_ms_max, stats.snapshot_ms_last);
+	stats.bytes = sizeof(CheckpointHeader) + snapshot.size() * sizeof(vec3);
+
+	writing = true;
+	writer = std::thread(&Checkpointer::write, this);
+	return true;
+}
+
+void Checkpointer::write()
+{
+	auto start = timer_clock::now();
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+	header.version = CHECKPOINT_VERSION;
+	header.width = snapshot_width;
+	header.height = snapshot_height;
+	header.samples = snapshot_samples;
+	header.seed = getRandomSeed();
+	header.hash = hash;
+
+	const string temporary = filename + ".tmp";
+	const size_t data_size = snapshot.size() * sizeof(vec3);
+	const vec3* data = snapshot.data();
+	struct Fill
+	{
+		const CheckpointHeader& header;
+		const vec3* data;
+		size_t data_size;
+		void operator()(char* memory) const
+		{
+			memcpy(memory, &header, sizeof(header));
+			memcpy(memory + sizeof(header), data, data_size);
+		}
+	};
+	write_ok = writeMapped(temporary, sizeof(header) + data_size, Fill{ header, data, data_size })
+	           && replaceFile(temporary, filename);
+	write_ms = millisecondsSince(start);
+	writing = false;
+}
+
+bool Checkpointer::wait()
+{
+	if(writer.joinable())
+	{
+		writer.join();
+		stats.write_ms_last = write_ms;
+		if(write_ok)
+			stats.saved++;
+		else
+			cout << "Could not write checkpoint " << filename << "\n";
+	}
+	return write_ok;
+}
+
+Checkpointer::Report Checkpointer::report() const
+{
+	return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// FNV-1a over the raw bytes of everything that affects the image
+///////////////////////////////////////////////////////////////////////////
+static void hashBytes(uint64_t& h, const void* data, size_t size)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for(size_t i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+}
+
+uint64_t hashRenderSetup(const string& scene, const mat4& V, const mat4& P, uint64_t extra)
+{
+	uint64_t h = 14695981039346656037ULL;
+	hashBytes(h, scene.data(), scene.size());
+	hashBytes(h, &V, sizeof(V));
+	hashBytes(h, &P, sizeof(P));
+	hashBytes(h, &rendered_image.width, sizeof(int));
+	hashBytes(h, &rendered_image.height, sizeof(int));
+	hashBytes(h, &settings.max_bounces, sizeof(int));
+	hashBytes(h, &settings.integrator, sizeof(settings.integrator));
+	// The radiance cache is biased, don't resume a render with or without it
+	if(settings.radiance_cache)
+		hashBytes(h, &settings.radiance_cache_bounces, sizeof(int));
+	hashBytes(h, &environment.multiplier, sizeof(float));
+	hashBytes(h, &point_light.intensity_multiplier, sizeof(float));
+	hashBytes(h, &point_light.color, sizeof(vec3));
+	hashBytes(h, &point_light.position, sizeof(vec3));
+	for(const DiscLight& light : disc_lights)
+	{
+		hashBytes(h, &light.intensity_multiplier, sizeof(float));
+		hashBytes(h, &light.color, sizeof(vec3));
+		hashBytes(h, &light.position, sizeof(vec3));
+		hashBytes(h, &light.direction, sizeof(vec3));
+		hashBytes(h, &light.radius, sizeof(float));
+	}
+	uint32_t seed = getRandomSeed();
+	hashBytes(h, &seed, sizeof(seed));
+	hashBytes(h, &extra, sizeof(extra));
+	return h;
+}
+} // namespace pathtracer
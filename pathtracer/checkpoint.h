@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Checkpoints of the progressive accumulation in rendered_image, so that a
+// long render can continue after the process was killed.
+//
+// A checkpoint holds the sum of the samples of every pixel, the number of
+// samples, the random seed (with the deterministic per-sample RNG, seed
+// and sample count are the whole sampler state) and a hash of everything
+// else the image depends on. resume() refuses checkpoints whose hash
+// doesn't match.
+//
+// save() only copies rendered_image while rendering is paused between two
+// tracePaths() calls. The copy is written to a memory-mapped temporary
+// file on a background thread and renamed over the previous checkpoint
+// when complete, so a crash while writing leaves the last one intact.
+///////////////////////////////////////////////////////////////////////////
+class Checkpointer
+{
+public:
+	struct Report
+	{
+		int saved = 0;
+		int skipped = 0;              // previous write still in progress
+		double snapshot_ms_last = 0.0; // time rendering was paused
+		double snapshot_ms_max = 0.0;
+		double write_ms_last = 0.0;   // background write
+		size_t bytes = 0;             // file size
+	};
+
+	Checkpointer(const std::string& filename, uint64_t hash);
+	~Checkpointer(); // Waits for a pending write
+
+	// Load the checkpoint into rendered_image (sized by resize() already)
+	// and reseed the RNG. Returns false if there is no matching checkpoint.
+	bool resume();
+
+	// Snapshot rendered_image and write it in the background. Returns false
+	// without doing anything if the previous checkpoint is still being
+	// written, so the cost per call stays bounded by one image copy.
+	bool save();
+
+	// Wait for a pending write. Returns false if the last write failed.
+	bool wait();
+
+	Report report() const;
+
+private:
+	void write();
+
+	std::string filename;
+	uint64_t hash;
+	std::vector<glm::vec3> snapshot;
+	int snapshot_width = 0, snapshot_height = 0, snapshot_samples = 0;
+	std::thread writer;
+	std::atomic<bool> writing;
+	// Set by the writer thread, read after joining it
+	bool write_ok = true;
+	double write_ms = 0.0;
+	Report stats;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Hash of the image size, camera, settings, lights and seed, to identify
+// the render a checkpoint belongs to. `scene` and `extra` are for anything
+// else that must match (the scene name, a worker index...).
+///////////////////////////////////////////////////////////////////////////
+uint64_t hashRenderSetup(const std::string& scene, const glm::mat4& V, const glm::mat4& P, uint64_t extra = 0);
+} // namespace pathtracer
@@ -0,0 +1,743 @@
+///////////////////////////////////////////////////////////////////////////
+// pathtracer_distributed: splits a render over several worker processes,
+// on this machine or on others, and merges their results.
+//
+// Usage: pathtracer_distributed coordinator [--port N] [--bind address]
+//            [--workers N] [--spawn 0|1] [--scene name] [--size WxH] [--spp N]
+//            [--max-bounces N] [--integrator pt|bdpt] [--seed N] [--update N]
+//            [--out file.pfm] [--compare file.pfm] [--checkpoint file]
+//        pathtracer_distributed worker [--connect host:port]
+//            [--checkpoint file] [--checkpoint-interval seconds]
+//        pathtracer_distributed single [--scene name] [--size WxH] [--spp N]
+//            [--max-bounces N] [--integrator pt|bdpt] [--seed N] [--out file.pfm]
+//            [--compare file.pfm] [--checkpoint file] [--checkpoint-interval seconds]
+//
+// The coordinator waits for `workers` connections (with --spawn 1 it
+// starts them itself on localhost), on `bind` (default: all interfaces,
+// or 127.0.0.1 with --spawn 1, since then all workers are local). Anyone
+// who can reach the port can join as a worker, so only open it to
+// trusted networks. It sends each worker the job and its worker
+// index, and worker w then renders sample indices w, w + workers,
+// w + 2 * workers, ... < spp of every pixel. Every `update` samples a
+// worker sends the unnormalized sum of its samples and their count, and
+// the coordinator writes the merged image (sum of sums / sum of counts)
+// to `out` as it goes.
+//
+// Since the random numbers of a sample only depend on the seed, the pixel
+// and the sample index (see beginSample()), the merged image is the one
+// "single" renders in one process, up to float rounding in the order the
+// samples are summed. Check with e.g.
+//
+//   pathtracer_distributed single --spp 64 --out single.pfm
+//   pathtracer_distributed coordinator --spawn 1 --workers 4 --spp 64
+//       --compare single.pfm
+//
+// With --checkpoint, "single" and the workers save their accumulation
+// state every `checkpoint-interval` seconds (see checkpoint.h) and resume
+// from it when restarted with the same arguments. Workers append
+// ".worker<index>" to the file name; a coordinator passes --checkpoint on
+// to the workers it spawns. Workers also save when they are done or lose
+// the coordinator. If a worker is lost, the coordinator still waits for
+// the others, writes the merged image of the samples it got and exits
+// with 1; run it again with the same arguments to render the rest.
+//
+// The protocol is plain TCP. Messages are sent in host byte order, so all
+// machines must have the same endianness (in practice: little-endian).
+///////////////////////////////////////////////////////////////////////////
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <labhelper.h>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "checkpoint.h"
+#include "embree.h"
+#include "pfm.h"
+#include "sampling.h"
+#include "scenes.h"
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+typedef int socket_t;
+const socket_t INVALID_SOCKET = -1;
+#define closesocket close
+#endif
+
+using namespace glm;
+using namespace std;
+
+namespace
+{
+///////////////////////////////////////////////////////////////////////////
+// Protocol: the coordinator sends one Job to every worker, and workers
+// answer with Updates until they have rendered all their samples. Each
+// message is a MessageHeader followed by `length` bytes.
+///////////////////////////////////////////////////////////////////////////
+enum MessageType : uint32_t
+{
+	JobMessage = 1,
+	// Payload: width * height * 3 floats, the sum of the worker's samples
+	UpdateMessage = 2,
+};
+
+struct MessageHeader
+{
+	uint32_t type;
+	uint32_t samples; // Update: samples per pixel in the sum
+	uint64_t length;
+};
+
+struct Job
+{
+	char scene[64];
+	int32_t width, height;
+	int32_t spp;
+	int32_t max_bounces;
+	int32_t integrator;
+	uint32_t seed;
+	int32_t worker, num_workers;
+	int32_t update_every;
+};
+
+struct DistributedOptions
+{
+	string mode;
+	string scene = "Sphere";
+	string out = "distributed.pfm";
+	string compare;
+	string checkpoint;
+	double checkpoint_interval = 60.0;
+	string host = "127.0.0.1";
+	string bind; // empty: see listenAddress()
+	int port = 5555;
+	int workers = 2;
+	bool spawn = false;
+	int width = 256, height = 256;
+	int spp = 64;
+	int max_bounces = 8;
+	pathtracer::Integrator integrator = pathtracer::PathTracing;
+	uint32_t seed = 1;
+	int update_every = 4;
+};
+DistributedOptions options;
+string executable;
+
+///////////////////////////////////////////////////////////////////////////
+// Blocking socket helpers
+///////////////////////////////////////////////////////////////////////////
+bool sendAll(socket_t s, const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+	while(size > 0)
+	{
+		int chunk = int(std::min(size, size_t(1 << 30)));
+		int sent = send(s, p, chunk, 0);
+		if(sent <= 0)
+			return false;
+		p += sent;
+		size -= size_t(sent);
+	}
+	return true;
+}
+
+bool recvAll(socket_t s, void* data, size_t size)
+{
+	char* p = static_cast<char*>(data);
+	while(size > 0)
+	{
+		int chunk = int(std::min(size, size_t(1 << 30)));
+		int received = recv(s, p, chunk, 0);
+		if(received <= 0)
+			return false;
+		p += received;
+		size -= size_t(received);
+	}
+	return true;
+}
+
+bool sendMessage(socket_t s, MessageType type, uint32_t samples, const void* payload, size_t length)
+{
+	MessageHeader header = { type, samples, uint64_t(length) };
+	return sendAll(s, &header, sizeof(header)) && sendAll(s, payload, length);
+}
+
+// Spawned workers are all on this machine, others may be anywhere
+string listenAddress()
+{
+	if(!options.bind.empty())
+		return options.bind;
+	return options.spawn ? "127.0.0.1" : "0.0.0.0";
+}
+
+socket_t listenOn(const string& ip, int port)
+{
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(uint16_t(port));
+	if(inet_pton(AF_INET, ip.c_str(), &address.sin_addr) != 1)
+		return INVALID_SOCKET;
+	socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+	if(s == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	int reuse = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+	if(::bind(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(s, 64) != 0)
+	{
+		closesocket(s);
+		return INVALID_SOCKET;
+	}
+	return s;
+}
+
+socket_t connectTo(const string& host, int port)
+{
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* result = nullptr;
+	if(getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0)
+		return INVALID_SOCKET;
+	socket_t s = INVALID_SOCKET;
+	// The coordinator may not be listening yet, retry for a while
+	for(int attempt = 0; attempt < 50 && s == INVALID_SOCKET; attempt++)
+	{
+		s = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		if(s != INVALID_SOCKET && connect(s, result->ai_addr, int(result->ai_addrlen)) != 0)
+		{
+			closesocket(s);
+			s = INVALID_SOCKET;
+#if defined(_WIN32)
+			Sleep(200);
+#else
+			usleep(200 * 1000);
+#endif
+		}
+	}
+	freeaddrinfo(result);
+	return s;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Start a worker process on this machine
+///////////////////////////////////////////////////////////////////////////
+bool spawnWorker(int port)
+{
+	string address = "127.0.0.1:" + to_string(port);
+#if defined(_WIN32)
+	string command = "\"" + executable + "\" worker --connect " + address;
+	if(!options.checkpoint.empty())
+		command += " --checkpoint \"" + options.checkpoint + "\"";
+	STARTUPINFOA startup;
+	PROCESS_INFORMATION process;
+	memset(&startup, 0, sizeof(startup));
+	startup.cb = sizeof(startup);
+	vector<char> command_line(command.begin(), command.end());
+	command_line.push_back('\0');
+	if(!CreateProcessA(nullptr, &command_line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+		return false;
+	CloseHandle(process.hThread);
+	CloseHandle(process.hProcess);
+	return true;
+#else
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		if(options.checkpoint.empty())
+			execl(executable.c_str(), executable.c_str(), "worker", "--connect", address.c_str(), (char*)nullptr);
+		else
+			execl(executable.c_str(), executable.c_str(), "worker", "--connect", address.c_str(), "--checkpoint",
+			      options.checkpoint.c_str(), (char*)nullptr);
+		_exit(127);
+	}
+	return pid > 0;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Rendering, shared by the workers and "single"
+///////////////////////////////////////////////////////////////////////////
+struct Renderer
+{
+	typedef chrono::high_resolution_clock clock;
+	SDL_Window* window = nullptr;
+	std::map<std::string, scene_t> scenes;
+	mat4 V, P;
+	unique_ptr<pathtracer::Checkpointer> checkpointer;
+	clock::time_point last_checkpoint;
+
+	bool start(const Job& job)
+	{
+		// Models are uploaded to GL when loaded, so we need a (hidden) context
+		window = labhelper::init_window_SDL("pathtracer_distributed", 64, 64, true);
+		initPathtracerDefaults();
+		loadScenes(scenes);
+		auto it = scenes.find(job.scene);
+		if(it == scenes.end())
+		{
+			cout << "Unknown scene " << job.scene << "\n";
+			return false;
+		}
+		const scene_t& scene = it->second;
+		buildPathtracerScene(scene);
+		pathtracer::settings.subsampling = 1;
+		pathtracer::settings.max_paths_per_pixel = 0;
+		pathtracer::settings.max_bounces = job.max_bounces;
+		pathtracer::settings.integrator = pathtracer::Integrator(job.integrator);
+		pathtracer::resize(job.width, job.height);
+		pathtracer::seedRandom(job.seed);
+		V = lookAt(scene.camera.position, scene.camera.position + scene.camera.direction, vec3(0.0f, 1.0f, 0.0f));
+		P = perspective(radians(45.0f), float(job.width) / float(job.height), 0.1f, 100.0f);
+		return true;
+	}
+
+	// Continue from options.checkpoint (+ `suffix`) if it is a checkpoint of
+	// this render. Returns the number of samples already rendered.
+	int resume(const Job& job, const string& suffix)
+	{
+		if(options.checkpoint.empty())
+			return 0;
+		const uint64_t partition = (uint64_t(job.num_workers) << 32) | uint32_t(job.worker);
+		checkpointer.reset(new pathtracer::Checkpointer(
+		    options.checkpoint + suffix, pathtracer::hashRenderSetup(job.scene, V, P, partition)));
+		last_checkpoint = clock::now();
+		if(!checkpointer->resume())
+			return 0;
+		cout << "Resumed from " << options.checkpoint + suffix << " at "
+		     << pathtracer::rendered_image.number_of_samples << " spp\n";
+		return pathtracer::rendered_image.number_of_samples;
+	}
+
+	// Call between tracePaths() calls
+	void checkpointIfDue()
+	{
+		if(!checkpointer
+		   || chrono::duration<double>(clock::now() - last_checkpoint).count() < options.checkpoint_interval)
+			return;
+		if(checkpointer->save())
+			last_checkpoint = clock::now();
+	}
+
+	// Save now, after the pending write if there is one
+	void checkpointNow()
+	{
+		if(!checkpointer)
+			return;
+		checkpointer->wait();
+		if(checkpointer->save())
+			last_checkpoint = clock::now();
+	}
+
+	void reportCheckpoints()
+	{
+		if(!checkpointer)
+			return;
+		checkpointer->wait();
+		pathtracer::Checkpointer::Report r = checkpointer->report();
+		cout << "Checkpoints: " << r.saved << " written, " << r.skipped << " skipped (still writing), "
+		     << r.bytes / (1024.0 * 1024.0) << " MB each, rendering paused " << r.snapshot_ms_max
+		     << " ms at most, last write " << r.write_ms_last << " ms in the background\n";
+	}
+
+	// rendered_image holds the mean of the samples so far
+	void sum(vector<vec3>& result) const
+	{
+		const float n = float(pathtracer::rendered_image.number_of_samples);
+		result.resize(pathtracer::rendered_image.data.size());
+		for(size_t i = 0; i < result.size(); i++)
+			result[i] = pathtracer::rendered_image.data[i] * n;
+	}
+
+	~Renderer()
+	{
+		checkpointer.reset();
+		cleanupScenes(scenes);
+		if(window)
+			labhelper::shutDown(window);
+	}
+};
+
+Job makeJob()
+{
+	Job job;
+	memset(&job, 0, sizeof(job));
+	strncpy(job.scene, options.scene.c_str(), sizeof(job.scene) - 1);
+	job.width = options.width;
+	job.height = options.height;
+	job.spp = options.spp;
+	job.max_bounces = options.max_bounces;
+	job.integrator = options.integrator;
+	job.seed = options.seed;
+	job.num_workers = options.workers;
+	job.update_every = options.update_every;
+	return job;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// RMSE and largest relative difference to another render of the job
+///////////////////////////////////////////////////////////////////////////
+void compareWith(const string& filename, const vector<vec3>& image)
+{
+	vector<vec3> other;
+	if(!readPFM(filename, options.width, options.height, other))
+	{
+		cout << "Could not read " << filename << " (or it has a different size)\n";
+		return;
+	}
+	double se = 0.0, max_relative = 0.0;
+	for(size_t i = 0; i < image.size(); i++)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			double d = double(image[i][c]) - double(other[i][c]);
+			se += d * d;
+			max_relative = std::max(max_relative, fabs(d) / std::max(1e-6, fabs(double(other[i][c]))));
+		}
+	}
+	cout << "Compared to " << filename << ": RMSE " << sqrt(se / (3.0 * image.size()))
+	     << ", max relative difference " << max_relative << "\n";
+}
+
+int runSingle()
+{
+	Job job = makeJob();
+	Renderer renderer;
+	if(!renderer.start(job))
+		return 1;
+	job.num_workers = 1;
+	for(int s = renderer.resume(job, ""); s < job.spp; s++)
+	{
+		pathtracer::tracePaths(renderer.V, renderer.P, s);
+		renderer.checkpointIfDue();
+		cout << "\r" << s + 1 << "/" << job.spp << " spp" << flush;
+	}
+	cout << "\n";
+	renderer.reportCheckpoints();
+	const pathtracer::Image& image = pathtracer::rendered_image;
+	bool ok = writePFM(options.out, image.width, image.height, &image.data[0]);
+	cout << (ok ? "Wrote " : "Could not write ") << options.out << "\n";
+	if(!options.compare.empty())
+		compareWith(options.compare, vector<vec3>(image.data.begin(), image.data.end()));
+	return ok ? 0 : 1;
+}
+
+int runWorker()
+{
+	socket_t s = connectTo(options.host, options.port);
+	if(s == INVALID_SOCKET)
+	{
+		cout << "Could not connect to " << options.host << ":" << options.port << "\n";
+		return 1;
+	}
+	MessageHeader header;
+	Job job;
+	if(!recvAll(s, &header, sizeof(header)) || header.type != JobMessage || header.length != sizeof(job)
+	   || !recvAll(s, &job, sizeof(job)))
+	{
+		cout << "Did not receive a job\n";
+		closesocket(s);
+		return 1;
+	}
+
+	int result = 0;
+	{
+		Renderer renderer;
+		if(!renderer.start(job))
+		{
+			closesocket(s);
+			return 1;
+		}
+		vector<vec3> sum;
+		int rendered = renderer.resume(job, ".worker" + to_string(job.worker));
+		// Samples from a checkpoint count right away (and may be all of them)
+		if(rendered > 0)
+		{
+			renderer.sum(sum);
+			if(!sendMessage(s, UpdateMessage, uint32_t(rendered), &sum[0].x, sum.size() * sizeof(vec3)))
+				rendered = job.spp;
+		}
+		for(int sample = job.worker + rendered * job.num_workers; sample < job.spp; sample += job.num_workers)
+		{
+			pathtracer::tracePaths(renderer.V, renderer.P, sample);
+			renderer.checkpointIfDue();
+			rendered++;
+			if(rendered % job.update_every == 0 || sample + job.num_workers >= job.spp)
+			{
+				renderer.sum(sum);
+				if(!sendMessage(s, UpdateMessage, uint32_t(rendered), &sum[0].x, sum.size() * sizeof(vec3)))
+				{
+					cout << "Lost the connection to the coordinator\n";
+					result = 1;
+					break;
+				}
+			}
+		}
+		// So that a coordinator run again finds all of it
+		renderer.checkpointNow();
+		renderer.reportCheckpoints();
+	}
+	closesocket(s);
+	return result;
+}
+
+struct WorkerState
+{
+	socket_t socket;
+	int expected_samples; // to render in total
+	int samples;          // in `sum`
+	vector<vec3> sum;
+};
+
+int runCoordinator()
+{
+	Job job = makeJob();
+	socket_t listener = listenOn(listenAddress(), options.port);
+	if(listener == INVALID_SOCKET)
+	{
+		cout << "Could not listen on " << listenAddress() << ":" << options.port << "\n";
+		return 1;
+	}
+	if(options.spawn)
+	{
+		for(int w = 0; w < options.workers; w++)
+		{
+			if(!spawnWorker(options.port))
+			{
+				cout << "Could not start worker " << w << "\n";
+				return 1;
+			}
+		}
+	}
+
+	cout << "Waiting for " << options.workers << " workers on " << listenAddress() << ":" << options.port
+	     << "\n";
+	const size_t pixels = size_t(job.width) * job.height;
+	vector<WorkerState> workers(options.workers);
+	for(int w = 0; w < options.workers; w++)
+	{
+		WorkerState& worker = workers[w];
+		worker.socket = accept(listener, nullptr, nullptr);
+		job.worker = w;
+		if(worker.socket == INVALID_SOCKET || !sendMessage(worker.socket, JobMessage, 0, &job, sizeof(job)))
+		{
+			cout << "Could not hand out job " << w << "\n";
+			return 1;
+		}
+		worker.expected_samples = w < job.spp ? (job.spp - w + job.num_workers - 1) / job.num_workers : 0;
+		worker.samples = 0;
+		worker.sum.assign(pixels, vec3(0.0f));
+	}
+	closesocket(listener);
+
+	typedef chrono::high_resolution_clock clock;
+	auto start = clock::now();
+	vector<vec3> merged(pixels, vec3(0.0f));
+	// Updates are received here, so that a worker lost halfway through one
+	// keeps its last complete sum
+	vector<vec3> update(pixels);
+	int total_samples = 0;
+	// Less than spp once workers are lost
+	int expected_samples = job.spp;
+	int lost_workers = 0;
+	while(total_samples < expected_samples)
+	{
+		fd_set ready;
+		FD_ZERO(&ready);
+		socket_t max_socket = 0;
+		for(const WorkerState& worker : workers)
+		{
+			if(worker.samples < worker.expected_samples)
+			{
+				FD_SET(worker.socket, &ready);
+				max_socket = std::max(max_socket, worker.socket);
+			}
+		}
+		if(select(int(max_socket + 1), &ready, nullptr, nullptr, nullptr) <= 0)
+			continue;
+
+		for(int w = 0; w < options.workers; w++)
+		{
+			WorkerState& worker = workers[w];
+			if(worker.samples >= worker.expected_samples || !FD_ISSET(worker.socket, &ready))
+				continue;
+			MessageHeader header;
+			if(!recvAll(worker.socket, &header, sizeof(header)) || header.type != UpdateMessage
+			   || header.length != pixels * sizeof(vec3)
+			   || !recvAll(worker.socket, &update[0].x, header.length))
+			{
+				cout << "\nLost worker " << w << " after " << worker.samples << "/" << worker.expected_samples
+				     << " samples\n";
+				// Go on with the others, so that their samples are done too
+				expected_samples -= worker.expected_samples - worker.samples;
+				worker.expected_samples = worker.samples;
+				lost_workers++;
+				continue;
+			}
+			// Updates carry the whole sum so far, replacing the last one
+			worker.sum.swap(update);
+			worker.samples = int(header.samples);
+		}
+
+		// Merge, in double so that the sum doesn't depend on the order much
+		total_samples = 0;
+		for(const WorkerState& worker : workers)
+			total_samples += worker.samples;
+		if(total_samples == 0)
+			continue;
+		for(size_t i = 0; i < pixels; i++)
+		{
+			dvec3 sum(0.0);
+			for(const WorkerState& worker : workers)
+				sum += dvec3(worker.sum[i]);
+			merged[i] = vec3(sum / double(total_samples));
+		}
+		writePFM(options.out, job.width, job.height, &merged[0]);
+		double seconds = chrono::duration<double>(clock::now() - start).count();
+		cout << "\r" << total_samples << "/" << job.spp << " spp, " << seconds << " s" << flush;
+	}
+	if(total_samples > 0)
+		cout << "\nWrote " << options.out << " (" << total_samples << "/" << job.spp << " spp)\n";
+	for(WorkerState& worker : workers)
+		closesocket(worker.socket);
+#if !defined(_WIN32)
+	if(options.spawn)
+	{
+		while(wait(nullptr) > 0)
+		{
+		}
+	}
+#endif
+	if(lost_workers > 0)
+	{
+		cout << "Lost " << lost_workers << " of " << options.workers << " workers. ";
+		if(options.checkpoint.empty())
+			cout << "Use --checkpoint to be able to finish a render after that.\n";
+		else
+			cout << "Run again with the same arguments to render their remaining samples.\n";
+		return 1;
+	}
+	if(!options.compare.empty())
+		compareWith(options.compare, merged);
+	return 0;
+}
+
+void usage()
+{
+	cout << "Usage: pathtracer_distributed coordinator [--port N] [--bind address] [--workers N]\n"
+	        "           [--spawn 0|1] [--scene name] [--size WxH] [--spp N] [--max-bounces N]\n"
+	        "           [--integrator pt|bdpt] [--seed N] [--update N] [--out file.pfm] [--compare file.pfm]\n"
+	        "           [--checkpoint file]\n"
+	        "       pathtracer_distributed worker [--connect host:port] [--checkpoint file]\n"
+	        "           [--checkpoint-interval seconds]\n"
+	        "       pathtracer_distributed single [--scene name] [--size WxH] [--spp N]\n"
+	        "           [--max-bounces N] [--integrator pt|bdpt] [--seed N] [--out file.pfm]\n"
+	        "           [--compare file.pfm] [--checkpoint file] [--checkpoint-interval seconds]\n";
+	exit(1);
+}
+
+void parseArguments(int argc, char* argv[])
+{
+	executable = argv[0];
+	if(argc < 2)
+		usage();
+	options.mode = argv[1];
+	if(options.mode != "coordinator" && options.mode != "worker" && options.mode != "single")
+		usage();
+	for(int i = 2; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+			usage();
+		string value = argv[++i];
+		if(arg == "--port")
+			options.port = atoi(value.c_str());
+		else if(arg == "--bind")
+			options.bind = value;
+		else if(arg == "--workers")
+			options.workers = std::max(1, atoi(value.c_str()));
+		else if(arg == "--spawn")
+			options.spawn = atoi(value.c_str()) != 0;
+		else if(arg == "--scene")
+			options.scene = value;
+		else if(arg == "--spp")
+			options.spp = std::max(1, atoi(value.c_str()));
+		else if(arg == "--max-bounces")
+			options.max_bounces = std::max(0, atoi(value.c_str()));
+		else if(arg == "--integrator")
+		{
+			if(value != "pt" && value != "bdpt")
+				usage();
+			options.integrator = value == "bdpt" ? pathtracer::Bidirectional : pathtracer::PathTracing;
+		}
+		else if(arg == "--seed")
+			options.seed = uint32_t(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--update")
+			options.update_every = std::max(1, atoi(value.c_str()));
+		else if(arg == "--out")
+			options.out = value;
+		else if(arg == "--compare")
+			options.compare = value;
+		else if(arg == "--checkpoint")
+			options.checkpoint = value;
+		else if(arg == "--checkpoint-interval")
+			options.checkpoint_interval = std::max(0.0, atof(value.c_str()));
+		else if(arg == "--connect")
+		{
+			size_t colon = value.rfind(':');
+			if(colon == string::npos)
+				usage();
+			options.host = value.substr(0, colon);
+			options.port = atoi(value.substr(colon + 1).c_str());
+		}
+		else if(arg == "--size")
+		{
+			if(sscanf(value.c_str(), "%dx%d", &options.width, &options.height) != 2 || options.width <= 0
+			   || options.height <= 0)
+				usage();
+		}
+		else
+			usage();
+	}
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	parseArguments(argc, argv);
+#if defined(_WIN32)
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+	int result;
+	if(options.mode == "coordinator")
+		result = runCoordinator();
+	else if(options.mode == "worker")
+		result = runWorker();
+	else
+		result = runSingle();
+#if defined(_WIN32)
+	WSACleanup();
+#endif
+	return result;
+}
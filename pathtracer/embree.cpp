@@ -1,6 +1,9 @@
 #include "embree.h"
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <map>
+#include "stats.h"
 
 
 using namespace std;
@@ -12,16 +15,208 @@ namespace pathtracer
 // Global variables
 ///////////////////////////////////////////////////////////////////////////
 RTCDevice embree_device = nullptr;
+shared_ptr<EmbreeScene> current_scene;
+// Same as current_scene->scene, or nullptr
 RTCScene embree_scene = nullptr;
+// Memory allocated by embree, and when the current scene was started
+atomic<int64_t> embree_bytes(0);
+int64_t scene_start_bytes = 0;
+
+EmbreeScene::~EmbreeScene()
+{
+	// Embree can't cancel a build, wait for it
+	if(builder.joinable())
+	{
+		builder.join();
+	}
+	if(final_scene)
+	{
+		rtcDeleteScene(final_scene);
+	}
+	if(scene)
+	{
+		rtcDeleteScene(scene);
+	}
+}
+
+static float millisecondsSince(const chrono::high_resolution_clock::time_point& start)
+{
+	return chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+static size_t tableBytes(const EmbreeScene& s)
+{
+	size_t bytes = s.emissive_triangles.capacity() * sizeof(EmissiveTriangle)
+	               + (s.geom_ID_to_model.size() + s.geom_ID_to_mesh.size()) * 48
+	               + s.geom_ID_to_model_matrix.size() * (48 + sizeof(mat4));
+	for(const auto& g : s.geom_ID_to_primitives)
+	{
+		bytes += g.second.capacity() * sizeof(Primitive) + 48;
+	}
+	return bytes;
+}
+
+shared_ptr<EmbreeScene> getCurrentScene()
+{
+	return current_scene;
+}
+
+void setCurrentScene(const shared_ptr<EmbreeScene>& scene)
+{
+	current_scene = scene;
+	embree_scene = scene ? scene->scene : nullptr;
+}
+
+const vector<EmissiveTriangle>& getEmissiveTriangles()
+{
+	static const vector<EmissiveTriangle> none;
+	return current_scene ? current_scene->emissive_triangles : none;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Add the triangles of a mesh of `s` to its emissive triangles, if its
+// material is emissive
+///////////////////////////////////////////////////////////////////////////
+static void addEmissiveTriangles(EmbreeScene& s, uint32_t geom_ID)
+{
+	const labhelper::Model* model = s.geom_ID_to_model[geom_ID];
+	const labhelper::Mesh* mesh = s.geom_ID_to_mesh[geom_ID];
+	const labhelper::Material& material = model->m_materials[mesh->m_material_idx];
+	if(material.m_emission == vec3(0.0f))
+	{
+		return;
+	}
+	// The same transform as the vertices given to embree
+	const mat4& model_matrix = s.geom_ID_to_model_matrix[geom_ID];
+	const vec3* positions = &model->m_positions[mesh->m_start_index];
+	for(uint32_t i = 0; i < mesh->m_number_of_vertices / 3; i++)
+	{
+		EmissiveTriangle triangle;
+		triangle.p0 = vec3(model_matrix * vec4(positions[i * 3 + 0], 1.0f));
+		triangle.p1 = vec3(model_matrix * vec4(positions[i * 3 + 1], 1.0f));
+		triangle.p2 = vec3(model_matrix * vec4(positions[i * 3 + 2], 1.0f));
+		triangle.material = &material;
+		triangle.geomID = geom_ID;
+		triangle.primID = i;
+		s.emissive_triangles.push_back(triangle);
+	}
+}
+
+void updateEmissiveTriangles()
+{
+	if(!current_scene)
+	{
+		return;
+	}
+	current_scene->emissive_triangles.clear();
+	for(const auto& g : current_scene->geom_ID_to_mesh)
+	{
+		addEmissiveTriangles(*current_scene, g.first);
+	}
+}
+
+const map<uint32_t, vector<Primitive>>& getPrimitives()
+{
+	static const map<uint32_t, vector<Primitive>> none;
+	return current_scene ? current_scene->geom_ID_to_primitives : none;
+}
+
+static void addGeometry(RTCScene target, const labhelper::Model* model, const mat4& model_matrix,
+                        EmbreeScene* tables);
+typedef pair<const uint32_t, vector<Primitive>> PrimitiveGeometry;
+static uint32_t newPrimitiveGeometry(RTCScene target, size_t count);
+static void setPrimitiveFunctions(RTCScene target, PrimitiveGeometry* primitives);
+
+///////////////////////////////////////////////////////////////////////////
+// Build the high-quality BVH of a scene, on the builder thread. The
+// geometry is added in the same order as to the preview, so it gets the
+// same IDs, and the tables hold for both.
+///////////////////////////////////////////////////////////////////////////
+static void buildFinalBVH(EmbreeScene* s)
+{
+	auto start = chrono::high_resolution_clock::now();
+	// Only an estimate if other scenes are built meanwhile
+	const int64_t start_bytes = embree_bytes;
+	RTCScene scene =
+	    rtcDeviceNewScene(embree_device, RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY, RTC_INTERSECT1);
+	for(const EmbreeScene::Addition& a : s->additions)
+	{
+		if(a.model)
+		{
+			addGeometry(scene, a.model, a.model_matrix, nullptr);
+		}
+		else
+		{
+			// Gets the same ID as in the preview, so the same user data
+			PrimitiveGeometry* g = &*s->geom_ID_to_primitives.find(a.primitives_geom_ID);
+			newPrimitiveGeometry(scene, g->second.size());
+			setPrimitiveFunctions(scene, g);
+		}
+	}
+	rtcCommit(scene);
+	s->final_bytes = size_t(std::max(int64_t(0), embree_bytes.load() - start_bytes));
+	s->final_build_ms = millisecondsSince(start);
+	s->final_scene = scene;
+	s->final_built.store(true, memory_order_release);
+}
 
 ///////////////////////////////////////////////////////////////////////////
 // Build an acceleration structure for the scene
 ///////////////////////////////////////////////////////////////////////////
 void buildBVH()
 {
-	cout << "Embree building BVH..." << flush;
+	EmbreeScene& s = *current_scene;
+	cout << "Embree building " << (s.preview ? "preview " : "") << "BVH..." << flush;
+	auto start = chrono::high_resolution_clock::now();
 	rtcCommit(embree_scene);
-	cout << "done.\n";
+	s.build_ms = millisecondsSince(start);
+	// Scenes are built one at a time, so what embree allocated since
+	// reinitScene() is this scene's
+	s.bytes = size_t(std::max(int64_t(0), embree_bytes.load() - scene_start_bytes)) + tableBytes(s);
+	cout << "done (" << s.bytes / (1024 * 1024) << " MB, " << s.build_ms << " ms).\n";
+	if(s.preview)
+	{
+		s.builder = thread(buildFinalBVH, &s);
+	}
+}
+
+void updateBVH()
+{
+	EmbreeScene* s = current_scene.get();
+	if(!s || !s->builder.joinable() || !s->final_built.load(memory_order_acquire))
+	{
+		return;
+	}
+	s->builder.join();
+	rtcDeleteScene(s->scene);
+	s->scene = s->final_scene;
+	s->final_scene = nullptr;
+	s->preview = false;
+	s->bytes = s->final_bytes + tableBytes(*s);
+	embree_scene = s->scene;
+	cout << "Switched to the high-quality BVH (built in " << s->final_build_ms << " ms).\n";
+}
+
+BVHReport getBVHReport()
+{
+	BVHReport r = { false, false, 0.0f, 0.0f };
+	if(current_scene)
+	{
+		const bool final_built = current_scene->final_built.load(memory_order_acquire);
+		r.preview = current_scene->preview;
+		r.building = current_scene->preview && !final_built;
+		r.build_ms = current_scene->build_ms;
+		r.final_build_ms = final_built ? current_scene->final_build_ms : 0.0f;
+	}
+	return r;
+}
+
+void getSceneBounds(vec3& lo, vec3& hi)
+{
+	RTCBounds bounds;
+	rtcGetBounds(embree_scene, bounds);
+	lo = vec3(bounds.lower_x, bounds.lower_y, bounds.lower_z);
+	hi = vec3(bounds.upper_x, bounds.upper_y, bounds.upper_z);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -29,15 +224,22 @@ void buildBVH()
 ///////////////////////////////////////////////////////////////////////////
 void embreeErrorHandler(void* userval, const RTCError code, const char* str)
 {
+	(void)userval;
+	(void)code;
 	cout << "Embree ERROR: " << str << endl;
 	exit(1);
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Used to map an Embree geometry ID to our scene Meshes and Materials
+// Called when embree allocates (bytes > 0) or frees memory
 ///////////////////////////////////////////////////////////////////////////
-map<uint32_t, const labhelper::Model*> map_geom_ID_to_model;
-map<uint32_t, const labhelper::Mesh*> map_geom_ID_to_mesh;
+bool embreeMemoryMonitor(void* userval, const ssize_t bytes, const bool post)
+{
+	(void)userval;
+	(void)post;
+	embree_bytes += int64_t(bytes);
+	return true;
+}
 
 void initEmbree()
 {
@@ -51,20 +253,61 @@ void initEmbree()
 		embree_is_initialized = true;
 		embree_device = rtcNewDevice();
 		rtcDeviceSetErrorFunction2(embree_device, embreeErrorHandler, nullptr);
+		rtcDeviceSetMemoryMonitorFunction2(embree_device, embreeMemoryMonitor, nullptr);
 		cout << "done.\n";
 	}
 }
 
-void reinitScene()
+void reinitScene(bool preview_bvh)
 {
 	initEmbree();
 
-	if(embree_scene)
+	// Delete the previous scene first, unless it was kept, so that it does
+	// not count toward this one's memory
+	setCurrentScene(nullptr);
+	scene_start_bytes = embree_bytes;
+	shared_ptr<EmbreeScene> scene = make_shared<EmbreeScene>();
+	// Dynamic scenes get embree's fast (Morton code) builder
+	scene->preview = preview_bvh;
+	scene->scene = rtcDeviceNewScene(embree_device, preview_bvh ? RTC_SCENE_DYNAMIC : RTC_SCENE_STATIC,
+	                                 RTC_INTERSECT1);
+	setCurrentScene(scene);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Transform and add each mesh in the model as a geometry to an embree
+// scene, and, if `tables` is given, create mappings so that we can
+// connect an embree geom_ID to a Material.
+///////////////////////////////////////////////////////////////////////////
+static void addGeometry(RTCScene target, const labhelper::Model* model, const mat4& model_matrix,
+                        EmbreeScene* tables)
+{
+	for(auto& mesh : model->m_meshes)
 	{
-		rtcDeleteScene(embree_scene);
+		uint32_t geom_ID = rtcNewTriangleMesh(target, RTC_GEOMETRY_STATIC, mesh.m_number_of_vertices / 3,
+		                                      mesh.m_number_of_vertices);
+		// Transform and commit vertices
+		vec4* embree_vertices = (vec4*)rtcMapBuffer(target, geom_ID, RTC_VERTEX_BUFFER);
+		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		{
+			embree_vertices[i] = model_matrix * vec4(model->m_positions[mesh.m_start_index + i], 1.0f);
+		}
+		rtcUnmapBuffer(target, geom_ID, RTC_VERTEX_BUFFER);
+		if(tables)
+		{
+			tables->geom_ID_to_mesh[geom_ID] = &mesh;
+			tables->geom_ID_to_model[geom_ID] = model;
+			tables->geom_ID_to_model_matrix[geom_ID] = model_matrix;
+			addEmissiveTriangles(*tables, geom_ID);
+		}
+		// Commit triangle indices
+		int* embree_tri_idxs = (int*)rtcMapBuffer(target, geom_ID, RTC_INDEX_BUFFER);
+		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		{
+			embree_tri_idxs[i] = i;
+		}
+		rtcUnmapBuffer(target, geom_ID, RTC_INDEX_BUFFER);
 	}
-
-	embree_scene = rtcDeviceNewScene(embree_device, RTC_SCENE_STATIC, RTC_INTERSECT1);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -80,32 +323,101 @@ void addModel(const labhelper::Model* model, const mat4& model_matrix)
 		reinitScene();
 	}
 
-	///////////////////////////////////////////////////////////////////////
-	// Transform and add each mesh in the model as a geometry in embree,
-	// and create mappings so that we can connect an embree geom_ID to a
-	// Material.
-	///////////////////////////////////////////////////////////////////////
 	cout << "Adding " << model->m_name << " to embree scene..." << flush;
-	for(auto& mesh : model->m_meshes)
+	addGeometry(embree_scene, model, model_matrix, current_scene.get());
+	if(current_scene->preview)
 	{
-		uint32_t geom_ID = rtcNewTriangleMesh(embree_scene, RTC_GEOMETRY_STATIC,
-		                                      mesh.m_number_of_vertices / 3, mesh.m_number_of_vertices);
-		map_geom_ID_to_mesh[geom_ID] = &mesh;
-		map_geom_ID_to_model[geom_ID] = model;
-		// Transform and commit vertices
-		vec4* embree_vertices = (vec4*)rtcMapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
-		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
-		{
-			embree_vertices[i] = model_matrix * vec4(model->m_positions[mesh.m_start_index + i], 1.0f);
-		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
-		// Commit triangle indices
-		int* embree_tri_idxs = (int*)rtcMapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
-		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
-		{
-			embree_tri_idxs[i] = i;
-		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
+		current_scene->additions.push_back({ model, model_matrix, RTC_INVALID_GEOMETRY_ID });
+	}
+	cout << "done.\n";
+}
+
+///////////////////////////////////////////////////////////////////////////
+// User geometry callbacks for analytic primitives. The user data is the
+// entry of geom_ID_to_primitives, so they know their geometry ID. Only
+// single rays are traced, so there are no packet versions.
+///////////////////////////////////////////////////////////////////////////
+
+static void primitiveBoundsFunc(void* ptr, size_t item, RTCBounds& bounds)
+{
+	const Primitive& p = static_cast<PrimitiveGeometry*>(ptr)->second[item];
+	vec3 lo, hi;
+	primitiveBounds(p, lo, hi);
+	bounds.lower_x = lo.x;
+	bounds.lower_y = lo.y;
+	bounds.lower_z = lo.z;
+	bounds.upper_x = hi.x;
+	bounds.upper_y = hi.y;
+	bounds.upper_z = hi.z;
+}
+
+static void primitiveIntersectFunc(void* ptr, RTCRay& rtc_ray, size_t item)
+{
+	const PrimitiveGeometry& g = *static_cast<PrimitiveGeometry*>(ptr);
+	Ray& r = reinterpret_cast<Ray&>(rtc_ray);
+	float t;
+	vec2 uv;
+	if(intersectPrimitive(g.second[item], r.o, r.d, r.tnear, r.tfar, t, uv))
+	{
+		r.tfar = t;
+		r.u = uv.x;
+		r.v = uv.y;
+		// getIntersection() computes the exact normal, this is for anyone
+		// reading the embree ray directly
+		vec3 position = r.o + t * r.d;
+		r.n = -primitiveSurface(g.second[item], position);
+		r.geomID = g.first;
+		r.primID = uint32_t(item);
+		r.instID = RTC_INVALID_GEOMETRY_ID;
+	}
+}
+
+static void primitiveOccludedFunc(void* ptr, RTCRay& rtc_ray, size_t item)
+{
+	const PrimitiveGeometry& g = *static_cast<PrimitiveGeometry*>(ptr);
+	Ray& r = reinterpret_cast<Ray&>(rtc_ray);
+	float t;
+	vec2 uv;
+	if(intersectPrimitive(g.second[item], r.o, r.d, r.tnear, r.tfar, t, uv))
+	{
+		r.geomID = 0;
+	}
+}
+
+static uint32_t newPrimitiveGeometry(RTCScene target, size_t count)
+{
+	return rtcNewUserGeometry3(target, RTC_GEOMETRY_STATIC, count);
+}
+
+static void setPrimitiveFunctions(RTCScene target, PrimitiveGeometry* primitives)
+{
+	rtcSetUserData(target, primitives->first, primitives);
+	rtcSetBoundsFunction(target, primitives->first, primitiveBoundsFunc);
+	rtcSetIntersectFunction(target, primitives->first, primitiveIntersectFunc);
+	rtcSetOccludedFunction(target, primitives->first, primitiveOccludedFunc);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Add analytic primitives to the embree scene
+///////////////////////////////////////////////////////////////////////////
+void addPrimitives(const vector<Primitive>& primitives)
+{
+	if(primitives.empty())
+	{
+		return;
+	}
+	if(!embree_scene)
+	{
+		reinitScene();
+	}
+
+	cout << "Adding " << primitives.size() << " primitives to embree scene..." << flush;
+	uint32_t geom_ID = newPrimitiveGeometry(embree_scene, primitives.size());
+	setPrimitiveFunctions(embree_scene,
+	                      &*current_scene->geom_ID_to_primitives.insert(make_pair(geom_ID, primitives)).first);
+	if(current_scene->preview)
+	{
+		current_scene->additions.push_back({ nullptr, mat4(1.0f), geom_ID });
 	}
 	cout << "done.\n";
 }
@@ -115,8 +427,26 @@ void addModel(const labhelper::Model* model, const mat4& model_matrix)
 ///////////////////////////////////////////////////////////////////////////
 Intersection getIntersection(const Ray& r)
 {
-	const labhelper::Model* model = map_geom_ID_to_model[r.geomID];
-	const labhelper::Mesh* mesh = map_geom_ID_to_mesh[r.geomID];
+	stats::ScopedCycles timer(stats::Shading);
+	stats::local().intersections++;
+	if(!current_scene->geom_ID_to_primitives.empty())
+	{
+		auto primitives = current_scene->geom_ID_to_primitives.find(r.geomID);
+		if(primitives != current_scene->geom_ID_to_primitives.end())
+		{
+			const Primitive& p = primitives->second[r.primID];
+			Intersection i;
+			i.material = p.material;
+			i.position = r.o + r.tfar * r.d;
+			i.geometry_normal = primitiveSurface(p, i.position);
+			i.shading_normal = i.geometry_normal;
+			i.wo = normalize(-r.d);
+			i.uv = vec2(r.u, r.v);
+			return i;
+		}
+	}
+	const labhelper::Model* model = current_scene->geom_ID_to_model[r.geomID];
+	const labhelper::Mesh* mesh = current_scene->geom_ID_to_mesh[r.geomID];
 	Intersection i;
 	i.material = &(model->m_materials[mesh->m_material_idx]);
 	vec3 n0 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
@@ -140,6 +470,7 @@ Intersection getIntersection(const Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool intersect(Ray& r)
 {
+	stats::ScopedCycles timer(stats::Traversal);
 	rtcIntersect(embree_scene, *((RTCRay*)&r));
 	return r.geomID != RTC_INVALID_GEOMETRY_ID;
 }
@@ -150,7 +481,12 @@ bool intersect(Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool occluded(Ray& r)
 {
+	stats::ScopedCycles timer(stats::Traversal);
+	stats::Counters& counters = stats::local();
+	counters.shadow_rays++;
 	rtcOccluded(embree_scene, *((RTCRay*)&r));
-	return r.geomID != RTC_INVALID_GEOMETRY_ID;
+	bool hit = r.geomID != RTC_INVALID_GEOMETRY_ID;
+	counters.occluded_hits += hit ? 1 : 0;
+	return hit;
 }
 } // namespace pathtracer
\ No newline at end of file
@@ -2,8 +2,13 @@
 #include <embree2/rtcore.h>
 #include <embree2/rtcore_ray.h>
 #include "Model.h"
+#include "primitives.h"
 #include <glm/glm.hpp>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <thread>
+#include <vector>
 
 namespace pathtracer
 {
@@ -82,6 +87,61 @@ struct RTCORE_ALIGN(16) Ray
 	uint32_t instID = RTC_INVALID_GEOMETRY_ID;
 };
 
+///////////////////////////////////////////////////////////////////////////
+// Triangles with an emissive material, in world space. Collected by
+// addModel() so that they can be sampled as light sources, and again by
+// updateEmissiveTriangles() when materials change. Their emission is read
+// from the material, so edits to it show without collecting them again.
+///////////////////////////////////////////////////////////////////////////
+struct EmissiveTriangle
+{
+	glm::vec3 p0, p1, p2;
+	const labhelper::Material* material;
+	uint32_t geomID, primID;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// An embree scene, with the tables that map its geometry IDs back to
+// meshes and materials. The functions below work on the current one.
+// Keep it (getCurrentScene()) to switch back to it later without building
+// it again (setCurrentScene()).
+///////////////////////////////////////////////////////////////////////////
+struct EmbreeScene
+{
+	RTCScene scene = nullptr;
+	std::map<uint32_t, const labhelper::Model*> geom_ID_to_model;
+	std::map<uint32_t, const labhelper::Mesh*> geom_ID_to_mesh;
+	std::map<uint32_t, glm::mat4> geom_ID_to_model_matrix;
+	std::vector<EmissiveTriangle> emissive_triangles;
+	// The primitives of each user geometry, by the primID embree reports.
+	// The nodes of a map do not move, so embree is given pointers to them.
+	std::map<uint32_t, std::vector<Primitive>> geom_ID_to_primitives;
+	// Memory used by embree for it and by the tables, set by buildBVH()
+	size_t bytes = 0;
+
+	// With a preview BVH (see reinitScene()): what was added, in order, to
+	// add it again to the high-quality scene, which is built by `builder`
+	// and swapped in by updateBVH()
+	struct Addition
+	{
+		const labhelper::Model* model; // nullptr for primitives
+		glm::mat4 model_matrix;
+		uint32_t primitives_geom_ID;
+	};
+	std::vector<Addition> additions;
+	bool preview = false;
+	std::thread builder;
+	std::atomic<bool> final_built{ false };
+	RTCScene final_scene = nullptr;
+	size_t final_bytes = 0;
+	float build_ms = 0.0f, final_build_ms = 0.0f;
+
+	~EmbreeScene();
+};
+
+std::shared_ptr<EmbreeScene> getCurrentScene();
+void setCurrentScene(const std::shared_ptr<EmbreeScene>& scene);
+
 ///////////////////////////////////////////////////////////////////////////
 // Scene functions
 ///////////////////////////////////////////////////////////////////////////
@@ -89,13 +149,48 @@ struct RTCORE_ALIGN(16) Ray
 // Add a model to the embree scene
 void addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
 
+// Add analytic primitives to the embree scene, as one user geometry
+void addPrimitives(const std::vector<Primitive>& primitives);
+
 // Build an acceleration structure for the scene
 void buildBVH();
 
+// Bounding box of the scene. Use after calling `buildBVH`
+void getSceneBounds(glm::vec3& lo, glm::vec3& hi);
+
+// Emissive triangles of the current scene
+const std::vector<EmissiveTriangle>& getEmissiveTriangles();
+
+// Collect the emissive triangles of the current scene again, for meshes
+// whose material became emissive or stopped being so
+void updateEmissiveTriangles();
+
+// Analytic primitives of the current scene, by geometry ID
+const std::map<uint32_t, std::vector<Primitive>>& getPrimitives();
+
 ///////////////////////////////////////////////////////////////////////////
-// Reinitialize the scene
+// Start a new, empty current scene. The previous one is deleted unless
+// it was kept.
+//
+// With preview_bvh, buildBVH() only does a quick build of a lower quality
+// BVH, so that tracing can start right away, and then builds a
+// high-quality one on a background thread.
 ///////////////////////////////////////////////////////////////////////////
-void reinitScene();
+void reinitScene(bool preview_bvh = false);
+
+///////////////////////////////////////////////////////////////////////////
+// Swap in the high-quality BVH of the current scene if its background
+// build is done. Call between passes, while no rays are being traced.
+///////////////////////////////////////////////////////////////////////////
+void updateBVH();
+
+struct BVHReport
+{
+	bool preview;  // the quick BVH is in use
+	bool building; // the high-quality one is being built
+	float build_ms, final_build_ms;
+};
+BVHReport getBVHReport();
 
 
 ///////////////////////////////////////////////////////////////////////////
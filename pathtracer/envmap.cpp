@@ -0,0 +1,196 @@
+#include "envmap.h"
+#include <algorithm>
+#include <iostream>
+#include <omp.h>
+#include "fastmath.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace glm;
+
+namespace pathtracer
+{
+static inline float signNotZero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Octahedral mapping between unit directions and [0,1]^2 (y is up)
+///////////////////////////////////////////////////////////////////////////
+vec2 octahedralEncode(const vec3& d)
+{
+	float inv_l1 = 1.0f / (abs(d.x) + abs(d.y) + abs(d.z));
+	vec2 p = vec2(d.x, d.z) * inv_l1;
+	if(d.y < 0.0f)
+	{
+		p = vec2((1.0f - abs(p.y)) * signNotZero(p.x), (1.0f - abs(p.x)) * signNotZero(p.y));
+	}
+	return p * 0.5f + 0.5f;
+}
+
+vec3 octahedralDecode(vec2 uv)
+{
+	vec2 p = uv * 2.0f - 1.0f;
+	vec3 d = vec3(p.x, 1.0f - abs(p.x) - abs(p.y), p.y);
+	if(d.y < 0.0f)
+	{
+		d.x = (1.0f - abs(p.y)) * signNotZero(p.x);
+		d.z = (1.0f - abs(p.x)) * signNotZero(p.y);
+	}
+	return normalize(d);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Fold a point just outside the octahedral square back inside. Used to
+// fill the border texels so that bilinear filtering wraps correctly.
+///////////////////////////////////////////////////////////////////////////
+static vec2 octahedralWrap(vec2 uv)
+{
+	vec2 p = uv * 2.0f - 1.0f;
+	if(p.x > 1.0f)
+	{
+		p = vec2(2.0f - p.x, -p.y);
+	}
+	else if(p.x < -1.0f)
+	{
+		p = vec2(-2.0f - p.x, -p.y);
+	}
+	if(p.y > 1.0f)
+	{
+		p = vec2(-p.x, 2.0f - p.y);
+	}
+	else if(p.y < -1.0f)
+	{
+		p = vec2(-p.x, -2.0f - p.y);
+	}
+	return p * 0.5f + 0.5f;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The same parameterization as the original Lenvironment()
+///////////////////////////////////////////////////////////////////////////
+static vec3 sampleEquirect(const HDRImage& equirect, const vec3& wi)
+{
+	const float theta = fast_acos(std::max(-1.0f, std::min(1.0f, wi.y)));
+	float phi = fast_atan2(wi.z, wi.x);
+	if(phi < 0.0f)
+		phi = phi + 2.0f * 3.14159265359f;
+	return equirect.sampleBilinear(phi / (2.0f * 3.14159265359f), 1.0f - theta / 3.14159265359f);
+}
+
+void OctahedralMap::build(const HDRImage& equirect, int _size)
+{
+	if(_size <= 0)
+	{
+		// An octahedral texel covers 4pi/size^2 sr, an equirect one 4pi/(2*height^2) on average
+		_size = int(equirect.height * 1.41421356f);
+	}
+	size = _size;
+	const int stride = size + 2;
+	texels.resize(stride * stride);
+
+	// 2x2 supersampling per texel, so that minification from the source
+	// image doesn't alias.
+	const float offsets[2] = { 0.25f, 0.75f };
+#pragma omp parallel for
+	for(int ty = 0; ty < stride; ty++)
+	{
+		for(int tx = 0; tx < stride; tx++)
+		{
+			vec3 sum = vec3(0.0f);
+			for(float oy : offsets)
+			{
+				for(float ox : offsets)
+				{
+					vec2 uv = vec2((float(tx - 1) + ox) / float(size), (float(ty - 1) + oy) / float(size));
+					sum += sampleEquirect(equirect, octahedralDecode(octahedralWrap(uv)));
+				}
+			}
+			texels[ty * stride + tx] = 0.25f * sum;
+		}
+	}
+}
+
+vec3 OctahedralMap::lookup(const vec3& d) const
+{
+	const int stride = size + 2;
+	vec2 pos = octahedralEncode(d) * float(size) + 0.5f;
+	vec2 p0 = min(floor(pos), vec2(float(size)));
+	vec2 w = pos - p0;
+	int x0 = int(p0.x);
+	int y0 = int(p0.y);
+	const vec3* row0 = &texels[y0 * stride + x0];
+	const vec3* row1 = row0 + stride;
+	return mix(mix(row0[0], row0[1], w.x), mix(row1[0], row1[1], w.x), w.y);
+}
+
+void OctahedralMap::lookup8(const float* dx, const float* dy, const float* dz, vec3* result) const
+{
+#if defined(__AVX2__)
+	const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 fsize = _mm256_set1_ps(float(size));
+	const __m256i stride3 = _mm256_set1_epi32((size + 2) * 3);
+	const __m256i three = _mm256_set1_epi32(3);
+
+	__m256 x = _mm256_loadu_ps(dx);
+	__m256 y = _mm256_loadu_ps(dy);
+	__m256 z = _mm256_loadu_ps(dz);
+
+	// Project onto the octahedron |x| + |y| + |z| = 1
+	__m256 l1 = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(sign_mask, x), _mm256_andnot_ps(sign_mask, y)),
+	                          _mm256_andnot_ps(sign_mask, z));
+	__m256 inv_l1 = _mm256_div_ps(one, l1);
+	__m256 px = _mm256_mul_ps(x, inv_l1);
+	__m256 pz = _mm256_mul_ps(z, inv_l1);
+
+	// Fold the lower hemisphere over the diagonals
+	__m256 sign_x = _mm256_or_ps(one, _mm256_and_ps(sign_mask, px));
+	__m256 sign_z = _mm256_or_ps(one, _mm256_and_ps(sign_mask, pz));
+	__m256 fold_x = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_andnot_ps(sign_mask, pz)), sign_x);
+	__m256 fold_z = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_andnot_ps(sign_mask, px)), sign_z);
+	__m256 lower = _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ);
+	px = _mm256_blendv_ps(px, fold_x, lower);
+	pz = _mm256_blendv_ps(pz, fold_z, lower);
+
+	// To texel space, including the one texel border
+	__m256 pos_x = _mm256_fmadd_ps(_mm256_fmadd_ps(px, half, half), fsize, half);
+	__m256 pos_y = _mm256_fmadd_ps(_mm256_fmadd_ps(pz, half, half), fsize, half);
+	__m256 x0 = _mm256_min_ps(_mm256_floor_ps(pos_x), fsize);
+	__m256 y0 = _mm256_min_ps(_mm256_floor_ps(pos_y), fsize);
+	__m256 wx = _mm256_sub_ps(pos_x, x0);
+	__m256 wy = _mm256_sub_ps(pos_y, y0);
+
+	__m256i i00 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(y0), stride3),
+	                               _mm256_mullo_epi32(_mm256_cvttps_epi32(x0), three));
+	__m256i i01 = _mm256_add_epi32(i00, three);
+	__m256i i10 = _mm256_add_epi32(i00, stride3);
+	__m256i i11 = _mm256_add_epi32(i10, three);
+
+	const float* base = &texels[0].x;
+	float out[3][8];
+	for(int c = 0; c < 3; c++)
+	{
+		__m256 t00 = _mm256_i32gather_ps(base + c, i00, 4);
+		__m256 t01 = _mm256_i32gather_ps(base + c, i01, 4);
+		__m256 t10 = _mm256_i32gather_ps(base + c, i10, 4);
+		__m256 t11 = _mm256_i32gather_ps(base + c, i11, 4);
+		__m256 top = _mm256_fmadd_ps(wx, _mm256_sub_ps(t01, t00), t00);
+		__m256 bottom = _mm256_fmadd_ps(wx, _mm256_sub_ps(t11, t10), t10);
+		_mm256_storeu_ps(out[c], _mm256_fmadd_ps(wy, _mm256_sub_ps(bottom, top), top));
+	}
+	for(int i = 0; i < 8; i++)
+	{
+		result[i] = vec3(out[0][i], out[1][i], out[2][i]);
+	}
+#else
+	for(int i = 0; i < 8; i++)
+	{
+		result[i] = lookup(vec3(dx[i], dy[i], dz[i]));
+	}
+#endif
+}
+} // namespace pathtracer
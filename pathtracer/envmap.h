@@ -0,0 +1,45 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "HDRImage.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// An environment map resampled once into an octahedral parameterization.
+// Looking up a direction is then only a few adds, an abs and a divide
+// (no acos/atan), and the result is bilinearly filtered. The texture has a
+// one texel border filled with the octahedral wrap, so the four bilinear
+// taps never need special casing at the seams.
+///////////////////////////////////////////////////////////////////////////
+struct OctahedralMap
+{
+	// Resolution of the octahedral square, not counting the border
+	int size = 0;
+	// (size + 2) * (size + 2) texels, row major
+	std::vector<glm::vec3> texels;
+
+	// Resample an equirectangular image (as used by Lenvironment). If size
+	// is 0 it is chosen so that texels have about the same solid angle as
+	// in the source image.
+	void build(const HDRImage& equirect, int size = 0);
+
+	bool valid() const
+	{
+		return size > 0;
+	}
+
+	// Bilinearly filtered radiance in direction `d` (need not be normalized)
+	glm::vec3 lookup(const glm::vec3& d) const;
+
+	// Look up 8 directions at once, given in SoA form. Uses AVX2 when the
+	// pathtracer is compiled with it, otherwise falls back to lookup().
+	void lookup8(const float* dx, const float* dy, const float* dz, glm::vec3* result) const;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Octahedral mapping between unit directions and [0,1]^2 (y is up)
+///////////////////////////////////////////////////////////////////////////
+glm::vec2 octahedralEncode(const glm::vec3& d);
+glm::vec3 octahedralDecode(glm::vec2 uv);
+} // namespace pathtracer
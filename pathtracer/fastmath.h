@@ -0,0 +1,499 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Small fast-math library for the shading hot path.
+//
+// Every function is written once as a template over the "lane" type, and
+// instantiated for plain float, float4 (SSE2) and float8 (AVX2, or two
+// float4 when not compiled with it), so the scalar and vector versions agree up to FMA
+// contraction. Maximum errors, measured against libm (double) over the stated
+// domains (checked by fastmath_test.cpp):
+//
+//   exp2(x)     x in [-126, 127]          3e-7 relative
+//   log2(x)     x normal, positive        1.5e-7 * max(1, |log2(x)|) absolute
+//               (absolute for x in [1/2, 2], relative elsewhere)
+//   pow(x, y)   x > 0, |y*log2(x)| < 126  2e-7 * (1 + |y*log2(x)|) relative
+//               x <= 0 returns 0
+//   sincos(x)   |x| < 8192                1e-7 absolute
+//   acos(x)     x in [-1, 1]              5e-7 absolute (radians)
+//   atan2(y, x) all finite y, x           3e-7 absolute (radians)
+//
+// The pathtracer uses these through fast_pow() etc. below, which fall back
+// to libm when PATHTRACER_FAST_MATH is 0.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef PATHTRACER_FAST_MATH
+#define PATHTRACER_FAST_MATH 1
+#endif
+
+namespace pathtracer
+{
+namespace fastmath
+{
+///////////////////////////////////////////////////////////////////////////
+// Lane types. Comparisons on float return bool, on the SIMD types they
+// return all-bits masks of the same type.
+///////////////////////////////////////////////////////////////////////////
+struct float4
+{
+	__m128 v;
+	float4() = default;
+	float4(__m128 _v) : v(_v)
+	{
+	}
+	float4(float s) : v(_mm_set1_ps(s))
+	{
+	}
+	static float4 load(const float* p)
+	{
+		return _mm_loadu_ps(p);
+	}
+	void store(float* p) const
+	{
+		_mm_storeu_ps(p, v);
+	}
+};
+
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+inline float4 operator-(float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline float4 operator<(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline float4 operator>(float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline float4 operator==(float4 a, float4 b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline float4 operator|(float4 a, float4 b) { return _mm_or_ps(a.v, b.v); }
+inline float4 operator&(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+inline float4 operator>=(float4 a, float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline float4 operator<=(float4 a, float4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline int movemask(float4 mask) { return _mm_movemask_ps(mask.v); }
+inline float4 select(float4 mask, float4 a, float4 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+inline float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+// Only valid for |a| < 2^31, which all callers guarantee
+inline float4 round(float4 a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a.v)); }
+inline float4 floor(float4 a)
+{
+	float4 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	return t - select(a < t, float4(1.0f), float4(0.0f));
+}
+// Sign bit of b applied to a
+inline float4 xorsign(float4 a, float4 b)
+{
+	return _mm_xor_ps(a.v, _mm_and_ps(b.v, _mm_set1_ps(-0.0f)));
+}
+// 2^n for integral n in [-126, 127]
+inline float4 pow2i(float4 n)
+{
+	__m128i e = _mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127));
+	return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+// Split a positive normal float into mantissa in [1,2) and exponent
+inline float4 frexp2(float4 a, float4& exponent)
+{
+	__m128i bits = _mm_castps_si128(a.v);
+	exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128i m = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000));
+	return _mm_castsi128_ps(m);
+}
+
+#if defined(__AVX2__)
+struct float8
+{
+	__m256 v;
+	float8() = default;
+	float8(__m256 _v) : v(_v)
+	{
+	}
+	float8(float s) : v(_mm256_set1_ps(s))
+	{
+	}
+	static float8 load(const float* p)
+	{
+		return _mm256_loadu_ps(p);
+	}
+	void store(float* p) const
+	{
+		_mm256_storeu_ps(p, v);
+	}
+};
+
+inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+inline float8 operator-(float8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline float8 operator<(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline float8 operator>(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline float8 operator==(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+inline float8 operator|(float8 a, float8 b) { return _mm256_or_ps(a.v, b.v); }
+inline float8 operator&(float8 a, float8 b) { return _mm256_and_ps(a.v, b.v); }
+inline float8 operator>=(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline float8 operator<=(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline int movemask(float8 mask) { return _mm256_movemask_ps(mask.v); }
+inline float8 select(float8 mask, float8 a, float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline float8 abs(float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline float8 min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+inline float8 max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+inline float8 sqrt(float8 a) { return _mm256_sqrt_ps(a.v); }
+inline float8 round(float8 a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+inline float8 floor(float8 a) { return _mm256_floor_ps(a.v); }
+inline float8 xorsign(float8 a, float8 b)
+{
+	return _mm256_xor_ps(a.v, _mm256_and_ps(b.v, _mm256_set1_ps(-0.0f)));
+}
+inline float8 pow2i(float8 n)
+{
+	__m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+	return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+inline float8 frexp2(float8 a, float8& exponent)
+{
+	__m256i bits = _mm256_castps_si256(a.v);
+	exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+	__m256i m = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+	                            _mm256_set1_epi32(0x3F800000));
+	return _mm256_castsi256_ps(m);
+}
+#else
+///////////////////////////////////////////////////////////////////////////
+// Without AVX2, float8 is two float4 so that 8-wide code still compiles
+///////////////////////////////////////////////////////////////////////////
+struct float8
+{
+	float4 lo, hi;
+	float8() = default;
+	float8(float4 _lo, float4 _hi) : lo(_lo), hi(_hi)
+	{
+	}
+	float8(float s) : lo(s), hi(s)
+	{
+	}
+	static float8 load(const float* p)
+	{
+		return float8(float4::load(p), float4::load(p + 4));
+	}
+	void store(float* p) const
+	{
+		lo.store(p);
+		hi.store(p + 4);
+	}
+};
+
+#define FASTMATH_FLOAT8_BINARY(op)                                                                           \
+	inline float8 operator op(float8 a, float8 b) { return float8(a.lo op b.lo, a.hi op b.hi); }
+FASTMATH_FLOAT8_BINARY(+)
+FASTMATH_FLOAT8_BINARY(-)
+FASTMATH_FLOAT8_BINARY(*)
+FASTMATH_FLOAT8_BINARY(/)
+FASTMATH_FLOAT8_BINARY(<)
+FASTMATH_FLOAT8_BINARY(>)
+FASTMATH_FLOAT8_BINARY(<=)
+FASTMATH_FLOAT8_BINARY(>=)
+FASTMATH_FLOAT8_BINARY(==)
+FASTMATH_FLOAT8_BINARY(|)
+FASTMATH_FLOAT8_BINARY(&)
+#undef FASTMATH_FLOAT8_BINARY
+
+#define FASTMATH_FLOAT8_UNARY(fn)                                                                            \
+	inline float8 fn(float8 a) { return float8(fn(a.lo), fn(a.hi)); }
+FASTMATH_FLOAT8_UNARY(abs)
+FASTMATH_FLOAT8_UNARY(sqrt)
+FASTMATH_FLOAT8_UNARY(round)
+FASTMATH_FLOAT8_UNARY(floor)
+FASTMATH_FLOAT8_UNARY(pow2i)
+#undef FASTMATH_FLOAT8_UNARY
+
+inline float8 operator-(float8 a) { return float8(-a.lo, -a.hi); }
+inline float8 select(float8 mask, float8 a, float8 b)
+{
+	return float8(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi));
+}
+inline float8 min(float8 a, float8 b) { return float8(min(a.lo, b.lo), min(a.hi, b.hi)); }
+inline float8 max(float8 a, float8 b) { return float8(max(a.lo, b.lo), max(a.hi, b.hi)); }
+inline float8 xorsign(float8 a, float8 b) { return float8(xorsign(a.lo, b.lo), xorsign(a.hi, b.hi)); }
+inline float8 frexp2(float8 a, float8& exponent)
+{
+	return float8(frexp2(a.lo, exponent.lo), frexp2(a.hi, exponent.hi));
+}
+inline int movemask(float8 mask) { return movemask(mask.lo) | (movemask(mask.hi) << 4); }
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Scalar lane helpers, mirroring the SIMD ones above
+///////////////////////////////////////////////////////////////////////////
+inline float select(bool mask, float a, float b) { return mask ? a : b; }
+inline float xorsign(float a, float b) { return std::signbit(b) ? -a : a; }
+inline float pow2i(float n)
+{
+	uint32_t bits = uint32_t(int32_t(n) + 127) << 23;
+	float r;
+	std::memcpy(&r, &bits, sizeof(r));
+	return r;
+}
+inline float frexp2(float a, float& exponent)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &a, sizeof(bits));
+	exponent = float(int32_t(bits >> 23) - 127);
+	bits = (bits & 0x007FFFFF) | 0x3F800000;
+	float m;
+	std::memcpy(&m, &bits, sizeof(m));
+	return m;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// std::allocator does not honour the 32 byte alignment of float8 before
+// C++17, so containers of SIMD types need this one.
+///////////////////////////////////////////////////////////////////////////
+template<class T>
+struct aligned_allocator
+{
+	typedef T value_type;
+	aligned_allocator() = default;
+	template<class U>
+	aligned_allocator(const aligned_allocator<U>&)
+	{
+	}
+	T* allocate(size_t n)
+	{
+		void* p = _mm_malloc(n * sizeof(T), alignof(T) < 32 ? 32 : alignof(T));
+		if(p == nullptr)
+			throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+	void deallocate(T* p, size_t)
+	{
+		_mm_free(p);
+	}
+	template<class U>
+	struct rebind
+	{
+		typedef aligned_allocator<U> other;
+	};
+};
+template<class T, class U>
+bool operator==(const aligned_allocator<T>&, const aligned_allocator<U>&)
+{
+	return true;
+}
+template<class T, class U>
+bool operator!=(const aligned_allocator<T>&, const aligned_allocator<U>&)
+{
+	return false;
+}
+
+namespace detail
+{
+using std::abs;
+using std::floor;
+using std::sqrt;
+using std::round;
+using fastmath::abs;
+using fastmath::floor;
+using fastmath::sqrt;
+using fastmath::round;
+
+template<class T>
+inline T minT(T a, T b)
+{
+	return select(a < b, a, b);
+}
+template<class T>
+inline T maxT(T a, T b)
+{
+	return select(a > b, a, b);
+}
+
+template<class T>
+inline T exp2(T x)
+{
+	x = maxT(T(-126.0f), minT(x, T(127.0f)));
+	T xi = round(x);
+	T f = x - xi;
+	// Taylor series of 2^f on [-1/2, 1/2]
+	T p = T(1.5403530e-4f);
+	p = p * f + T(1.3333558e-3f);
+	p = p * f + T(9.6181291e-3f);
+	p = p * f + T(5.5504109e-2f);
+	p = p * f + T(2.4022651e-1f);
+	p = p * f + T(6.9314718e-1f);
+	p = p * f + T(1.0f);
+	return p * pow2i(xi);
+}
+
+template<class T>
+inline T log2(T x)
+{
+	T e;
+	T m = frexp2(x, e);
+	// Move the mantissa to [sqrt(1/2), sqrt(2)) to center the series
+	auto big = m > T(1.41421356f);
+	m = select(big, m * T(0.5f), m);
+	e = select(big, e + T(1.0f), e);
+	// log2(m) = 2/ln(2) * atanh((m - 1) / (m + 1))
+	T t = (m - T(1.0f)) / (m + T(1.0f));
+	T t2 = t * t;
+	T p = T(1.0f / 9.0f);
+	p = p * t2 + T(1.0f / 7.0f);
+	p = p * t2 + T(1.0f / 5.0f);
+	p = p * t2 + T(1.0f / 3.0f);
+	p = p * t2 + T(1.0f);
+	return e + T(2.8853900817779268f) * t * p;
+}
+
+template<class T>
+inline T pow(T x, T y)
+{
+	T r = exp2(y * log2(maxT(x, T(1.17549435e-38f))));
+	return select(x > T(0.0f), r, T(0.0f));
+}
+
+template<class T>
+inline void sincos(T x, T& s, T& c)
+{
+	// Reduce to [-pi/4, pi/4] with a three part Cody-Waite pi/2
+	T q = round(x * T(0.63661977236758134f));
+	T r = x - q * T(1.5703125f);
+	r = r - q * T(4.837512969970703125e-4f);
+	r = r - q * T(7.549789948768648e-8f);
+	T r2 = r * r;
+	T ps = T(-1.9515295891e-4f);
+	ps = ps * r2 + T(8.3321608736e-3f);
+	ps = ps * r2 + T(-1.6666654611e-1f);
+	ps = ps * r2 * r + r;
+	T pc = T(2.443315711809948e-5f);
+	pc = pc * r2 + T(-1.388731625493765e-3f);
+	pc = pc * r2 + T(4.166664568298827e-2f);
+	pc = pc * r2 * r2 - T(0.5f) * r2 + T(1.0f);
+	// Quadrant: 0 -> (s, c), 1 -> (c, -s), 2 -> (-s, -c), 3 -> (-c, s)
+	T quadrant = q - T(4.0f) * floor(q * T(0.25f));
+	auto odd = (quadrant == T(1.0f)) | (quadrant == T(3.0f));
+	auto s_neg = (quadrant == T(2.0f)) | (quadrant == T(3.0f));
+	auto c_neg = (quadrant == T(1.0f)) | (quadrant == T(2.0f));
+	T ss = select(odd, pc, ps);
+	T cc = select(odd, ps, pc);
+	s = select(s_neg, -ss, ss);
+	c = select(c_neg, -cc, cc);
+}
+
+template<class T>
+inline T acos(T x)
+{
+	// Abramowitz & Stegun 4.4.46
+	T a = minT(abs(x), T(1.0f));
+	T p = T(-0.0012624911f);
+	p = p * a + T(0.0066700901f);
+	p = p * a + T(-0.0170881256f);
+	p = p * a + T(0.0308918810f);
+	p = p * a + T(-0.0501743046f);
+	p = p * a + T(0.0889789874f);
+	p = p * a + T(-0.2145988016f);
+	p = p * a + T(1.5707963050f);
+	T r = sqrt(T(1.0f) - a) * p;
+	return select(x < T(0.0f), T(3.14159265358979f) - r, r);
+}
+
+template<class T>
+inline T atan2(T y, T x)
+{
+	T ax = abs(x);
+	T ay = abs(y);
+	T mx = maxT(ax, ay);
+	T a = minT(ax, ay) / select(mx == T(0.0f), T(1.0f), mx);
+	// Reduce to [0, tan(pi/12)] via atan(a) = pi/6 + atan((a*sqrt3 - 1) / (a + sqrt3))
+	auto reduce = a > T(0.26794919f);
+	a = select(reduce, (a * T(1.7320508f) - T(1.0f)) / (a + T(1.7320508f)), a);
+	T a2 = a * a;
+	T p = T(-1.0f / 11.0f);
+	p = p * a2 + T(1.0f / 9.0f);
+	p = p * a2 + T(-1.0f / 7.0f);
+	p = p * a2 + T(1.0f / 5.0f);
+	p = p * a2 + T(-1.0f / 3.0f);
+	p = p * a2 * a + a;
+	T r = select(reduce, p + T(0.52359877559829887f), p);
+	r = select(ay > ax, T(1.5707963267948966f) - r, r);
+	r = select(x < T(0.0f), T(3.14159265358979f) - r, r);
+	return xorsign(r, y);
+}
+} // namespace detail
+
+///////////////////////////////////////////////////////////////////////////
+// Public entry points
+///////////////////////////////////////////////////////////////////////////
+inline float exp2(float x) { return detail::exp2(x); }
+inline float log2(float x) { return detail::log2(x); }
+inline float pow(float x, float y) { return detail::pow(x, y); }
+inline void sincos(float x, float& s, float& c) { detail::sincos(x, s, c); }
+inline float acos(float x) { return detail::acos(x); }
+inline float atan2(float y, float x) { return detail::atan2(y, x); }
+
+inline float4 exp2(float4 x) { return detail::exp2(x); }
+inline float4 log2(float4 x) { return detail::log2(x); }
+inline float4 pow(float4 x, float4 y) { return detail::pow(x, y); }
+inline void sincos(float4 x, float4& s, float4& c) { detail::sincos(x, s, c); }
+inline float4 acos(float4 x) { return detail::acos(x); }
+inline float4 atan2(float4 y, float4 x) { return detail::atan2(y, x); }
+
+inline float8 exp2(float8 x) { return detail::exp2(x); }
+inline float8 log2(float8 x) { return detail::log2(x); }
+inline float8 pow(float8 x, float8 y) { return detail::pow(x, y); }
+inline void sincos(float8 x, float8& s, float8& c) { detail::sincos(x, s, c); }
+inline float8 acos(float8 x) { return detail::acos(x); }
+inline float8 atan2(float8 y, float8 x) { return detail::atan2(y, x); }
+} // namespace fastmath
+
+///////////////////////////////////////////////////////////////////////////
+// What the pathtracer calls. Switched at compile time.
+///////////////////////////////////////////////////////////////////////////
+inline float fast_pow(float x, float y)
+{
+#if PATHTRACER_FAST_MATH
+	return fastmath::pow(x, y);
+#else
+	return std::pow(x, y);
+#endif
+}
+
+inline void fast_sincos(float x, float& s, float& c)
+{
+#if PATHTRACER_FAST_MATH
+	fastmath::sincos(x, s, c);
+#else
+	s = std::sin(x);
+	c = std::cos(x);
+#endif
+}
+
+inline float fast_acos(float x)
+{
+#if PATHTRACER_FAST_MATH
+	return fastmath::acos(x);
+#else
+	return std::acos(x);
+#endif
+}
+
+inline float fast_atan2(float y, float x)
+{
+#if PATHTRACER_FAST_MATH
+	return fastmath::atan2(y, x);
+#else
+	return std::atan2(y, x);
+#endif
+}
+} // namespace pathtracer
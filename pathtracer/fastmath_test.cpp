@@ -0,0 +1,304 @@
+///////////////////////////////////////////////////////////////////////////
+// fastmath_test: sweeps each function of fastmath.h over the domain stated
+// in its table, in all three lane types (float, float4, float8), and
+// checks the error against libm (double) stays within the stated bound.
+// Prints the worst error of each function and exits with 1 if any bound
+// is exceeded.
+///////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "fastmath.h"
+
+using namespace pathtracer;
+
+namespace
+{
+///////////////////////////////////////////////////////////////////////////
+// The functions, callable with any lane type
+///////////////////////////////////////////////////////////////////////////
+struct Exp2
+{
+	template<class T>
+	T operator()(T x) const
+	{
+		return fastmath::exp2(x);
+	}
+};
+struct Log2
+{
+	template<class T>
+	T operator()(T x) const
+	{
+		return fastmath::log2(x);
+	}
+};
+struct Sin
+{
+	template<class T>
+	T operator()(T x) const
+	{
+		T s, c;
+		fastmath::sincos(x, s, c);
+		return s;
+	}
+};
+struct Cos
+{
+	template<class T>
+	T operator()(T x) const
+	{
+		T s, c;
+		fastmath::sincos(x, s, c);
+		return c;
+	}
+};
+struct Acos
+{
+	template<class T>
+	T operator()(T x) const
+	{
+		return fastmath::acos(x);
+	}
+};
+struct Pow
+{
+	template<class T>
+	T operator()(T x, T y) const
+	{
+		return fastmath::pow(x, y);
+	}
+};
+struct Atan2
+{
+	template<class T>
+	T operator()(T y, T x) const
+	{
+		return fastmath::atan2(y, x);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// f of 8 inputs, computed once with each lane type
+///////////////////////////////////////////////////////////////////////////
+const int kLaneTypes = 3;
+
+template<class F>
+void evaluate(F f, const float* x, float (&out)[kLaneTypes][8])
+{
+	for(int i = 0; i < 8; i++)
+		out[0][i] = f(x[i]);
+	for(int i = 0; i < 8; i += 4)
+		f(fastmath::float4::load(x + i)).store(out[1] + i);
+	f(fastmath::float8::load(x)).store(out[2]);
+}
+
+template<class F>
+void evaluate(F f, const float* x, const float* y, float (&out)[kLaneTypes][8])
+{
+	for(int i = 0; i < 8; i++)
+		out[0][i] = f(x[i], y[i]);
+	for(int i = 0; i < 8; i += 4)
+		f(fastmath::float4::load(x + i), fastmath::float4::load(y + i)).store(out[1] + i);
+	f(fastmath::float8::load(x), fastmath::float8::load(y)).store(out[2]);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Worst error seen for one row of the table
+///////////////////////////////////////////////////////////////////////////
+struct Result
+{
+	const char* name;
+	const char* error;
+	double bound;
+	double worst;
+	float at_x, at_y;
+};
+
+void record(Result& r, double error, float x, float y = 0.0f)
+{
+	// NaN counts as failing
+	if(!(error <= r.worst))
+	{
+		r.worst = std::isnan(error) ? INFINITY : error;
+		r.at_x = x;
+		r.at_y = y;
+	}
+}
+
+float fromBits(uint32_t bits)
+{
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The sweeps. Each fills 8 inputs at a time and checks every lane type.
+///////////////////////////////////////////////////////////////////////////
+void testExp2(Result& r)
+{
+	// 2^22 evenly spaced points over [-126, 127]
+	const int n = 1 << 22;
+	float x[8], out[kLaneTypes][8];
+	for(int i = 0; i < n; i += 8)
+	{
+		for(int j = 0; j < 8; j++)
+			x[j] = -126.0f + 253.0f * float(i + j) / float(n - 1);
+		evaluate(Exp2(), x, out);
+		for(int l = 0; l < kLaneTypes; l++)
+			for(int j = 0; j < 8; j++)
+			{
+				const double ref = std::exp2(double(x[j]));
+				record(r, std::abs(out[l][j] - ref) / ref, x[j]);
+			}
+	}
+}
+
+void testLog2(Result& r)
+{
+	// Every 257th positive normal float
+	float x[8], out[kLaneTypes][8];
+	int filled = 0;
+	for(uint64_t bits = 0x00800000u; bits < 0x7F800000u; bits += 257)
+	{
+		x[filled++] = fromBits(uint32_t(bits));
+		if(filled < 8)
+			continue;
+		filled = 0;
+		evaluate(Log2(), x, out);
+		for(int l = 0; l < kLaneTypes; l++)
+			for(int j = 0; j < 8; j++)
+			{
+				const double ref = std::log2(double(x[j]));
+				record(r, std::abs(out[l][j] - ref) / std::max(1.0, std::abs(ref)), x[j]);
+			}
+	}
+}
+
+void testPow(Result& r, std::mt19937& rng)
+{
+	// x a random positive normal float, y such that y * log2(x) is uniform
+	// in the domain
+	std::uniform_int_distribution<uint32_t> bits(0x00800000u, 0x7F7FFFFFu);
+	std::uniform_real_distribution<float> exponent(-125.9f, 125.9f);
+	float x[8], y[8], out[kLaneTypes][8];
+	for(int i = 0; i < (1 << 20); i += 8)
+	{
+		for(int j = 0; j < 8; j++)
+		{
+			x[j] = fromBits(bits(rng));
+			const float l = float(std::log2(double(x[j])));
+			y[j] = l != 0.0f ? exponent(rng) / l : exponent(rng);
+		}
+		evaluate(Pow(), x, y, out);
+		for(int l = 0; l < kLaneTypes; l++)
+			for(int j = 0; j < 8; j++)
+			{
+				const double z = double(y[j]) * std::log2(double(x[j]));
+				if(std::abs(z) >= 126.0)
+					continue;
+				const double ref = std::exp2(z);
+				record(r, std::abs(out[l][j] - ref) / ref / (1.0 + std::abs(z)), x[j], y[j]);
+			}
+	}
+	// x <= 0 returns 0
+	const float nonpositive[8] = { 0.0f, -0.0f, -1.0f, -FLT_MIN, -1e-30f, -2.5f, -1e30f, -FLT_MAX };
+	const float any[8] = { 0.0f, 1.0f, -1.0f, 2.5f, 0.5f, -3.0f, 100.0f, 1e-3f };
+	evaluate(Pow(), nonpositive, any, out);
+	for(int l = 0; l < kLaneTypes; l++)
+		for(int j = 0; j < 8; j++)
+			record(r, out[l][j] == 0.0f ? 0.0 : INFINITY, nonpositive[j], any[j]);
+}
+
+template<class F>
+void testSincos(Result& r, F f, double (*ref)(double))
+{
+	// 2^22 evenly spaced points over (-8192, 8192)
+	const int n = 1 << 22;
+	float x[8], out[kLaneTypes][8];
+	for(int i = 0; i < n; i += 8)
+	{
+		for(int j = 0; j < 8; j++)
+			x[j] = -8191.99f + 16383.98f * float(i + j) / float(n - 1);
+		evaluate(f, x, out);
+		for(int l = 0; l < kLaneTypes; l++)
+			for(int j = 0; j < 8; j++)
+				record(r, std::abs(out[l][j] - ref(double(x[j]))), x[j]);
+	}
+}
+
+void testAcos(Result& r)
+{
+	// 2^22 evenly spaced points over [-1, 1], ends included
+	const int n = 1 << 22;
+	float x[8], out[kLaneTypes][8];
+	for(int i = 0; i < n; i += 8)
+	{
+		for(int j = 0; j < 8; j++)
+			x[j] = std::min(1.0f, -1.0f + 2.0f * float(i + j) / float(n - 1));
+		evaluate(Acos(), x, out);
+		for(int l = 0; l < kLaneTypes; l++)
+			for(int j = 0; j < 8; j++)
+				record(r, std::abs(out[l][j] - std::acos(double(x[j]))), x[j]);
+	}
+}
+
+void testAtan2(Result& r, std::mt19937& rng)
+{
+	// Random finite floats of any sign and exponent, zeros included
+	std::uniform_int_distribution<uint32_t> bits(0u, 0x7F7FFFFFu);
+	std::uniform_int_distribution<int> sign(0, 1);
+	float x[8], y[8], out[kLaneTypes][8];
+	for(int i = 0; i < (1 << 20); i += 8)
+	{
+		for(int j = 0; j < 8; j++)
+		{
+			x[j] = fromBits(bits(rng) | (sign(rng) ? 0x80000000u : 0u));
+			y[j] = fromBits(bits(rng) | (sign(rng) ? 0x80000000u : 0u));
+		}
+		if(i == 0)
+			x[0] = y[0] = 0.0f;
+		evaluate(Atan2(), y, x, out);
+		for(int l = 0; l < kLaneTypes; l++)
+			for(int j = 0; j < 8; j++)
+				record(r, std::abs(out[l][j] - std::atan2(double(y[j]), double(x[j]))), y[j], x[j]);
+	}
+}
+} // namespace
+
+int main()
+{
+	// The bounds of the table in fastmath.h
+	Result results[] = {
+		{ "exp2", "relative", 3e-7, 0.0, 0.0f, 0.0f },
+		{ "log2", "absolute / max(1, |log2(x)|)", 1.5e-7, 0.0, 0.0f, 0.0f },
+		{ "pow", "relative / (1 + |y*log2(x)|)", 2e-7, 0.0, 0.0f, 0.0f },
+		{ "sin", "absolute", 1e-7, 0.0, 0.0f, 0.0f },
+		{ "cos", "absolute", 1e-7, 0.0, 0.0f, 0.0f },
+		{ "acos", "absolute", 5e-7, 0.0, 0.0f, 0.0f },
+		{ "atan2", "absolute", 3e-7, 0.0, 0.0f, 0.0f },
+	};
+	std::mt19937 rng(1);
+	testExp2(results[0]);
+	testLog2(results[1]);
+	testPow(results[2], rng);
+	testSincos(results[3], Sin(), static_cast<double (*)(double)>(std::sin));
+	testSincos(results[4], Cos(), static_cast<double (*)(double)>(std::cos));
+	testAcos(results[5]);
+	testAtan2(results[6], rng);
+
+	int failed = 0;
+	for(const Result& r : results)
+	{
+		const bool ok = r.worst <= r.bound;
+		printf("%-6s %-30s worst %.3g (bound %.3g) at (%.9g, %.9g) %s\n", r.name, r.error, r.worst, r.bound,
+		       r.at_x, r.at_y, ok ? "ok" : "FAILED");
+		failed += ok ? 0 : 1;
+	}
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#version 420
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+in vec3 viewSpaceNormal;
+in vec3 viewSpacePosition;
+
+// xyz: normal, w: distance along the view direction (0 where nothing is hit)
+layout(location = 0) out vec4 guide;
+
+void main()
+{
+	guide = vec4(normalize(viewSpaceNormal), -viewSpacePosition.z);
+}
@@ -0,0 +1,19 @@
+#version 420
+// First-hit view-space normal and depth of the scene, the guide for the
+// upscaler (see upscale.frag)
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normalIn;
+
+uniform mat4 modelViewMatrix;
+uniform mat4 modelViewProjectionMatrix;
+uniform mat4 normalMatrix;
+
+out vec3 viewSpaceNormal;
+out vec3 viewSpacePosition;
+
+void main()
+{
+	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	viewSpaceNormal = (normalMatrix * vec4(normalIn, 0.0)).xyz;
+	viewSpacePosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
+}
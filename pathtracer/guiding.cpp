@@ -0,0 +1,452 @@
+#include "guiding.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Pathtracer.h"
+#include "atomicfloat.h"
+#include "embree.h"
+#include "sampling.h"
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Tuning, as suggested in the paper
+///////////////////////////////////////////////////////////////////////////
+// A region is split when an iteration recorded more than
+// SPATIAL_THRESHOLD * sqrt(passes in the iteration) samples in it
+const float SPATIAL_THRESHOLD = 12000.0f;
+const int MAX_SPATIAL_DEPTH = 24;
+// A quadtree cell is subdivided when it holds more than this fraction of
+// the region's energy
+const float DIRECTIONAL_THRESHOLD = 0.01f;
+const int MAX_DIRECTIONAL_DEPTH = 20;
+// Training stops after iterations of 1, 2, ..., 2^(N-1) passes
+const int TRAINING_ITERATIONS = 9;
+
+///////////////////////////////////////////////////////////////////////////
+// Quadtree over directions, in the equal-area cylindrical parametrization
+// (cos(theta), phi) -> [0,1]^2. Each node holds the energy of its four
+// quadrants; child[i] is 0 for quadrants that are leaves.
+///////////////////////////////////////////////////////////////////////////
+inline vec2 dirToCanonical(const vec3& d)
+{
+	float cos_theta = clamp(d.z, -1.0f, 1.0f);
+	float phi = atan2(d.y, d.x);
+	if(phi < 0.0f)
+		phi += 2.0f * M_PI;
+	return vec2((cos_theta + 1.0f) * 0.5f, std::min(phi / (2.0f * M_PI), 0.99999994f));
+}
+
+inline vec3 canonicalToDir(const vec2& p)
+{
+	float cos_theta = 2.0f * p.x - 1.0f;
+	float phi = 2.0f * M_PI * p.y;
+	float sin_theta = sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	return vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+}
+
+struct QuadNode
+{
+	AtomicFloat sum[4];
+	uint32_t child[4] = { 0, 0, 0, 0 };
+
+	float total() const
+	{
+		return sum[0].get() + sum[1].get() + sum[2].get() + sum[3].get();
+	}
+};
+
+inline int quadrant(vec2& p)
+{
+	int x = p.x >= 0.5f ? 1 : 0;
+	int y = p.y >= 0.5f ? 1 : 0;
+	p = p * 2.0f - vec2(x, y);
+	return x + 2 * y;
+}
+
+class DTree
+{
+public:
+	DTree() : nodes(1)
+	{
+	}
+
+	bool empty() const
+	{
+		return !(nodes[0].total() > 0.0f);
+	}
+
+	int size() const
+	{
+		return int(nodes.size());
+	}
+
+	float weight() const
+	{
+		return sample_weight.get();
+	}
+
+	void halveWeight()
+	{
+		sample_weight = sample_weight.get() * 0.5f;
+	}
+
+	vec3 sample() const
+	{
+		vec2 origin(0.0f);
+		float size = 1.0f;
+		uint32_t index = 0;
+		while(true)
+		{
+			const QuadNode& node = nodes[index];
+			float u = randf() * node.total();
+			int i = 0;
+			while(i < 3 && (u >= node.sum[i].get() || node.sum[i].get() <= 0.0f))
+			{
+				u -= node.sum[i].get();
+				i++;
+			}
+			size *= 0.5f;
+			origin += vec2(i & 1, i >> 1) * size;
+			if(node.child[i] == 0)
+				break;
+			index = node.child[i];
+		}
+		return canonicalToDir(origin + size * vec2(randf(), randf()));
+	}
+
+	float pdf(const vec3& d) const
+	{
+		vec2 p = dirToCanonical(d);
+		float density = 1.0f;
+		uint32_t index = 0;
+		while(true)
+		{
+			const QuadNode& node = nodes[index];
+			int i = quadrant(p);
+			float total = node.total();
+			if(!(node.sum[i].get() > 0.0f))
+				return 0.0f;
+			density *= 4.0f * node.sum[i].get() / total;
+			if(node.child[i] == 0)
+				break;
+			index = node.child[i];
+		}
+		return density / (4.0f * M_PI);
+	}
+
+	// Only touches leaf quadrants; build() sums them up
+	void record(const vec3& d, float value)
+	{
+		vec2 p = dirToCanonical(d);
+		uint32_t index = 0;
+		while(true)
+		{
+			QuadNode& node = nodes[index];
+			int i = quadrant(p);
+			if(node.child[i] == 0)
+			{
+				node.sum[i].add(value);
+				break;
+			}
+			index = node.child[i];
+		}
+		sample_weight.add(1.0f);
+	}
+
+	// Sum the recorded energy up the tree. Children always come after their
+	// parent in `nodes`.
+	void build()
+	{
+		for(int n = int(nodes.size()) - 1; n >= 0; n--)
+		{
+			for(int i = 0; i < 4; i++)
+			{
+				if(nodes[n].child[i] != 0)
+					nodes[n].sum[i] = nodes[nodes[n].child[i]].total();
+			}
+		}
+	}
+
+	// An empty tree with cells subdivided where this one has much energy
+	DTree refined() const
+	{
+		struct Entry
+		{
+			int node; // in this tree, -1 if this tree doesn't go as deep
+			float energy[4];
+			uint32_t refined_node;
+			int depth;
+		};
+		DTree result;
+		const float total = nodes[0].total();
+		if(!(total > 0.0f))
+			return result;
+		vector<Entry> stack;
+		Entry root = { 0, {}, 0, 1 };
+		for(int i = 0; i < 4; i++)
+			root.energy[i] = nodes[0].sum[i].get();
+		stack.push_back(root);
+		while(!stack.empty())
+		{
+			Entry e = stack.back();
+			stack.pop_back();
+			for(int i = 0; i < 4; i++)
+			{
+				if(e.depth >= MAX_DIRECTIONAL_DEPTH || e.energy[i] / total <= DIRECTIONAL_THRESHOLD)
+					continue;
+				Entry child;
+				child.refined_node = uint32_t(result.nodes.size());
+				child.depth = e.depth + 1;
+				child.node = e.node >= 0 && nodes[e.node].child[i] != 0 ? int(nodes[e.node].child[i]) : -1;
+				for(int j = 0; j < 4; j++)
+					child.energy[j] = child.node >= 0 ? nodes[child.node].sum[j].get() : e.energy[i] * 0.25f;
+				result.nodes.push_back(QuadNode());
+				result.nodes[e.refined_node].child[i] = child.refined_node;
+				stack.push_back(child);
+			}
+		}
+		return result;
+	}
+
+private:
+	vector<QuadNode> nodes;
+	AtomicFloat sample_weight; // Number of recorded samples
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The spatial tree: a binary tree over a cube around the scene, splitting
+// x, y and z in turn. Leaves point to a region with the distribution that
+// is sampled in this iteration and the one that is being learned.
+///////////////////////////////////////////////////////////////////////////
+struct GuidingRegion
+{
+	DTree sampling;
+	DTree building;
+};
+
+struct SNode
+{
+	int child[2] = { -1, -1 };
+	int region = -1; // >= 0 for leaves
+};
+
+struct SDTree
+{
+	vec3 origin;
+	float size;
+	vector<SNode> nodes;
+	vector<GuidingRegion> regions;
+	int iteration = 0;
+
+	GuidingRegion* find(const vec3& position)
+	{
+		vec3 p = clamp((position - origin) / size, vec3(0.0f), vec3(0.99999994f));
+		int index = 0;
+		int axis = 0;
+		while(nodes[index].region < 0)
+		{
+			int c = p[axis] >= 0.5f ? 1 : 0;
+			p[axis] = p[axis] * 2.0f - float(c);
+			index = nodes[index].child[c];
+			axis = (axis + 1) % 3;
+		}
+		return &regions[nodes[index].region];
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The tree for the next iteration, from what `tree` learned in the last
+///////////////////////////////////////////////////////////////////////////
+SDTree* buildNextTree(const SDTree& tree, int passes)
+{
+	SDTree* next = new SDTree(tree);
+	for(GuidingRegion& region : next->regions)
+	{
+		region.building.build();
+		if(!region.building.empty())
+			region.sampling = region.building;
+	}
+
+	// Split regions that saw many samples, until their halves saw few
+	// enough. Both halves start out with the parent's distributions.
+	const float threshold = SPATIAL_THRESHOLD * sqrt(float(passes));
+	struct Entry
+	{
+		int node, depth;
+	};
+	vector<Entry> stack = { { 0, 0 } };
+	while(!stack.empty())
+	{
+		Entry e = stack.back();
+		stack.pop_back();
+		if(next->nodes[e.node].region < 0)
+		{
+			for(int c = 0; c < 2; c++)
+				stack.push_back({ next->nodes[e.node].child[c], e.depth + 1 });
+			continue;
+		}
+		int region = next->nodes[e.node].region;
+		if(e.depth >= MAX_SPATIAL_DEPTH || next->regions[region].building.weight() <= threshold)
+			continue;
+		next->regions[region].building.halveWeight();
+		GuidingRegion half = next->regions[region];
+		next->regions.push_back(half);
+		SNode left, right;
+		left.region = region;
+		right.region = int(next->regions.size()) - 1;
+		next->nodes[e.node].region = -1;
+		for(int c = 0; c < 2; c++)
+		{
+			next->nodes[e.node].child[c] = int(next->nodes.size());
+			next->nodes.push_back(c == 0 ? left : right);
+			stack.push_back({ next->nodes[e.node].child[c], e.depth + 1 });
+		}
+	}
+
+	for(GuidingRegion& region : next->regions)
+		region.building = region.sampling.refined();
+	next->iteration = tree.iteration + 1;
+	return next;
+}
+
+SDTree* createTree()
+{
+	vec3 lo, hi;
+	getSceneBounds(lo, hi);
+	vec3 extent = hi - lo;
+	float size = std::max(extent.x, std::max(extent.y, extent.z)) * 1.01f + EPSILON;
+	SDTree* tree = new SDTree();
+	tree->origin = (lo + hi) * 0.5f - vec3(size * 0.5f);
+	tree->size = size;
+	tree->nodes.push_back(SNode());
+	tree->nodes[0].region = 0;
+	tree->regions.push_back(GuidingRegion());
+	return tree;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Training state. `current` is only replaced between passes; the builder
+// thread reads it while no pass records into it.
+///////////////////////////////////////////////////////////////////////////
+shared_ptr<SDTree> current;
+SDTree* active = nullptr; // current, while a pass uses guiding
+unique_ptr<SDTree> built;
+struct Builder
+{
+	std::thread worker;
+	~Builder()
+	{
+		// Don't let a build outlive the program
+		if(worker.joinable())
+			worker.join();
+	}
+} builder;
+atomic<bool> builder_done(false);
+bool building = false;
+bool recording = false;
+int recorded_passes = 0;
+
+void finishBuild()
+{
+	builder.worker.join();
+	building = false;
+	current.reset(built.release());
+	recorded_passes = 0;
+}
+
+void beginGuidingPass()
+{
+	if(building && builder_done.load())
+		finishBuild();
+	if(!settings.path_guiding || settings.integrator != PathTracing)
+	{
+		active = nullptr;
+		recording = false;
+		return;
+	}
+	if(!current)
+		current.reset(createTree());
+	active = current.get();
+	recording = !building && current->iteration < TRAINING_ITERATIONS;
+}
+
+void endGuidingPass()
+{
+	if(!recording)
+		return;
+	recording = false;
+	if(++recorded_passes < (1 << current->iteration))
+		return;
+	building = true;
+	builder_done = false;
+	shared_ptr<SDTree> tree = current;
+	int passes = recorded_passes;
+	builder.worker = thread([tree, passes]() {
+		built.reset(buildNextTree(*tree, passes));
+		builder_done = true;
+	});
+}
+
+void resetGuiding()
+{
+	if(building)
+		finishBuild();
+	current.reset();
+	active = nullptr;
+	recording = false;
+	recorded_passes = 0;
+}
+
+GuidingRegion* findGuidingRegion(const vec3& p)
+{
+	return active ? active->find(p) : nullptr;
+}
+
+bool hasGuidingDistribution(const GuidingRegion& region)
+{
+	return !region.sampling.empty();
+}
+
+vec3 sampleGuiding(const GuidingRegion& region)
+{
+	return region.sampling.sample();
+}
+
+float guidingPdf(const GuidingRegion& region, const vec3& wi)
+{
+	return region.sampling.pdf(wi);
+}
+
+bool isGuidingRecording()
+{
+	return recording;
+}
+
+void recordGuiding(GuidingRegion& region, const vec3& wi, float radiance_over_pdf)
+{
+	if(recording && radiance_over_pdf > 0.0f && std::isfinite(radiance_over_pdf))
+		region.building.record(wi, radiance_over_pdf);
+}
+
+GuidingReport getGuidingReport()
+{
+	GuidingReport report = {};
+	report.building = building;
+	report.training = current && current->iteration < TRAINING_ITERATIONS;
+	if(current)
+	{
+		report.iteration = current->iteration;
+		report.regions = int(current->regions.size());
+		for(const GuidingRegion& region : current->regions)
+			report.directional += region.sampling.size();
+	}
+	return report;
+}
+} // namespace pathtracer
@@ -0,0 +1,56 @@
+#pragma once
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Path guiding (settings.path_guiding), after Müller et al., "Practical
+// Path Guiding for Efficient Light-Transport Simulation" (2017).
+//
+// Incident radiance is learned online in an SD-tree: a binary tree over
+// the scene bounds whose leaves (regions) each hold a quadtree over the
+// sphere of directions. Li() samples the diffuse part of a bounce from an
+// even mix of a region's quadtree and the BSDF, and reports the radiance
+// its paths found back to the tree.
+//
+// Training runs in iterations of 1, 2, 4, ... passes. After each
+// iteration the next tree is built on a background thread from what was
+// learned: regions that got many samples are split, and quadtree cells
+// that hold much of the energy are subdivided. Passes keep sampling the
+// previous tree meanwhile (they just don't learn), and pick up the new one
+// when it is done, so the render threads never wait for it.
+///////////////////////////////////////////////////////////////////////////
+struct GuidingRegion;
+
+// Call around each pass of tracePaths()
+void beginGuidingPass();
+void endGuidingPass();
+
+// Forget what was learned (the scene changed)
+void resetGuiding();
+
+// Region that contains p, or nullptr if guiding is off for this pass
+GuidingRegion* findGuidingRegion(const glm::vec3& p);
+
+// Whether the region has learned anything to sample from yet
+bool hasGuidingDistribution(const GuidingRegion& region);
+glm::vec3 sampleGuiding(const GuidingRegion& region);
+float guidingPdf(const GuidingRegion& region, const glm::vec3& wi);
+
+// Whether this pass learns, i.e. if recordGuiding() is worth calling
+bool isGuidingRecording();
+
+// An estimate of the radiance arriving along wi, divided by the pdf with
+// which wi was sampled. Thread safe.
+void recordGuiding(GuidingRegion& region, const glm::vec3& wi, float radiance_over_pdf);
+
+struct GuidingReport
+{
+	int iteration;   // completed training iterations
+	int regions;     // leaves of the spatial tree
+	int directional; // quadtree nodes, over all regions
+	bool training;
+	bool building;
+};
+GuidingReport getGuidingReport();
+} // namespace pathtracer
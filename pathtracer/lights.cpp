@@ -0,0 +1,229 @@
+#include "lights.h"
+#include <algorithm>
+#include <unordered_map>
+#include <labhelper.h>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "sampling.h"
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+vector<LightSource> lights;
+static vector<float> light_cdf;
+// Emissive primitives of the current scene, in the order of their lights
+static vector<const Primitive*> primitive_lights;
+// (geomID, primID) of emissive triangles and primitives to their index in
+// `lights`
+static unordered_map<uint64_t, int> area_lights;
+
+static inline uint64_t areaKey(uint32_t geomID, uint32_t primID)
+{
+	return (uint64_t(geomID) << 32) | primID;
+}
+
+static inline float luminance(const vec3& c)
+{
+	return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+static inline float triangleArea(const EmissiveTriangle& t)
+{
+	return 0.5f * length(cross(t.p1 - t.p0, t.p2 - t.p0));
+}
+
+float buildLights()
+{
+	lights.clear();
+	primitive_lights.clear();
+	area_lights.clear();
+	vector<float> power;
+	if(point_light.intensity_multiplier > 0.0f)
+	{
+		lights.push_back({ PointLightSource, 0, 0.0f });
+		power.push_back(4.0f * M_PI * luminance(point_light.intensity_multiplier * point_light.color));
+	}
+	for(int i = 0; i < int(disc_lights.size()); i++)
+	{
+		const DiscLight& l = disc_lights[i];
+		lights.push_back({ DiscLightSource, i, 0.0f });
+		power.push_back(M_PI * l.radius * l.radius * M_PI * luminance(l.intensity_multiplier * l.color));
+	}
+	const vector<EmissiveTriangle>& triangles = getEmissiveTriangles();
+	for(int i = 0; i < int(triangles.size()); i++)
+	{
+		const EmissiveTriangle& t = triangles[i];
+		area_lights[areaKey(t.geomID, t.primID)] = int(lights.size());
+		lights.push_back({ TriangleLightSource, i, 0.0f });
+		// Emits from both sides, as in Li()
+		power.push_back(triangleArea(t) * 2.0f * M_PI * luminance(t.material->m_emission));
+	}
+	// The materials of primitives can be edited, so look at them each time
+	for(const auto& g : getPrimitives())
+	{
+		for(int i = 0; i < int(g.second.size()); i++)
+		{
+			const Primitive& p = g.second[i];
+			if(p.material->m_emission == vec3(0.0f))
+				continue;
+			area_lights[areaKey(g.first, uint32_t(i))] = int(lights.size());
+			lights.push_back({ PrimitiveLightSource, int(primitive_lights.size()), 0.0f });
+			primitive_lights.push_back(&p);
+			// Two sided like the triangles
+			power.push_back(primitiveArea(p) * 2.0f * M_PI * luminance(p.material->m_emission));
+		}
+	}
+
+	float total = 0.0f;
+	for(float p : power)
+		total += p;
+	light_cdf.resize(lights.size());
+	float sum = 0.0f;
+	for(size_t i = 0; i < lights.size(); i++)
+	{
+		lights[i].selection_pdf = total > 0.0f ? power[i] / total : 1.0f / float(lights.size());
+		sum += lights[i].selection_pdf;
+		light_cdf[i] = sum;
+	}
+	return total;
+}
+
+int findAreaLight(uint32_t geomID, uint32_t primID)
+{
+	auto it = area_lights.find(areaKey(geomID, primID));
+	return it != area_lights.end() ? it->second : -1;
+}
+
+int sampleLight(float u, float& pdf)
+{
+	if(lights.empty())
+		return -1;
+	int i = int(upper_bound(light_cdf.begin(), light_cdf.end(), u) - light_cdf.begin());
+	i = std::min(i, int(lights.size()) - 1);
+	pdf = lights[i].selection_pdf;
+	return pdf > 0.0f ? i : -1;
+}
+
+vec3 uniformSampleSphere()
+{
+	float z = 1.0f - 2.0f * randf();
+	float r = sqrt(std::max(0.0f, 1.0f - z * z));
+	float phi = 2.0f * M_PI * randf();
+	return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Uniform point on the surface of a primitive, and its normal there
+///////////////////////////////////////////////////////////////////////////
+static void samplePrimitivePoint(const Primitive& primitive, vec3& p, vec3& n)
+{
+	if(primitive.type == SpherePrimitive)
+	{
+		n = uniformSampleSphere();
+		p = primitive.position + primitive.radius * n;
+	}
+	else if(primitive.type == DiscPrimitive)
+	{
+		vec2 disc = concentricSampleDisk() * primitive.radius;
+		p = primitive.position + labhelper::tangentSpace(primitive.normal) * vec3(disc, 0.0f);
+		n = primitive.normal;
+	}
+	else
+	{
+		float s = randf(), t = randf();
+		p = primitive.position + s * primitive.edge0 + t * primitive.edge1;
+		n = primitive.normal;
+	}
+}
+
+void sampleLightPoint(const LightSource& l, vec3& p, vec3& n, float& pdf_pos)
+{
+	if(l.type == PointLightSource)
+	{
+		p = point_light.position;
+		n = vec3(0.0f);
+		pdf_pos = 1.0f;
+	}
+	else if(l.type == DiscLightSource)
+	{
+		const DiscLight& d = disc_lights[l.index];
+		vec2 disc = concentricSampleDisk() * d.radius;
+		p = d.position + labhelper::tangentSpace(d.direction) * vec3(disc, 0.0f);
+		n = d.direction;
+		pdf_pos = 1.0f / (M_PI * d.radius * d.radius);
+	}
+	else if(l.type == PrimitiveLightSource)
+	{
+		samplePrimitivePoint(*primitive_lights[l.index], p, n);
+		pdf_pos = 1.0f / primitiveArea(*primitive_lights[l.index]);
+	}
+	else
+	{
+		const EmissiveTriangle& t = getEmissiveTriangles()[l.index];
+		float su = sqrt(randf());
+		float b0 = 1.0f - su, b1 = randf() * su;
+		p = b0 * t.p0 + b1 * t.p1 + (1.0f - b0 - b1) * t.p2;
+		n = normalize(cross(t.p1 - t.p0, t.p2 - t.p0));
+		pdf_pos = 1.0f / triangleArea(t);
+	}
+}
+
+vec3 lightLe(const LightSource& l, const vec3& n, const vec3& w)
+{
+	if(l.type == PointLightSource)
+		return point_light.intensity_multiplier * point_light.color;
+	if(l.type == DiscLightSource)
+	{
+		const DiscLight& d = disc_lights[l.index];
+		return dot(w, n) > 0.0f ? d.intensity_multiplier * d.color : vec3(0.0f);
+	}
+	if(l.type == PrimitiveLightSource)
+		return primitive_lights[l.index]->material->m_emission;
+	return getEmissiveTriangles()[l.index].material->m_emission;
+}
+
+void lightPdfLe(const LightSource& l, const vec3& n, const vec3& w, float& pdf_pos, float& pdf_dir)
+{
+	if(l.type == PointLightSource)
+	{
+		pdf_pos = 0.0f; // Delta position
+		pdf_dir = 1.0f / (4.0f * M_PI);
+	}
+	else if(l.type == DiscLightSource)
+	{
+		const DiscLight& d = disc_lights[l.index];
+		pdf_pos = 1.0f / (M_PI * d.radius * d.radius);
+		pdf_dir = std::max(0.0f, dot(w, n)) / M_PI;
+	}
+	else
+	{
+		pdf_pos = l.type == PrimitiveLightSource ? 1.0f / primitiveArea(*primitive_lights[l.index]) :
+		                                           1.0f / triangleArea(getEmissiveTriangles()[l.index]);
+		pdf_dir = 0.5f * abs(dot(w, n)) / M_PI;
+	}
+}
+
+bool sampleLe(const LightSource& l, vec3& p, vec3& n, vec3& w, vec3& Le, float& pdf_pos, float& pdf_dir)
+{
+	sampleLightPoint(l, p, n, pdf_pos);
+	if(l.type == PointLightSource)
+	{
+		w = uniformSampleSphere();
+		pdf_dir = 1.0f / (4.0f * M_PI);
+	}
+	else
+	{
+		vec3 side = n;
+		// Emissive triangles and primitives emit from both sides
+		if(l.type != DiscLightSource && randf() < 0.5f)
+			side = -n;
+		w = labhelper::tangentSpace(side) * cosineSampleHemisphere();
+		float unused;
+		lightPdfLe(l, n, w, unused, pdf_dir);
+	}
+	Le = lightLe(l, n, w);
+	return pdf_dir > 0.0f && Le != vec3(0.0f);
+}
+} // namespace pathtracer
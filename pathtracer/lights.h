@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Light sources for the integrators that start paths on lights (bdpt.h,
+// sppm.h): the point light, the disc lights, every emissive triangle and
+// every emissive primitive (primitives.h), chosen with probability
+// proportional to their power.
+///////////////////////////////////////////////////////////////////////////
+enum LightType
+{
+	PointLightSource,
+	DiscLightSource,
+	TriangleLightSource,
+	PrimitiveLightSource,
+};
+
+struct LightSource
+{
+	LightType type;
+	int index; // in disc_lights, getEmissiveTriangles() or the emissive primitives
+	float selection_pdf;
+};
+
+extern std::vector<LightSource> lights;
+
+// Collect the lights of the current scene and return their total power
+// (luminance). Call before each pass, lights may have been edited.
+float buildLights();
+
+// Index in `lights` of the emissive triangle or primitive a ray hit, or -1
+int findAreaLight(uint32_t geomID, uint32_t primID);
+
+// Pick a light by power, -1 if there are none
+int sampleLight(float u, float& pdf);
+
+glm::vec3 uniformSampleSphere();
+
+// Uniform point on a light's surface, with its normal and area density
+void sampleLightPoint(const LightSource& l, glm::vec3& p, glm::vec3& n, float& pdf_pos);
+
+// Radiance leaving a light at a point with normal n in direction w (for the
+// point light: its intensity)
+glm::vec3 lightLe(const LightSource& l, const glm::vec3& n, const glm::vec3& w);
+
+// Densities of emitting from a point of the light (area measure) and in
+// direction w (solid angle), as sampled by sampleLe()
+void lightPdfLe(const LightSource& l, const glm::vec3& n, const glm::vec3& w, float& pdf_pos, float& pdf_dir);
+
+// Start a light path: point, normal, direction and emitted radiance
+bool sampleLe(const LightSource& l, glm::vec3& p, glm::vec3& n, glm::vec3& w, glm::vec3& Le, float& pdf_pos,
+              float& pdf_dir);
+} // namespace pathtracer
@@ -1,6 +1,7 @@
 
 #include <GL/glew.h>
 #include <stb_image.h>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <labhelper.h>
@@ -12,7 +13,12 @@
 #include <string>
 #include "Pathtracer.h"
 #include "embree.h"
+#include "guiding.h"
+#include "radiance_cache.h"
+#include "resolution.h"
 #include "sampling.h"
+#include "scenes.h"
+#include "stats.h"
 
 
 using namespace glm;
@@ -40,6 +46,8 @@ bool showLightSources = false;
 ///////////////////////////////////////////////////////////////////////////////
 GLuint shaderProgram;
 GLuint simpleShaderProgram;
+GLuint upscaleShaderProgram;
+GLuint gbufferShaderProgram;
 
 ///////////////////////////////////////////////////////////////////////////////
 // GL texture to put pathtracing result into
@@ -47,73 +55,41 @@ GLuint simpleShaderProgram;
 uint32_t pathtracer_result_txt_id;
 
 ///////////////////////////////////////////////////////////////////////////////
-// Scene
+// Rasterized normals and depth at window resolution, to guide the upscaling
+// of the pathtraced image
 ///////////////////////////////////////////////////////////////////////////////
-vec3 worldUp(0.0f, 1.0f, 0.0f);
-
-struct camera_t
-{
-	vec3 position;
-	vec3 direction;
-};
+GLuint guide_framebuffer = 0;
+GLuint guide_txt_id = 0;
+GLuint guide_depth_rb = 0;
+int guide_width = 0, guide_height = 0;
 
-struct scene_t
-{
-	struct scene_object_t
-	{
-		labhelper::Model* model;
-		mat4 modelMat;
-	};
-	std::vector<scene_object_t> models;
+///////////////////////////////////////////////////////////////////////////////
+// Dynamic resolution
+///////////////////////////////////////////////////////////////////////////////
+pathtracer::ResolutionController resolution_controller;
+pathtracer::MotionQualityController motion_quality;
+float last_trace_ms = 0.0f;
 
-	camera_t camera;
-};
+///////////////////////////////////////////////////////////////////////////////
+// Scene
+///////////////////////////////////////////////////////////////////////////////
+vec3 worldUp(0.0f, 1.0f, 0.0f);
 
 std::map<std::string, scene_t> scenes;
 std::string currentScene;
 camera_t camera;
+float last_switch_ms = 0.0f;
+// Time to first pixel: from the start of changeScene() to the end of the
+// first pass traced after it
+std::chrono::high_resolution_clock::time_point switch_start;
+bool first_pixel_pending = false;
+float first_pixel_ms = 0.0f;
 
 int selected_model_index = 0;
 int selected_mesh_index = 0;
 int selected_material_index = 0;
 
 
-void loadScenes()
-{
-	scenes["Sphere"] = { {
-		                     // Models
-		                     { labhelper::loadModelFromOBJ("../scenes/sphere.obj"), mat4(1.f) },
-		                 },
-		                 {
-		                     // Camera
-		                     vec3(-15, 0, 15),
-		                     normalize(-vec3(-15, 0, 15)),
-		                 } };
-	scenes["Ship"] = { {
-		                   // Models
-		                   { labhelper::loadModelFromOBJ("../scenes/space-ship.obj"),
-		                     translate(vec3(0.f, 8.f, 0.f)) },
-		                   { labhelper::loadModelFromOBJ("../scenes/landingpad.obj"), mat4(1.f) },
-		               },
-		               {
-		                   // Camera
-		                   vec3(-30, 15, 30),
-		                   normalize(-vec3(-30, 8, 30)),
-		               } };
-	// Modify the landingpad screen's color
-	scenes["Ship"].models[1].model->m_materials[8].m_color = glm::vec3(0.380392, 0.588235, 0.266667);
-
-	scenes["Refractions"] = { {
-		                          // Models
-		                          { labhelper::loadModelFromOBJ("../scenes/refractions.obj"), mat4(1.f) },
-		                      },
-		                      {
-		                          // Camera
-		                          vec3(7.3, 3.2, 7.2),
-		                          normalize(vec3(-0.43, -0.27, -0.85)),
-		                      } };
-}
-
 void changeScene(std::string sceneName)
 {
 	currentScene = sceneName;
@@ -123,31 +99,19 @@ void changeScene(std::string sceneName)
 	selected_mesh_index = 0;
 	selected_material_index = scenes[currentScene].models[0].model->m_meshes[0].m_material_idx;
 
-
-	pathtracer::reinitScene();
-
-	// Add models to pathtracer scene
-	for(auto& o : scenes[currentScene].models)
-	{
-		pathtracer::addModel(o.model, o.modelMat);
-	}
-	pathtracer::buildBVH();
+	switch_start = std::chrono::high_resolution_clock::now();
+	first_pixel_pending = true;
+	const bool kept = scenes[currentScene].built != nullptr;
+	buildPathtracerScene(scenes[currentScene]);
+	last_switch_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now()
+	                                                          - switch_start)
+	                     .count();
+	cout << "Switched to " << sceneName << " in " << last_switch_ms << " ms"
+	     << (kept ? " (kept)" : " (built)") << "\n";
 
 	pathtracer::restart();
 }
 
-void cleanupScenes()
-{
-	for(auto& it : scenes)
-	{
-		for(auto m : it.second.models)
-		{
-			labhelper::freeModel(m.model);
-		}
-	}
-}
-
-
 ///////////////////////////////////////////////////////////////////////////////
 // Load shaders, environment maps, models and so on
 ///////////////////////////////////////////////////////////////////////////////
@@ -160,6 +124,10 @@ void initialize()
 	                                             "../pathtracer/copyTexture.frag");
 	simpleShaderProgram = labhelper::loadShaderProgram("../pathtracer/simple.vert",
 	                                                   "../pathtracer/simple.frag");
+	upscaleShaderProgram = labhelper::loadShaderProgram("../pathtracer/copyTexture.vert",
+	                                                    "../pathtracer/upscale.frag");
+	gbufferShaderProgram = labhelper::loadShaderProgram("../pathtracer/gbuffer.vert",
+	                                                    "../pathtracer/gbuffer.frag");
 
 	///////////////////////////////////////////////////////////////////////////
 	// Generate result texture
@@ -173,53 +141,16 @@ void initialize()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 	///////////////////////////////////////////////////////////////////////////
-	// Initial path-tracer settings
-	///////////////////////////////////////////////////////////////////////////
-	pathtracer::settings.max_bounces = 8;
-	pathtracer::settings.max_paths_per_pixel = 0; // 0 = Infinite
-#ifdef _DEBUG
-	pathtracer::settings.subsampling = 16;
-#else
-	pathtracer::settings.subsampling = 4;
-#endif
-
-	///////////////////////////////////////////////////////////////////////////
-	// Set up light sources
-	///////////////////////////////////////////////////////////////////////////
-	pathtracer::point_light.intensity_multiplier = 2500.0f;
-	pathtracer::point_light.color = vec3(1.f, 1.f, 1.f);
-	pathtracer::point_light.position = vec3(10.0f, 25.0f, 20.0f);
-
-	// float intensity_multiplier;
-	// vec3 color;
-	// vec3 position;
-	// vec3 direction;
-	// float radius;
-	/*
-	pathtracer::disc_lights.push_back( pathtracer::DiscLight{
-									   1000,
-									   {1, 0.8, 0},
-									   {-8, 10, 8},
-									   glm::normalize(glm::vec3(10, -2, 10)),
-									   8.0 } );
-	pathtracer::disc_lights.push_back( pathtracer::DiscLight{
-									   1000,
-									   {0.1, 0.3, 1},
-									   {-10, 20, -5},
-									   glm::normalize(-glm::vec3(-10, 20, -5)),
-									   10.0 } );
-	*/
-
-	///////////////////////////////////////////////////////////////////////////
-	// Load environment map
+	// Initial path-tracer settings, light sources and environment map
 	///////////////////////////////////////////////////////////////////////////
-	pathtracer::environment.map.load("../scenes/envmaps/001.hdr");
-	pathtracer::environment.multiplier = 1.0f;
+	initPathtracerDefaults();
+	// Start tracing right away on a quickly built BVH
+	pathtracer::settings.preview_bvh = true;
 
 	///////////////////////////////////////////////////////////////////////////
 	// Load .obj models to scene
 	///////////////////////////////////////////////////////////////////////////
-	loadScenes();
+	loadScenes(scenes);
 	//changeScene("Ship");
 	changeScene("Sphere");
 	//changeScene("Refractions");
@@ -232,20 +163,90 @@ void initialize()
 	//glEnable(GL_FRAMEBUFFER_SRGB);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Render the normals and depth of the scene into the guide texture
+///////////////////////////////////////////////////////////////////////////////
+void drawGuide(const mat4& viewMatrix, const mat4& projMatrix)
+{
+	if(guide_framebuffer == 0)
+	{
+		glGenFramebuffers(1, &guide_framebuffer);
+		glGenTextures(1, &guide_txt_id);
+		glGenRenderbuffers(1, &guide_depth_rb);
+	}
+	if(guide_width != windowWidth || guide_height != windowHeight)
+	{
+		guide_width = windowWidth;
+		guide_height = windowHeight;
+		glBindTexture(GL_TEXTURE_2D, guide_txt_id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, guide_width, guide_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindRenderbuffer(GL_RENDERBUFFER, guide_depth_rb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32, guide_width, guide_height);
+		glBindFramebuffer(GL_FRAMEBUFFER, guide_framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, guide_txt_id, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, guide_depth_rb);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, guide_framebuffer);
+	glViewport(0, 0, guide_width, guide_height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	// The pathtracer sees back faces too
+	glDisable(GL_CULL_FACE);
+	glUseProgram(gbufferShaderProgram);
+	for(const auto& object : scenes[currentScene].models)
+	{
+		mat4 modelViewMatrix = viewMatrix * object.modelMat;
+		labhelper::setUniformSlow(gbufferShaderProgram, "modelViewMatrix", modelViewMatrix);
+		labhelper::setUniformSlow(gbufferShaderProgram, "modelViewProjectionMatrix", projMatrix * modelViewMatrix);
+		labhelper::setUniformSlow(gbufferShaderProgram, "normalMatrix", inverse(transpose(modelViewMatrix)));
+		labhelper::render(object.model, false);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 void display(void)
 {
+	///////////////////////////////////////////////////////////////////////////
+	// While the camera moves, trace fewer bounces at a coarser resolution.
+	// The full settings are restored after tracing.
+	///////////////////////////////////////////////////////////////////////////
+	const pathtracer::Settings full_settings = pathtracer::settings;
+	const bool was_moving = motion_quality.moving();
+	const bool moving = motion_quality.update(camera.position, camera.direction, deltaTime * 1000.0f);
+	if(moving != was_moving)
+	{
+		// Don't mix samples of the two quality levels
+		pathtracer::restart();
+	}
+	if(moving)
+	{
+		pathtracer::settings.max_bounces = std::min(full_settings.max_bounces, full_settings.motion_max_bounces);
+		pathtracer::settings.subsampling =
+		    std::min(16.0f, full_settings.subsampling * full_settings.motion_subsampling);
+		// The radiance cache would learn the radiance of the shortened paths
+		pathtracer::settings.radiance_cache = false;
+		// One path per pixel gives the quickest frame
+		pathtracer::settings.split_paths = 1;
+	}
+
 	{ ///////////////////////////////////////////////////////////////////////
 		// If first frame, or window resized, or subsampling changes,
 		// inform the pathtracer
 		///////////////////////////////////////////////////////////////////////
 		int w, h;
 		SDL_GetWindowSize(g_window, &w, &h);
-		static int old_subsampling;
+		static float old_subsampling;
 		if(windowWidth != w || windowHeight != h || old_subsampling != pathtracer::settings.subsampling)
 		{
 			pathtracer::resize(w, h);
 			windowWidth = w;
-			windowWidth = h;
+			windowHeight = h;
 			old_subsampling = pathtracer::settings.subsampling;
 		}
 	}
@@ -258,7 +259,28 @@ void display(void)
 	                              float(pathtracer::rendered_image.width)
 	                                  / float(pathtracer::rendered_image.height),
 	                              0.1f, 100.0f);
+	const int samples_before = pathtracer::rendered_image.number_of_samples;
+	auto trace_start = std::chrono::high_resolution_clock::now();
 	pathtracer::tracePaths(viewMatrix, projMatrix);
+	pathtracer::settings = full_settings;
+	if(first_pixel_pending && pathtracer::rendered_image.number_of_samples != samples_before)
+	{
+		first_pixel_pending = false;
+		first_pixel_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now()
+		                                                          - switch_start)
+		                     .count();
+		cout << "First pixels of " << currentScene << " after " << first_pixel_ms << " ms\n";
+	}
+	// The resolution controller only learns from full-quality frames
+	if(!moving && pathtracer::rendered_image.number_of_samples != samples_before)
+	{
+		last_trace_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now()
+		                                                         - trace_start)
+		                    .count();
+		resolution_controller.frameTraced(last_trace_ms,
+		                                  pathtracer::rendered_image.width * pathtracer::rendered_image.height,
+		                                  samples_before == 0, windowWidth, windowHeight);
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// Copy pathtraced image to texture for display
@@ -268,6 +290,14 @@ void display(void)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, pathtracer::rendered_image.width,
 	             pathtracer::rendered_image.height, 0, GL_RGB, GL_FLOAT, pathtracer::rendered_image.getPtr());
 
+	const bool upscale = pathtracer::settings.edge_aware_upscaling
+	                     && (pathtracer::rendered_image.width != windowWidth
+	                         || pathtracer::rendered_image.height != windowHeight);
+	if(upscale)
+	{
+		drawGuide(viewMatrix, projMatrix);
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	// Render a fullscreen quad, textured with our pathtraced image.
 	///////////////////////////////////////////////////////////////////////////
@@ -277,7 +307,17 @@ void display(void)
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 	SDL_GetWindowSize(g_window, &windowWidth, &windowHeight);
-	glUseProgram(shaderProgram);
+	if(upscale)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, guide_txt_id);
+		glActiveTexture(GL_TEXTURE0);
+		glUseProgram(upscaleShaderProgram);
+	}
+	else
+	{
+		glUseProgram(shaderProgram);
+	}
 	labhelper::drawFullScreenQuad();
 
 	if(showLightSources)
@@ -473,14 +513,134 @@ void gui()
 	///////////////////////////////////////////////////////////////////////////
 	if(ImGui::CollapsingHeader("Pathtracer", "pathtracer_ch", true, true))
 	{
-		ImGui::SliderInt("Subsampling", &pathtracer::settings.subsampling, 1, 16);
+		ImGui::Checkbox("Dynamic resolution", &pathtracer::settings.dynamic_resolution);
+		if(pathtracer::settings.dynamic_resolution)
+		{
+			ImGui::SliderFloat("Target frame time (ms)", &pathtracer::settings.target_frame_ms, 5.0f, 200.0f);
+			ImGui::Text("Subsampling: %.2f (%dx%d), %.0f ns/path", pathtracer::settings.subsampling,
+			            pathtracer::rendered_image.width, pathtracer::rendered_image.height,
+			            resolution_controller.nanosecondsPerPath());
+		}
+		else
+		{
+			ImGui::SliderFloat("Subsampling", &pathtracer::settings.subsampling, 1.0f, 16.0f);
+		}
+		ImGui::Checkbox("Edge-aware upscaling", &pathtracer::settings.edge_aware_upscaling);
+		ImGui::Checkbox("Reduce quality while moving", &pathtracer::settings.motion_adaptive);
+		if(pathtracer::settings.motion_adaptive)
+		{
+			ImGui::SliderInt("Bounces while moving", &pathtracer::settings.motion_max_bounces, 0, 16);
+			ImGui::SliderFloat("Extra subsampling while moving", &pathtracer::settings.motion_subsampling, 1.0f, 4.0f);
+			ImGui::SliderFloat("Settle time (ms)", &pathtracer::settings.settle_ms, 0.0f, 1000.0f);
+			ImGui::Text("Quality: %s", motion_quality.moving() ? "moving" : "full");
+		}
+		ImGui::Text("Trace time: %.1f ms", last_trace_ms);
+		int integrator = pathtracer::settings.integrator;
+		if(ImGui::Combo("Integrator", &integrator, "Path tracing\0Bidirectional\0Photon mapping\0"))
+		{
+			pathtracer::settings.integrator = pathtracer::Integrator(integrator);
+			pathtracer::restart();
+		}
+		if(pathtracer::settings.integrator == pathtracer::PathTracing)
+		{
+			ImGui::Checkbox("Path guiding", &pathtracer::settings.path_guiding);
+			if(pathtracer::settings.path_guiding)
+			{
+				pathtracer::GuidingReport guiding = pathtracer::getGuidingReport();
+				ImGui::Text("Guiding: %d iterations, %d regions, %d cells%s", guiding.iteration, guiding.regions,
+				            guiding.directional, guiding.building ? " (building)" : guiding.training ? "" : " (done)");
+				if(ImGui::Button("Reset Guiding"))
+				{
+					pathtracer::resetGuiding();
+				}
+			}
+			if(ImGui::Checkbox("Radiance cache", &pathtracer::settings.radiance_cache))
+			{
+				pathtracer::restart();
+			}
+			if(pathtracer::settings.radiance_cache)
+			{
+				if(ImGui::SliderInt("Cache from bounce", &pathtracer::settings.radiance_cache_bounces, 0, 16))
+				{
+					pathtracer::restart();
+				}
+				pathtracer::RadianceCacheReport cache = pathtracer::getRadianceCacheReport();
+				ImGui::Text("Cache: %d of %d cells, %d evicted", cache.cells, cache.capacity, cache.evicted);
+				if(ImGui::Button("Clear Cache"))
+				{
+					pathtracer::clearRadianceCache();
+				}
+			}
+			ImGui::Checkbox("Specialize Li() for the scene", &pathtracer::settings.specialize_li);
+			ImGui::Checkbox("Russian roulette", &pathtracer::settings.russian_roulette);
+			if(pathtracer::settings.russian_roulette)
+			{
+				ImGui::SliderInt("Roulette from bounce", &pathtracer::settings.roulette_depth, 0, 16);
+			}
+			ImGui::SliderInt("Paths per camera ray", &pathtracer::settings.split_paths, 1, 16);
+			if(ImGui::Checkbox("Reuse camera ray hits", &pathtracer::settings.primary_hit_cache))
+			{
+				pathtracer::restart();
+			}
+			if(pathtracer::settings.primary_hit_cache)
+			{
+				if(ImGui::SliderInt("Strata per pixel side", &pathtracer::settings.primary_strata, 1, 4))
+				{
+					pathtracer::restart();
+				}
+			}
+		}
 		ImGui::SliderInt("Max Bounces", &pathtracer::settings.max_bounces, 0, 16);
 		ImGui::SliderInt("Max Paths Per Pixel", &pathtracer::settings.max_paths_per_pixel, 0, 1024);
+		int scene_cache_mb = int(getSceneCacheBudget() >> 20);
+		if(ImGui::SliderInt("Scene cache budget (MB)", &scene_cache_mb, 0, 8192))
+		{
+			setSceneCacheBudget(size_t(scene_cache_mb) << 20);
+		}
+		ImGui::Text("Scene cache: %d MB, last switch %.1f ms", int(getSceneCacheSize() >> 20),
+		            last_switch_ms);
+		ImGui::Checkbox("Preview BVH while building", &pathtracer::settings.preview_bvh);
+		pathtracer::BVHReport bvh = pathtracer::getBVHReport();
+		if(bvh.preview)
+			ImGui::Text("BVH: preview (%.0f ms), high quality %s", bvh.build_ms,
+			            bvh.building ? "building" : "ready");
+		else
+			ImGui::Text("BVH: high quality (%.0f ms)",
+			            bvh.final_build_ms > 0.0f ? bvh.final_build_ms : bvh.build_ms);
+		ImGui::Text("Time to first pixel: %.1f ms", first_pixel_ms);
 		if(ImGui::Button("Restart Pathtracing"))
 		{
 			pathtracer::restart();
 		}
 		ImGui::Text("Num. samples: %d", pathtracer::getSampleCount());
+
+		// Counters of the last frame (one tracePaths call)
+		const pathtracer::stats::Counters& c = pathtracer::stats::frame;
+		ImGui::Text("Rays: %llu camera, %llu extension, %llu shadow", (unsigned long long)c.camera_rays,
+		            (unsigned long long)c.extension_rays, (unsigned long long)c.shadow_rays);
+		ImGui::Text("Occluded shadow rays: %.1f%%",
+		            c.shadow_rays ? 100.0 * double(c.occluded_hits) / double(c.shadow_rays) : 0.0);
+		ImGui::Text("Terminated by pdf < EPSILON: %llu", (unsigned long long)c.pdf_terminations);
+		if(pathtracer::settings.radiance_cache)
+			ImGui::Text("Ended at the radiance cache: %llu", (unsigned long long)c.cache_terminations);
+		if(pathtracer::settings.russian_roulette)
+			ImGui::Text("Ended by Russian roulette: %llu", (unsigned long long)c.roulette_terminations);
+		if(pathtracer::settings.primary_hit_cache)
+			ImGui::Text("Camera ray hits reused: %llu", (unsigned long long)c.reused_camera_rays);
+		double cycles = double(c.cycles[pathtracer::stats::Traversal] + c.cycles[pathtracer::stats::Shading]
+		                       + c.cycles[pathtracer::stats::Environment]);
+		if(cycles > 0.0)
+		{
+			ImGui::Text("Cycles: traversal %.0f%%, shading %.0f%%, environment %.0f%%",
+			            100.0 * c.cycles[pathtracer::stats::Traversal] / cycles,
+			            100.0 * c.cycles[pathtracer::stats::Shading] / cycles,
+			            100.0 * c.cycles[pathtracer::stats::Environment] / cycles);
+		}
+		float depth[pathtracer::stats::MAX_DEPTH + 1];
+		for(int i = 0; i <= pathtracer::stats::MAX_DEPTH; i++)
+			depth[i] = float(c.depth[i]);
+		ImGui::PlotHistogram("Path depth", depth, pathtracer::stats::MAX_DEPTH + 1, 0, nullptr, 0.0f, FLT_MAX,
+		                     ImVec2(0, 60));
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -488,6 +648,9 @@ void gui()
 	///////////////////////////////////////////////////////////////////////////
 	labhelper::Model* selected_model = scenes[currentScene].models[selected_model_index].model;
 	scene_t* selected_scene = &scenes[currentScene];
+	// Edits to materials and lights restart the image, and forget what was
+	// learned about the lighting
+	bool lighting_changed = false;
 
 	if(ImGui::CollapsingHeader("Models", "meshes_ch", true, true))
 	{
@@ -522,12 +685,13 @@ void gui()
 		{
 			labhelper::Material& material = selected_model->m_materials[selected_material_index];
 			ImGui::LabelText("Material Name", "%s", material.m_name.c_str());
-			ImGui::ColorEdit3("Color", &material.m_color.x);
-			ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
-			ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
-			ImGui::SliderFloat("Shininess", &material.m_shininess, 0.0f, 5000.0f, "%.3f", 2);
-			ImGui::ColorEdit3("Emission", &material.m_emission.x);
-			ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
+			lighting_changed |= ImGui::ColorEdit3("Color", &material.m_color.x);
+			lighting_changed |= ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
+			lighting_changed |= ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
+			lighting_changed |=
+			        ImGui::SliderFloat("Shininess", &material.m_shininess, 0.0f, 5000.0f, "%.3f", 2);
+			lighting_changed |= ImGui::ColorEdit3("Emission", &material.m_emission.x);
+			lighting_changed |= ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
 			//ImGui::SliderFloat("IoR", &material.m_ior, 0.1f, 3.0f);
 		}
 
@@ -547,13 +711,14 @@ void gui()
 	if(ImGui::CollapsingHeader("Light sources", "lights_ch", true, true))
 	{
 		ImGui::Checkbox("Show Light Overlays", &showLightSources);
-		ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier, 0.0f, 10.0f);
+		lighting_changed |= ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier,
+		                                       0.0f, 10.0f);
 		ImGui::Separator();
 		ImGui::Text("Point Light");
-		ImGui::ColorEdit3("Point light color", &pathtracer::point_light.color.x);
-		ImGui::SliderFloat("Point light intensity multiplier", &pathtracer::point_light.intensity_multiplier,
-		                   0.0f, 10000.0f);
-		ImGui::DragFloat3("Position", &pathtracer::point_light.position.x, 0.1);
+		lighting_changed |= ImGui::ColorEdit3("Point light color", &pathtracer::point_light.color.x);
+		lighting_changed |= ImGui::SliderFloat("Point light intensity multiplier",
+		                                       &pathtracer::point_light.intensity_multiplier, 0.0f, 10000.0f);
+		lighting_changed |= ImGui::DragFloat3("Position", &pathtracer::point_light.position.x, 0.1);
 
 		for(int i = 0; i < pathtracer::disc_lights.size(); ++i)
 		{
@@ -561,21 +726,29 @@ void gui()
 			ImGui::Separator();
 			auto& l = pathtracer::disc_lights[i];
 			ImGui::Text("Disc Light %d", i);
-			ImGui::ColorEdit3("Color", &l.color.x);
-			ImGui::SliderFloat("Intensity", &l.intensity_multiplier, 0.0f, 10000.0f, "%.3f", 3);
-			ImGui::DragFloat3("Position", &l.position.x, 0.1);
+			lighting_changed |= ImGui::ColorEdit3("Color", &l.color.x);
+			lighting_changed |=
+			        ImGui::SliderFloat("Intensity", &l.intensity_multiplier, 0.0f, 10000.0f, "%.3f", 3);
+			lighting_changed |= ImGui::DragFloat3("Position", &l.position.x, 0.1);
 
 			glm::vec2 dir(atan2(l.direction.z, l.direction.x) / (2 * M_PI) + 0.5, acos(l.direction.y) / M_PI);
-			ImGui::DragFloat2("Direction", &dir.x, 0.01, 0, 1);
-			dir.x -= 0.5;
-			dir.x *= 2 * M_PI;
-			dir.y *= M_PI;
-			l.direction = vec3(cos(dir.x) * sin(dir.y), cos(dir.y), sin(dir.x) * sin(dir.y));
+			if(ImGui::DragFloat2("Direction", &dir.x, 0.01, 0, 1))
+			{
+				dir.x -= 0.5;
+				dir.x *= 2 * M_PI;
+				dir.y *= M_PI;
+				l.direction = vec3(cos(dir.x) * sin(dir.y), cos(dir.y), sin(dir.x) * sin(dir.y));
+				lighting_changed = true;
+			}
 
-			ImGui::DragFloat("Radius", &l.radius, 1, 0, 100);
+			lighting_changed |= ImGui::DragFloat("Radius", &l.radius, 1, 0, 100);
 			ImGui::PopID();
 		}
 	}
+	if(lighting_changed)
+	{
+		pathtracer::restart(pathtracer::LightingChanged);
+	}
 
 	ImGui::End(); // Control Panel
 }
@@ -619,7 +792,7 @@ int main(int argc, char* argv[])
 	}
 
 	// Delete Models
-	cleanupScenes();
+	cleanupScenes(scenes);
 
 	// Shut down everything. This includes the window and all other subsystems.
 	labhelper::shutDown(g_window);
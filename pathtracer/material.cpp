@@ -1,6 +1,7 @@
 #include "material.h"
 #include "sampling.h"
 #include "labhelper.h"
+#include "fastmath.h"
 
 using namespace labhelper;
 
@@ -36,15 +37,23 @@ WiSample Diffuse::sample_wi(const vec3& wo, const vec3& n) const
 	return r;
 }
 
+float Diffuse::pdf(const vec3& wi, const vec3& /*wo*/, const vec3& n) const
+{
+	return max(0.0f, dot(wi, n)) / M_PI;
+}
+
 vec3 MicrofacetBRDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
+	// Reflection only, as in Diffuse::f
+	if(dot(wi, n) <= 0.0f || dot(wo, n) <= 0.0f)
+		return vec3(0.0f);
 	vec3 wh = normalize(wi + wo);
 	float wodotwh = max(dot(wo, wh), 0.001f);//ensure not division 0
 	//Calculate the microfacet distribution function
 	float ndotwh = max(dot(n, wh), 0.001f);
 	float ndotwi = max(dot(n, wi), 0.001f);	
 	float ndotwo = max(dot(n, wo), 0.001f);
-	float D = ((shininess + 2.0f) / (2.0f * M_PI)) * pow(ndotwh, shininess);
+	float D = ((shininess + 2.0f) / (2.0f * M_PI)) * fast_pow(ndotwh, shininess);
 	//Calculate the shadowing function
 
 	float G = min(1.0f, min(2.0f * ndotwh * ndotwo / wodotwh, 2.0f * ndotwh * ndotwi / wodotwh));
@@ -56,32 +65,62 @@ vec3 MicrofacetBRDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 
 WiSample MicrofacetBRDF::sample_wi(const vec3& wo, const vec3& n) const
 {
-	//WiSample r = sampleHemisphereCosine(wo, n);
-	//r.f = f(r.wi, wo, n);
+	// Sample the normals visible from wo. f() masks with V-cavities (the
+	// min() in G), for which that is exact (Heitz and d'Eon 2014): draw wh
+	// with density D(wh) n.wh, and replace it by the other facet of its
+	// V-cavity, wh' = (-x, -y, z), in proportion to the area of each that
+	// wo sees.
 	WiSample r;
+	if(dot(wo, n) <= 0.0f)
+		return r;
 	vec3 tangent = normalize(perpendicular(n));
 	vec3 bitangent = normalize(cross(tangent, n));
 	float phi = 2.0f * M_PI * randf();
-	float cos_theta = pow(randf(), 1.0f / (shininess + 1));
+	float cos_theta = fast_pow(randf(), 1.0f / (shininess + 2));
 	float sin_theta = sqrt(max(0.0f, 1.0f - cos_theta * cos_theta));
-	vec3 wh = normalize(sin_theta * cos(phi) * tangent + sin_theta * sin(phi) * bitangent + cos_theta * n);
+	float sin_phi, cos_phi;
+	fast_sincos(phi, sin_phi, cos_phi);
+	vec3 side = sin_theta * cos_phi * tangent + sin_theta * sin_phi * bitangent;
+	vec3 wh = normalize(side + cos_theta * n);
+	vec3 wh_other = normalize(cos_theta * n - side);
+	float seen = max(0.0f, dot(wo, wh));
+	float seen_other = max(0.0f, dot(wo, wh_other));
+	if(randf() * (seen + seen_other) < seen_other)
+		wh = wh_other;
 
-	float ndotwh = abs(dot(n, wh));
-	float wodotwh = abs(dot(wo, wh));
-	float pwh = (shininess + 1.0f) * pow(ndotwh, shininess) / (2 * M_PI);
-	float pwi = pwh / (4 * wodotwh);
-	r.pdf = pwi;
 	r.wi = normalize(2 * dot(wh, wo) * wh - wo);
+	r.pdf = pdf(r.wi, wo, n);
 	r.f = f(r.wi, wo, n);
 	return r;
 }
 
+float MicrofacetBRDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	// The visible normals have density G1(wo, wh) wo.wh D(wh) / n.wo, and
+	// reflecting wo about wh divides by 4 wo.wh. For the wi sample_wi()
+	// returns, wi + wo is a positive multiple of wh.
+	float ndotwo = dot(n, wo);
+	vec3 h = wi + wo;
+	if(ndotwo <= 0.0f || dot(h, h) < 1e-12f)
+		return 0.0f;
+	vec3 wh = normalize(h);
+	float ndotwh = dot(n, wh);
+	float wodotwh = dot(wo, wh);
+	if(ndotwh <= 0.0f || wodotwh <= 0.0f)
+		return 0.0f;
+	float D = ((shininess + 2.0f) / (2.0f * M_PI)) * fast_pow(ndotwh, shininess);
+	float G1 = min(1.0f, 2.0f * ndotwh * ndotwo / wodotwh);
+	return D * G1 / (4.0f * ndotwo);
+}
+
 
 float BSDF::fresnel(const vec3& wi, const vec3& wo) const
 {
 	vec3 wh = normalize(wi + wo);
 	float whdotwi = max(0.001f, dot(wh, wi));
-	float F = R0 + (1 - R0) * pow((1 - whdotwi), 5.0);
+	float c = 1 - whdotwi;
+	float c2 = c * c;
+	float F = R0 + (1 - R0) * c2 * c2 * c;
 	return F;
 }
 
@@ -95,29 +134,33 @@ vec3 DielectricBSDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 	return bsdf;
 }
 
-WiSample DielectricBSDF::sample_wi(const vec3& wo, const vec3& n) const
+// Probability of sampling the reflective lobe: the Fresnel term at wo,
+// the share of the light that the reflective lobe gets. Kept away from 0
+// and 1 so that neither lobe is starved where the estimate is off.
+static float reflectProbability(float R0, const vec3& wo, const vec3& n)
 {
-	WiSample r;
-	if (randf() < 0.5) {
-		//Sample the BRDF
-		r = reflective_material->sample_wi(wo, n);
-		r.pdf *= 0.5;
-		float F = BSDF::fresnel(r.wi, wo);
-		r.f = r.f * F;
-	}
-	else {
-		//Sample the BSDF
-		r = transmissive_material->sample_wi(wo, n);
-		r.pdf *= 0.5;
-		float F = BSDF::fresnel(r.wi, wo);
-		r.f = r.f * (1 - F);
-	}
-	//r = sampleHemisphereCosine(wo, n);
-	//r.f = f(r.wi, wo, n);
+	float c = 1.0f - clamp(dot(wo, n), 0.0f, 1.0f);
+	float c2 = c * c;
+	return clamp(R0 + (1.0f - R0) * c2 * c2 * c, 0.05f, 0.95f);
+}
 
+WiSample DielectricBSDF::sample_wi(const vec3& wo, const vec3& n) const
+{
+	float p = reflectProbability(R0, wo, n);
+	WiSample r = randf() < p ? reflective_material->sample_wi(wo, n) : transmissive_material->sample_wi(wo, n);
+	if(r.pdf <= 0.0f)
+		return r;
+	r.f = f(r.wi, wo, n);
+	r.pdf = pdf(r.wi, wo, n);
 	return r;
 }
 
+float DielectricBSDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	float p = reflectProbability(R0, wo, n);
+	return p * reflective_material->pdf(wi, wo, n) + (1.0f - p) * transmissive_material->pdf(wi, wo, n);
+}
+
 vec3 MetalBSDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
 	float f = BSDF::fresnel(wi, wo);
@@ -128,15 +171,16 @@ vec3 MetalBSDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 
 WiSample MetalBSDF::sample_wi(const vec3& wo, const vec3& n) const
 {
-	WiSample r;
-	//r = sampleHemisphereCosine(wo, n);
-	//r.f = f(r.wi, wo, n);
-	r = reflective_material->sample_wi(wo,n);
-	float F = BSDF::fresnel(r.wi, n);
-	r.f = r.f * F * color;
+	WiSample r = reflective_material->sample_wi(wo, n);
+	r.f = r.f * BSDF::fresnel(r.wi, wo) * color;
 	return r;
 }
 
+float MetalBSDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return reflective_material->pdf(wi, wo, n);
+}
+
 
 vec3 BSDFLinearBlend::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
@@ -148,18 +192,19 @@ vec3 BSDFLinearBlend::f(const vec3& wi, const vec3& wo, const vec3& n) const
 
 WiSample BSDFLinearBlend::sample_wi(const vec3& wo, const vec3& n) const
 {
-	WiSample r;
-	if (randf() < w) {
-		r = bsdf0->sample_wi(wo, n);
-		float F = BSDF::fresnel(r.wi, wo);
-	}
-	else {
-		r = bsdf1->sample_wi(wo, n);
-		float F = BSDF::fresnel(r.wi, wo);
-	}
+	WiSample r = randf() < w ? bsdf0->sample_wi(wo, n) : bsdf1->sample_wi(wo, n);
+	if(r.pdf <= 0.0f)
+		return r;
+	r.f = f(r.wi, wo, n);
+	r.pdf = pdf(r.wi, wo, n);
 	return r;
 }
 
+float BSDFLinearBlend::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return w * bsdf0->pdf(wi, wo, n) + (1.0f - w) * bsdf1->pdf(wi, wo, n);
+}
+
 
 #if SOLUTION_PROJECT == PROJECT_REFRACTIONS
 ///////////////////////////////////////////////////////////////////////////
@@ -175,10 +220,13 @@ vec3 GlassBTDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 
 	// consine the angle of incidence
 	float cosThetaI = std::abs(dot(normal, wo));
-	float F0 = pow((etaI - etaT) / (etaI + etaT), 2);
+	float r = (etaI - etaT) / (etaI + etaT);
+	float F0 = r * r;
 
 	//calculate fresnel
-	float fresnel = F0 + (1.0f - F0) * pow(1.0f - cosThetaI, 5);
+	float c = 1.0f - cosThetaI;
+	float c2 = c * c;
+	float fresnel = F0 + (1.0f - F0) * c2 * c2 * c;
 
 	//If wi and wo are in different hemispheres
 	if (!sameHemisphere(wi, wo, n))
@@ -235,6 +283,11 @@ WiSample GlassBTDF::sample_wi(const vec3& wo, const vec3& n) const
 	return r;
 }
 
+float GlassBTDF::pdf(const vec3& /*wi*/, const vec3& /*wo*/, const vec3& /*n*/) const
+{
+	return 0.0f;
+}
+
 vec3 BTDFLinearBlend::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
 	return w * btdf0->f(wi, wo, n) + (1.0f - w) * btdf1->f(wi, wo, n);
@@ -254,5 +307,10 @@ WiSample BTDFLinearBlend::sample_wi(const vec3& wo, const vec3& n) const
 	}
 }
 
+float BTDFLinearBlend::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return w * btdf0->pdf(wi, wo, n) + (1.0f - w) * btdf1->pdf(wi, wo, n);
+}
+
 #endif
 } // namespace pathtracer
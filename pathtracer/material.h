@@ -25,6 +25,9 @@ public:
 	// Sample a suitable direction and return the brdf in that direction as
 	// well as the pdf (~probability) that the direction was chosen.
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const = 0;
+	// The pdf with which sample_wi() picks wi, for combining with other
+	// sampling strategies (MIS)
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -39,6 +42,10 @@ public:
 	// Sample a suitable direction and return the btdf in that direction as
 	// well as the pdf (~probability) that the direction was chosen.
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const = 0;
+
+	// The pdf with which sample_wi() picks wi. Zero for delta
+	// distributions (perfect refraction), which no other strategy can hit.
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
 };
 
 
@@ -59,9 +66,14 @@ public:
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
 
 	// Sample a suitable direction and return the bsdf in that direction as
-	// well as the pdf (~probability) that the direction was chosen.
+	// well as the pdf (~probability) that the direction was chosen. The
+	// lobes of a BSDF are combined with one-sample MIS: f is the whole bsdf
+	// and pdf the mixture of the lobe pdfs, not those of the lobe picked.
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const = 0;
 
+	// The pdf with which sample_wi() picks wi
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
+
 	// Calculate the fresnel term
 	float fresnel(const vec3& wi, const vec3& wo) const;
 };
@@ -79,6 +91,7 @@ public:
 	}
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 
@@ -94,11 +107,14 @@ public:
 	}
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////
-/// A Dielectric BSFD
+/// A Dielectric BSFD. sample_wi() reflects with the probability of the
+/// Fresnel term at wo, so that little is spent on the reflective lobe where
+/// it contributes little. Both materials must be non-delta.
 ///////////////////////////////////////////////////////////////////////////
 class DielectricBSDF : public BSDF
 {
@@ -113,6 +129,7 @@ public:
 
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -131,6 +148,7 @@ public:
 
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 
@@ -155,6 +173,7 @@ public:
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 #if SOLUTION_PROJECT == PROJECT_REFRACTIONS
@@ -172,6 +191,7 @@ public:
 
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 class BTDFLinearBlend : public BTDF
@@ -188,6 +208,7 @@ public:
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 #endif
 
@@ -0,0 +1,36 @@
+#include "pfm.h"
+#include <cstdio>
+
+using namespace std;
+using namespace glm;
+
+bool writePFM(const string& filename, int width, int height, const vec3* data)
+{
+	FILE* f = fopen(filename.c_str(), "wb");
+	if(!f)
+		return false;
+	fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+	const size_t size = size_t(width) * height;
+	size_t written = fwrite(&data[0].x, sizeof(float) * 3, size, f);
+	fclose(f);
+	return written == size;
+}
+
+bool readPFM(const string& filename, int width, int height, vector<vec3>& data)
+{
+	FILE* f = fopen(filename.c_str(), "rb");
+	if(!f)
+		return false;
+	char magic[3] = {};
+	int w = 0, h = 0;
+	float scale = 0.0f;
+	bool ok = fscanf(f, "%2s %d %d %f", magic, &w, &h, &scale) == 4 && string(magic) == "PF"
+	          && w == width && h == height && scale < 0.0f && fgetc(f) == '\n';
+	if(ok)
+	{
+		data.resize(size_t(w) * h);
+		ok = fread(&data[0].x, sizeof(float) * 3, data.size(), f) == data.size();
+	}
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+///////////////////////////////////////////////////////////////////////////
+// Portable float map (PFM) images: full float precision and trivial to
+// read. Rows are bottom to top, as in pathtracer::rendered_image.
+///////////////////////////////////////////////////////////////////////////
+bool writePFM(const std::string& filename, int width, int height, const glm::vec3* data);
+
+// Fails unless the file is a width x height RGB PFM
+bool readPFM(const std::string& filename, int width, int height, std::vector<glm::vec3>& data);
@@ -0,0 +1,182 @@
+#include "primitives.h"
+#include <algorithm>
+#include <cmath>
+#include <labhelper.h>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+Primitive makeSphere(const vec3& center, float radius, const labhelper::Material* material)
+{
+	Primitive p = {};
+	p.type = SpherePrimitive;
+	p.position = center;
+	p.radius = radius;
+	p.material = material;
+	return p;
+}
+
+Primitive makeDisc(const vec3& center, const vec3& normal, float radius, const labhelper::Material* material)
+{
+	Primitive p = {};
+	p.type = DiscPrimitive;
+	p.position = center;
+	p.normal = normalize(normal);
+	p.radius = radius;
+	p.material = material;
+	return p;
+}
+
+Primitive makeQuad(const vec3& corner, const vec3& edge0, const vec3& edge1,
+                   const labhelper::Material* material)
+{
+	Primitive p = {};
+	p.type = QuadPrimitive;
+	p.position = corner;
+	p.edge0 = edge0;
+	p.edge1 = edge1;
+	p.normal = normalize(cross(edge0, edge1));
+	p.material = material;
+	return p;
+}
+
+float primitiveArea(const Primitive& p)
+{
+	switch(p.type)
+	{
+	case SpherePrimitive:
+		return 4.0f * M_PI * p.radius * p.radius;
+	case DiscPrimitive:
+		return M_PI * p.radius * p.radius;
+	default:
+		return length(cross(p.edge0, p.edge1));
+	}
+}
+
+void primitiveBounds(const Primitive& p, vec3& lo, vec3& hi)
+{
+	switch(p.type)
+	{
+	case SpherePrimitive:
+		lo = p.position - vec3(p.radius);
+		hi = p.position + vec3(p.radius);
+		break;
+	case DiscPrimitive:
+	{
+		// Along each axis the disc reaches radius * sin(angle to the normal)
+		const vec3 extent = p.radius * sqrt(max(vec3(0.0f), vec3(1.0f) - p.normal * p.normal));
+		lo = p.position - extent;
+		hi = p.position + extent;
+		break;
+	}
+	default:
+	{
+		const vec3 c1 = p.position + p.edge0, c2 = p.position + p.edge1, c3 = c1 + p.edge1;
+		lo = min(min(p.position, c1), min(c2, c3));
+		hi = max(max(p.position, c1), max(c2, c3));
+		break;
+	}
+	}
+}
+
+static bool intersectSphere(const Primitive& p, const vec3& o, const vec3& d, float tnear, float tfar,
+                            float& t, vec2& uv)
+{
+	// Solve a t^2 + 2 b t + c = 0. The discriminant is computed from the
+	// distance between the center and the line, which keeps its precision
+	// when the ray starts far from a small sphere (Haines et al. 2019).
+	const vec3 oc = o - p.position;
+	const float a = dot(d, d);
+	const float b = dot(oc, d);
+	const vec3 f = oc - (b / a) * d;
+	const float discriminant = a * (p.radius * p.radius - dot(f, f));
+	if(discriminant < 0.0f)
+	{
+		return false;
+	}
+	const float c = dot(oc, oc) - p.radius * p.radius;
+	const float q = -b - copysign(sqrt(discriminant), b);
+	float t0 = c / q, t1 = q / a;
+	if(t0 > t1)
+	{
+		swap(t0, t1);
+	}
+	if(t0 > tnear && t0 < tfar)
+	{
+		t = t0;
+	}
+	else if(t1 > tnear && t1 < tfar)
+	{
+		t = t1;
+	}
+	else
+	{
+		return false;
+	}
+	const vec3 n = clamp((oc + t * d) / p.radius, vec3(-1.0f), vec3(1.0f));
+	uv = vec2(atan2(n.z, n.x) / (2.0f * M_PI) + 0.5f, acos(n.y) / M_PI);
+	return true;
+}
+
+static bool intersectPlane(const vec3& point, const vec3& n, const vec3& o, const vec3& d, float tnear,
+                           float tfar, float& t)
+{
+	const float denominator = dot(n, d);
+	if(denominator == 0.0f)
+	{
+		return false;
+	}
+	t = dot(n, point - o) / denominator;
+	return t > tnear && t < tfar;
+}
+
+bool intersectPrimitive(const Primitive& p, const vec3& o, const vec3& d, float tnear, float tfar, float& t,
+                        vec2& uv)
+{
+	if(p.type == SpherePrimitive)
+	{
+		return intersectSphere(p, o, d, tnear, tfar, t, uv);
+	}
+	if(!intersectPlane(p.position, p.normal, o, d, tnear, tfar, t))
+	{
+		return false;
+	}
+	const vec3 q = o + t * d - p.position;
+	if(p.type == DiscPrimitive)
+	{
+		if(dot(q, q) > p.radius * p.radius)
+		{
+			return false;
+		}
+		const vec3 local = transpose(labhelper::tangentSpace(p.normal)) * q;
+		uv = vec2(length(q) / p.radius, atan2(local.y, local.x) / (2.0f * M_PI) + 0.5f);
+		return true;
+	}
+	// q = s * edge0 + t * edge1, solved with cross products, which works
+	// for any parallelogram
+	const vec3 n = cross(p.edge0, p.edge1);
+	const float inv_nn = 1.0f / dot(n, n);
+	const float s = dot(cross(q, p.edge1), n) * inv_nn;
+	const float u = dot(cross(p.edge0, q), n) * inv_nn;
+	if(s < 0.0f || s > 1.0f || u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+	uv = vec2(s, u);
+	return true;
+}
+
+vec3 primitiveSurface(const Primitive& p, vec3& position)
+{
+	if(p.type == SpherePrimitive)
+	{
+		const vec3 n = normalize(position - p.position);
+		position = p.position + p.radius * n;
+		return n;
+	}
+	position -= dot(position - p.position, p.normal) * p.normal;
+	return p.normal;
+}
+} // namespace pathtracer
@@ -0,0 +1,60 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <Model.h>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Analytic primitives: spheres, discs and quads (parallelograms), traced
+// as embree user geometry (see addPrimitives()) instead of being
+// tessellated. Their normals, uvs and areas are exact, so curved glass
+// refracts without facets and emissive primitives are sampled as the
+// shape they are.
+///////////////////////////////////////////////////////////////////////////
+enum PrimitiveType
+{
+	SpherePrimitive,
+	DiscPrimitive,
+	QuadPrimitive,
+};
+
+struct Primitive
+{
+	PrimitiveType type;
+	// Sphere and disc: the center. Quad: a corner, the quad is the points
+	// position + s * edge0 + t * edge1 for s, t in [0, 1]
+	glm::vec3 position;
+	// Disc and quad: the normal of the plane (quads: along edge0 x edge1)
+	glm::vec3 normal;
+	glm::vec3 edge0, edge1;
+	// Sphere and disc
+	float radius;
+	// Not owned. May be a material of a model, so that editing it in the
+	// GUI changes the primitive too.
+	const labhelper::Material* material;
+};
+
+Primitive makeSphere(const glm::vec3& center, float radius, const labhelper::Material* material);
+Primitive makeDisc(const glm::vec3& center, const glm::vec3& normal, float radius,
+                   const labhelper::Material* material);
+Primitive makeQuad(const glm::vec3& corner, const glm::vec3& edge0, const glm::vec3& edge1,
+                   const labhelper::Material* material);
+
+float primitiveArea(const Primitive& p);
+
+// Conservative axis aligned bounding box
+void primitiveBounds(const Primitive& p, glm::vec3& lo, glm::vec3& hi);
+
+// Closest intersection of the ray o + t * d with t in (tnear, tfar), with
+// its distance and the uv coordinates of the point:
+// - sphere: longitude and latitude (v = 0 at +y), in [0, 1]
+// - disc: distance from the center relative to the radius, and angle
+// - quad: s and t as above
+bool intersectPrimitive(const Primitive& p, const glm::vec3& o, const glm::vec3& d, float tnear, float tfar,
+                        float& t, glm::vec2& uv);
+
+// Move a point found by intersectPrimitive() onto the surface, undoing
+// the rounding of o + t * d, and return the normal there (spheres:
+// outwards)
+glm::vec3 primitiveSurface(const Primitive& p, glm::vec3& position);
+} // namespace pathtracer
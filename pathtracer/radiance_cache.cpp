@@ -0,0 +1,304 @@
+#include "radiance_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "Pathtracer.h"
+#include "atomicfloat.h"
+#include "embree.h"
+#include "sampling.h"
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+namespace
+{
+///////////////////////////////////////////////////////////////////////////
+// Tuning
+///////////////////////////////////////////////////////////////////////////
+const size_t CAPACITY = size_t(1) << 19; // cells, ~26 MB with their index
+const int MAX_PROBES = 32;
+// Edge of a cell, as a fraction of the diagonal of the scene (rounded up
+// to a power of two)
+const float CELL_FRACTION = 1.0f / 256.0f;
+// A cell answers once it has this many samples...
+const float MIN_SAMPLES = 8.0f;
+// ...and averages over at most this many, so it follows changes
+const float MAX_SAMPLES = 256.0f;
+// Passes without a sample before a cell is evicted
+const int MAX_AGE = 64;
+// Fraction of paths that ignore the cache and trace on to the bounce
+// limit, so that the cells where the others end keep learning
+const float TRAINING_PATHS = 0.125f;
+
+const uint64_t EMPTY = 0;
+const uint64_t EVICTED = 1; // keeps probe sequences through it intact
+
+struct Cell
+{
+	atomic<uint64_t> key;
+	AtomicFloat sum[3]; // of the samples of this pass
+	atomic<uint32_t> count;
+	// Only changed by endRadianceCachePass()
+	vec3 radiance;
+	float samples;
+	int age;
+
+	void reset(uint64_t k)
+	{
+		key.store(k, memory_order_relaxed);
+		sum[0] = sum[1] = sum[2] = 0.0f;
+		count.store(0, memory_order_relaxed);
+		radiance = vec3(0.0f);
+		samples = 0.0f;
+		age = 0;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// State
+///////////////////////////////////////////////////////////////////////////
+unique_ptr<Cell[]> cells; // allocated when first used
+// Indices of the cells claimed for a key, in the order they were claimed,
+// so that a pass only goes over the cells in use. Evicted cells are taken
+// out by endRadianceCachePass().
+unique_ptr<uint32_t[]> in_use;
+atomic<uint32_t> in_use_count(0);
+bool active = false;
+float inv_cell_size = 0.0f; // 0: not chosen for the current scene yet
+int cells_used = 0;
+int cells_evicted = 0;
+int last_evicted = 0;
+
+///////////////////////////////////////////////////////////////////////////
+// Keys
+///////////////////////////////////////////////////////////////////////////
+inline uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t cellKey(const vec3& p, const vec3& n)
+{
+	const vec3 a = abs(n);
+	const int axis = a.x >= a.y && a.x >= a.z ? 0 : a.y >= a.z ? 1 : 2;
+	const int normal_bin = 2 * axis + (n[axis] < 0.0f ? 1 : 0);
+
+	uint64_t h = mix(uint64_t(normal_bin));
+	h = mix(h ^ uint64_t(uint32_t(int32_t(floor(p.x * inv_cell_size)))));
+	h = mix(h ^ uint64_t(uint32_t(int32_t(floor(p.y * inv_cell_size)))));
+	h = mix(h ^ uint64_t(uint32_t(int32_t(floor(p.z * inv_cell_size)))));
+	return h > EVICTED ? h : h + 2;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The cell with a key, claimed for it if `insert` and it has none yet.
+// nullptr if it is not there, or the table is too full around it.
+///////////////////////////////////////////////////////////////////////////
+Cell* findCell(uint64_t key, bool insert)
+{
+	size_t i = size_t(key) & (CAPACITY - 1);
+	for(int probe = 0; probe < MAX_PROBES; probe++, i = (i + 1) & (CAPACITY - 1))
+	{
+		uint64_t k = cells[i].key.load(memory_order_relaxed);
+		if(k == key)
+			return &cells[i];
+		if(k == EMPTY)
+		{
+			if(!insert)
+				return nullptr;
+			if(cells[i].key.compare_exchange_strong(k, key, memory_order_relaxed))
+			{
+				// Only EMPTY cells are claimed, so each index is listed once
+				in_use[in_use_count.fetch_add(1, memory_order_relaxed)] = uint32_t(i);
+				return &cells[i];
+			}
+			if(k == key)
+				return &cells[i];
+			// Another thread claimed it for another key
+		}
+	}
+	return nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Rehash the cells in use, to get rid of evicted ones
+///////////////////////////////////////////////////////////////////////////
+void compact()
+{
+	struct Kept
+	{
+		uint64_t key;
+		vec3 radiance;
+		float samples;
+		int age;
+	};
+	vector<Kept> kept;
+	kept.reserve(cells_used);
+	const uint32_t n = in_use_count.load(memory_order_relaxed);
+	for(uint32_t i = 0; i < n; i++)
+	{
+		const Cell& c = cells[in_use[i]];
+		kept.push_back({ c.key.load(memory_order_relaxed), c.radiance, c.samples, c.age });
+	}
+	for(size_t i = 0; i < CAPACITY; i++)
+		cells[i].reset(EMPTY);
+	in_use_count.store(0, memory_order_relaxed);
+	for(const Kept& k : kept)
+	{
+		Cell* c = findCell(k.key, true);
+		if(c)
+		{
+			c->radiance = k.radiance;
+			c->samples = k.samples;
+			c->age = k.age;
+		}
+	}
+	cells_evicted = 0;
+}
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////
+// Passes
+///////////////////////////////////////////////////////////////////////////
+void beginRadianceCachePass()
+{
+	active = settings.radiance_cache;
+	if(!active)
+		return;
+	if(!cells)
+	{
+		cells.reset(new Cell[CAPACITY]);
+		in_use.reset(new uint32_t[CAPACITY]);
+		clearRadianceCache();
+	}
+	if(inv_cell_size == 0.0f)
+	{
+		// Power of two at least as large as the wanted cell size
+		vec3 lo, hi;
+		getSceneBounds(lo, hi);
+		int level;
+		frexp(std::max(length(hi - lo) * CELL_FRACTION, 1e-6f), &level);
+		inv_cell_size = ldexp(1.0f, -level);
+	}
+}
+
+void endRadianceCachePass()
+{
+	if(!active)
+		return;
+	active = false;
+	const int n = int(in_use_count.load(memory_order_relaxed));
+	int used = 0, evicted = 0;
+	// Blend the samples of this pass into what each cell answers with
+#pragma omp parallel for schedule(static) reduction(+ : used, evicted)
+	for(int i = 0; i < n; i++)
+	{
+		Cell& c = cells[in_use[i]];
+		const uint32_t count = c.count.load(memory_order_relaxed);
+		if(count > 0)
+		{
+			const vec3 mean = vec3(c.sum[0].get(), c.sum[1].get(), c.sum[2].get()) / float(count);
+			c.samples = std::min(c.samples + float(count), MAX_SAMPLES);
+			c.radiance += (mean - c.radiance) * std::min(1.0f, float(count) / c.samples);
+			c.sum[0] = c.sum[1] = c.sum[2] = 0.0f;
+			c.count.store(0, memory_order_relaxed);
+			c.age = 0;
+			used++;
+		}
+		else if(++c.age > MAX_AGE)
+		{
+			c.reset(EVICTED);
+			evicted++;
+		}
+		else
+		{
+			used++;
+		}
+	}
+	if(evicted > 0)
+	{
+		uint32_t kept = 0;
+		for(int i = 0; i < n; i++)
+		{
+			if(cells[in_use[i]].key.load(memory_order_relaxed) > EVICTED)
+				in_use[kept++] = in_use[i];
+		}
+		in_use_count.store(kept, memory_order_relaxed);
+	}
+	cells_used = used;
+	cells_evicted += evicted;
+	last_evicted = evicted;
+	// Evicted cells lengthen the probe sequences of every lookup through
+	// them until the table is rebuilt
+	if(size_t(cells_evicted) > CAPACITY / 8)
+		compact();
+}
+
+void clearRadianceCache()
+{
+	if(cells)
+	{
+		for(size_t i = 0; i < CAPACITY; i++)
+			cells[i].reset(EMPTY);
+	}
+	in_use_count.store(0, memory_order_relaxed);
+	cells_used = 0;
+	cells_evicted = 0;
+	last_evicted = 0;
+	inv_cell_size = 0.0f;
+}
+
+bool isRadianceCacheActive()
+{
+	return active;
+}
+
+bool isRadianceCacheTrainingPath()
+{
+	return randf() < TRAINING_PATHS;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Lookups and samples
+///////////////////////////////////////////////////////////////////////////
+bool lookupRadianceCache(const vec3& p, const vec3& n, vec3& radiance)
+{
+	const Cell* c = findCell(cellKey(p, n), false);
+	if(!c || c->samples < MIN_SAMPLES)
+		return false;
+	radiance = c->radiance;
+	return true;
+}
+
+void recordRadianceCache(const vec3& p, const vec3& n, const vec3& radiance)
+{
+	// A NaN would stay in the cell
+	if(!(radiance.x + radiance.y + radiance.z < INFINITY))
+		return;
+	Cell* c = findCell(cellKey(p, n), true);
+	if(!c)
+		return;
+	// Negative values come from rounding
+	for(int i = 0; i < 3; i++)
+		c->sum[i].add(std::max(0.0f, radiance[i]));
+	c->count.fetch_add(1, memory_order_relaxed);
+}
+
+RadianceCacheReport getRadianceCacheReport()
+{
+	RadianceCacheReport r;
+	r.cells = cells_used;
+	r.capacity = int(CAPACITY);
+	r.evicted = last_evicted;
+	return r;
+}
+} // namespace pathtracer
@@ -0,0 +1,59 @@
+#pragma once
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Radiance cache (settings.radiance_cache): a world-space hash grid of the
+// radiance leaving opaque surfaces, learned from the paths of Li().
+//
+// A cell is keyed by its quantized position and the dominant axis of the
+// normal. Cells are cubes of one size for the whole scene, a power of two
+// near 1/256 of its diagonal, so that where a cell is does not depend on
+// the camera and moving it keeps what was learned. Li() reports
+// the radiance it found leaving every opaque vertex of its paths, and
+// from bounce settings.radiance_cache_bounces on ends a path at the first
+// cell that has seen enough samples, adding the cell's radiance instead of
+// tracing on.
+//
+// The table has a fixed size and is addressed by linear probing; render
+// threads claim cells and add to them with atomic operations. After each
+// pass the new samples of a cell are blended into the radiance it answers
+// with, and cells that got no sample for a while are evicted.
+//
+// The result is biased: a cell answers with its average over its area and
+// over the directions it was seen from, which is exact only for diffuse
+// surfaces with uniform lighting across the cell. Changes to the lighting
+// make the cache stale, see restart(LightingChanged).
+///////////////////////////////////////////////////////////////////////////
+
+// Call around each pass of tracePaths(), after the BVH of the scene is
+// built (its bounds decide the cell size)
+void beginRadianceCachePass();
+void endRadianceCachePass();
+
+// Forget everything (the scene or its lighting changed)
+void clearRadianceCache();
+
+// Whether this pass uses the cache
+bool isRadianceCacheActive();
+
+// Random: whether a path should ignore the cache and trace on to the
+// bounce limit, so that the cells where other paths end keep learning
+bool isRadianceCacheTrainingPath();
+
+// Radiance leaving the surface at p with normal n, if its cell has seen
+// enough samples
+bool lookupRadianceCache(const glm::vec3& p, const glm::vec3& n, glm::vec3& radiance);
+
+// A sample of the radiance leaving the surface at p. Thread safe.
+void recordRadianceCache(const glm::vec3& p, const glm::vec3& n, const glm::vec3& radiance);
+
+struct RadianceCacheReport
+{
+	int cells;    // in use
+	int capacity;
+	int evicted;  // by the last pass
+};
+RadianceCacheReport getRadianceCacheReport();
+} // namespace pathtracer
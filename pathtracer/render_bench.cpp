@@ -0,0 +1,648 @@
+///////////////////////////////////////////////////////////////////////////
+// pathtracer_render_bench: renders each scene headlessly with a fixed
+// camera, resolution and seed, and reports throughput (rays/s, paths/s,
+// time per sample per pixel), peak memory and the error against a stored
+// high-spp reference at a set of time budgets.
+//
+// Usage: pathtracer_render_bench [--out file.json] [--scene name]
+//            [--size WxH] [--budgets s1,s2,...] [--references dir]
+//            [--make-references spp] [--seed N] [--label text]
+//            [--integrator pt|bdpt|sppm] [--guiding 0|1]
+//            [--radiance-cache 0|1] [--cache-bounces N] [--specialize 0|1]
+//            [--roulette 0|1] [--roulette-depth N] [--split N]
+//            [--primary-cache 0|1] [--strata N]
+//        pathtracer_render_bench --scaling strong|weak [--threads 1,2,4,...]
+//            [--spp N] [--pin 0|1] [--first-touch 0|1] [...]
+//
+// Run once with --make-references to render the references (written as
+// PFM to the references directory), then without it to benchmark. Without
+// a reference for a scene only the throughput numbers are reported.
+//
+// --scaling renders `spp` samples per pixel at each thread count, either
+// at the same size (strong scaling) or with the pixel count growing with
+// the number of threads (weak scaling), and reports the parallel
+// efficiency relative to the first thread count. --pin binds OpenMP thread
+// i to logical CPU i, --first-touch 0 lets the main thread initialize the
+// image (as before), to make remote-memory traffic on NUMA machines show.
+//
+// --guiding 1 turns on path guiding (see guiding.h). Its training happens
+// within the time budgets, so the errors of a run with --guiding 0 and one
+// with --guiding 1 compare the two at equal time.
+//
+// --radiance-cache 1 lets paths end at the radiance cache from bounce
+// --cache-bounces on (see radiance_cache.h). The cache fills within the
+// time budgets as well, and the error against the references (always
+// rendered without it) includes its bias.
+//
+// --specialize 0 makes the path tracer use the version of Li() that tests
+// for glass, emission, the point light and the environment at every
+// bounce, instead of the one compiled for what the scene uses. Compare the
+// paths/s of both, e.g. on the Sphere scene, which is diffuse only.
+//
+// --roulette and --roulette-depth set Russian roulette, --split the
+// number of paths traced on from each camera ray's hit. Both are unbiased,
+// so the errors at the time budgets show which settings converge faster.
+//
+// --primary-cache 1 reuses the surface each camera ray hit in later
+// passes (the camera does not move), sampling each pixel at --strata x
+// --strata fixed positions. Compare the rays/s and the camera_rays and
+// reused_camera_rays counters with a run without it.
+///////////////////////////////////////////////////////////////////////////
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <labhelper.h>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "guiding.h"
+#include "radiance_cache.h"
+#include "pfm.h"
+#include "sampling.h"
+#include "scenes.h"
+#include "stats.h"
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+using namespace glm;
+using namespace std;
+
+namespace
+{
+struct RenderBenchOptions
+{
+	string out = "pathtracer_render_bench.json";
+	string scene;
+	string label;
+	string references = "../scenes/references/";
+	int width = 256, height = 256;
+	int reference_spp = 0; // > 0: render references instead of benchmarking
+	uint32_t seed = 1;
+	pathtracer::Integrator integrator = pathtracer::PathTracing;
+	bool guiding = false;
+	bool radiance_cache = false;
+	int cache_bounces = 2;
+	bool specialize = true;
+	bool roulette = true;
+	int roulette_depth = 3;
+	int split = 1;
+	bool primary_cache = false;
+	int strata = 2;
+	vector<double> budgets = { 1.0, 2.0, 4.0, 8.0 };
+	// Scaling study
+	string scaling; // "strong", "weak" or empty
+	vector<int> threads;
+	int scaling_spp = 16;
+	bool pin = false;
+	bool first_touch = true;
+};
+RenderBenchOptions options;
+
+// Error against the reference after `time` seconds of rendering
+struct ConvergencePoint
+{
+	double budget, time;
+	int spp;
+	double rmse, relmse;
+};
+
+struct SceneReport
+{
+	string scene;
+	string reference;
+	int spp;
+	double render_seconds;
+	uint64_t rays;
+	double ms_per_spp_median, ms_per_spp_mean;
+	size_t peak_memory;
+	pathtracer::stats::Counters counters;
+	vector<ConvergencePoint> convergence;
+};
+
+struct ScalingPoint
+{
+	int threads;
+	int width, height;
+	double seconds;
+	uint64_t rays;
+	double paths_per_sec;
+	double efficiency;
+};
+
+struct ScalingReport
+{
+	string scene;
+	vector<ScalingPoint> points;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Peak resident set size of the process so far, in bytes
+///////////////////////////////////////////////////////////////////////////
+size_t peakMemory()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return size_t(counters.PeakWorkingSetSize);
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return size_t(usage.ru_maxrss);
+#else
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+// References are stored as PFM (see pfm.h)
+///////////////////////////////////////////////////////////////////////////
+string referenceFilename(const string& scene)
+{
+	stringstream ss;
+	ss << options.references << scene << "_" << options.width << "x" << options.height << ".pfm";
+	return ss.str();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Root mean square error and relative MSE, mean((x - ref)^2 / (ref^2 +
+// 0.01)), over all pixels and channels
+///////////////////////////////////////////////////////////////////////////
+void imageError(const pathtracer::Image::Buffer& image,
+                const vector<vec3>& reference,
+                double& rmse,
+                double& relmse)
+{
+	double se = 0.0, rel = 0.0;
+	for(size_t i = 0; i < image.size(); i++)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			double d = double(image[i][c]) - double(reference[i][c]);
+			se += d * d;
+			rel += d * d / (double(reference[i][c]) * reference[i][c] + 0.01);
+		}
+	}
+	double n = 3.0 * double(image.size());
+	rmse = sqrt(se / n);
+	relmse = rel / n;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Set up the pathtracer for a fresh render of `scene`
+///////////////////////////////////////////////////////////////////////////
+void startRender(const scene_t& scene, int width, int height, mat4& V, mat4& P)
+{
+	pathtracer::settings.subsampling = 1;
+	pathtracer::settings.max_paths_per_pixel = 0;
+	pathtracer::settings.numa_first_touch = options.first_touch;
+	pathtracer::settings.integrator = options.integrator;
+	pathtracer::settings.path_guiding = options.guiding;
+	pathtracer::resetGuiding();
+	pathtracer::settings.radiance_cache = options.radiance_cache && options.reference_spp == 0;
+	pathtracer::settings.radiance_cache_bounces = options.cache_bounces;
+	pathtracer::settings.specialize_li = options.specialize;
+	pathtracer::settings.russian_roulette = options.roulette;
+	pathtracer::settings.roulette_depth = options.roulette_depth;
+	pathtracer::settings.split_paths = options.split;
+	pathtracer::settings.primary_hit_cache = options.primary_cache && options.reference_spp == 0;
+	pathtracer::settings.primary_strata = options.strata;
+	pathtracer::clearRadianceCache();
+	pathtracer::resize(width, height);
+	pathtracer::seedRandom(options.seed);
+	pathtracer::stats::resetTotal();
+	V = lookAt(scene.camera.position, scene.camera.position + scene.camera.direction, vec3(0.0f, 1.0f, 0.0f));
+	P = perspective(radians(45.0f), float(width) / float(height), 0.1f, 100.0f);
+}
+
+void makeReference(const string& name, const scene_t& scene)
+{
+	mat4 V, P;
+	buildPathtracerScene(scene);
+	startRender(scene, options.width, options.height, V, P);
+	for(int s = 0; s < options.reference_spp; s++)
+	{
+		pathtracer::tracePaths(V, P);
+		if((s + 1) % 64 == 0)
+			cout << "\r" << name << ": " << s + 1 << "/" << options.reference_spp << " spp" << flush;
+	}
+	string filename = referenceFilename(name);
+	bool ok = writePFM(filename, options.width, options.height, &pathtracer::rendered_image.data[0]);
+	cout << "\n" << (ok ? "Wrote " : "Could not write ") << filename << "\n";
+}
+
+SceneReport benchmarkScene(const string& name, const scene_t& scene)
+{
+	typedef chrono::high_resolution_clock clock;
+	SceneReport report;
+	report.scene = name;
+	vector<vec3> reference;
+	if(readPFM(referenceFilename(name), options.width, options.height, reference))
+		report.reference = referenceFilename(name);
+	else
+		cout << name << ": no reference " << referenceFilename(name) << ", reporting throughput only\n";
+
+	mat4 V, P;
+	buildPathtracerScene(scene);
+	startRender(scene, options.width, options.height, V, P);
+
+	// Only time spent in tracePaths counts toward the budgets, the error
+	// computation is excluded.
+	vector<double> ms_per_spp;
+	double render_seconds = 0.0;
+	size_t next_budget = 0;
+	while(next_budget < options.budgets.size())
+	{
+		auto start = clock::now();
+		pathtracer::tracePaths(V, P);
+		double seconds = chrono::duration<double>(clock::now() - start).count();
+		render_seconds += seconds;
+		ms_per_spp.push_back(seconds * 1e3);
+
+		while(next_budget < options.budgets.size() && render_seconds >= options.budgets[next_budget])
+		{
+			ConvergencePoint point;
+			point.budget = options.budgets[next_budget++];
+			point.time = render_seconds;
+			point.spp = int(ms_per_spp.size());
+			point.rmse = point.relmse = -1.0;
+			if(!reference.empty())
+				imageError(pathtracer::rendered_image.data, reference, point.rmse, point.relmse);
+			report.convergence.push_back(point);
+		}
+	}
+
+	report.spp = int(ms_per_spp.size());
+	report.render_seconds = render_seconds;
+	report.counters = pathtracer::stats::total;
+	report.rays = report.counters.rays();
+	double sum = 0.0;
+	for(double ms : ms_per_spp)
+		sum += ms;
+	report.ms_per_spp_mean = sum / double(ms_per_spp.size());
+	sort(ms_per_spp.begin(), ms_per_spp.end());
+	report.ms_per_spp_median = ms_per_spp[ms_per_spp.size() / 2];
+	report.peak_memory = peakMemory();
+
+	double paths = double(report.spp) * options.width * options.height;
+	printf("%-12s %5d spp in %6.2fs  %8.3f Mrays/s  %8.3f Mpaths/s  %8.2f ms/spp  peak %6.1f MB\n", name.c_str(),
+	       report.spp, render_seconds, 1e-6 * double(report.rays) / render_seconds, 1e-6 * paths / render_seconds,
+	       report.ms_per_spp_median, double(report.peak_memory) / (1024.0 * 1024.0));
+	for(const ConvergencePoint& p : report.convergence)
+	{
+		if(p.rmse >= 0.0)
+			printf("    %6.2fs: %5d spp  RMSE %.5f  relMSE %.6f\n", p.time, p.spp, p.rmse, p.relmse);
+	}
+	return report;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Bind each OpenMP thread of the current team size to one logical CPU.
+// The runtime keeps its threads alive between parallel regions, so this
+// sticks for the following renders.
+///////////////////////////////////////////////////////////////////////////
+void pinThreads()
+{
+	const int num_cpus = omp_get_num_procs();
+#pragma omp parallel
+	{
+		int cpu = omp_get_thread_num() % num_cpus;
+#if defined(_WIN32)
+		SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (cpu % (8 * sizeof(DWORD_PTR))));
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+}
+
+ScalingReport scalingScene(const string& name, const scene_t& scene)
+{
+	typedef chrono::high_resolution_clock clock;
+	ScalingReport report;
+	report.scene = name;
+	buildPathtracerScene(scene);
+	const bool weak = options.scaling == "weak";
+	const int base_threads = options.threads.front();
+	for(int threads : options.threads)
+	{
+		omp_set_num_threads(threads);
+		if(options.pin)
+			pinThreads();
+
+		// Weak scaling keeps the pixels per thread (and the aspect) fixed
+		float scale = weak ? sqrtf(float(threads) / float(base_threads)) : 1.0f;
+		ScalingPoint point;
+		point.threads = threads;
+		point.width = std::max(1, int(options.width * scale + 0.5f));
+		point.height = std::max(1, int(options.height * scale + 0.5f));
+
+		mat4 V, P;
+		startRender(scene, point.width, point.height, V, P);
+		pathtracer::tracePaths(V, P); // Warm-up, faults in all pages
+		pathtracer::stats::resetTotal();
+		auto start = clock::now();
+		for(int s = 0; s < options.scaling_spp; s++)
+			pathtracer::tracePaths(V, P);
+		point.seconds = chrono::duration<double>(clock::now() - start).count();
+		point.rays = pathtracer::stats::total.rays();
+		point.paths_per_sec = double(options.scaling_spp) * point.width * point.height / point.seconds;
+
+		// Throughput per thread relative to the first run, which is the
+		// usual definition of efficiency for both strong and weak scaling.
+		const ScalingPoint& base = report.points.empty() ? point : report.points.front();
+		point.efficiency = (point.paths_per_sec / threads) / (base.paths_per_sec / base_threads);
+		report.points.push_back(point);
+
+		printf("%-12s %3d threads %5dx%-5d %8.3f s  %8.3f Mrays/s  %8.3f Mpaths/s  speedup %6.2f  efficiency "
+		       "%5.1f%%\n",
+		       name.c_str(), threads, point.width, point.height, point.seconds,
+		       1e-6 * double(point.rays) / point.seconds, 1e-6 * point.paths_per_sec,
+		       point.paths_per_sec / report.points.front().paths_per_sec, 100.0 * point.efficiency);
+	}
+	return report;
+}
+
+string jsonEscape(const string& s)
+{
+	string r;
+	for(char c : s)
+	{
+		if(c == '"' || c == '\\')
+			r += '\\';
+		r += c;
+	}
+	return r;
+}
+
+void writeMeta(ofstream& f)
+{
+	char date[64];
+	time_t now = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	f << "{\n  \"meta\": {\n";
+	f << "    \"label\": \"" << jsonEscape(options.label) << "\",\n";
+	f << "    \"date\": \"" << date << "\",\n";
+	f << "    \"width\": " << options.width << ",\n";
+	f << "    \"height\": " << options.height << ",\n";
+	f << "    \"seed\": " << options.seed << ",\n";
+	f << "    \"max_bounces\": " << pathtracer::settings.max_bounces << ",\n";
+	const char* integrators[] = { "pt", "bdpt", "sppm" };
+	f << "    \"integrator\": \"" << integrators[options.integrator] << "\",\n";
+	f << "    \"path_guiding\": " << (options.guiding ? "true" : "false") << ",\n";
+	f << "    \"radiance_cache\": " << (options.radiance_cache ? "true" : "false") << ",\n";
+	f << "    \"cache_bounces\": " << options.cache_bounces << ",\n";
+	f << "    \"specialize_li\": " << (options.specialize ? "true" : "false") << ",\n";
+	f << "    \"russian_roulette\": " << (options.roulette ? "true" : "false") << ",\n";
+	f << "    \"roulette_depth\": " << options.roulette_depth << ",\n";
+	f << "    \"split_paths\": " << options.split << ",\n";
+	f << "    \"primary_hit_cache\": " << (options.primary_cache ? "true" : "false") << ",\n";
+	f << "    \"primary_strata\": " << options.strata << ",\n";
+	f << "    \"first_touch\": " << (options.first_touch ? "true" : "false") << ",\n";
+	f << "    \"threads\": " << omp_get_max_threads() << "\n  },\n";
+}
+
+void writeJSON(const string& filename, const vector<SceneReport>& reports)
+{
+	ofstream f(filename);
+	if(!f)
+	{
+		cout << "Could not write " << filename << "\n";
+		return;
+	}
+	writeMeta(f);
+	f << "  \"scenes\": [\n";
+	for(size_t i = 0; i < reports.size(); i++)
+	{
+		const SceneReport& r = reports[i];
+		double paths = double(r.spp) * options.width * options.height;
+		f << "    {\n";
+		f << "      \"scene\": \"" << jsonEscape(r.scene) << "\",\n";
+		f << "      \"reference\": \"" << jsonEscape(r.reference) << "\",\n";
+		f << "      \"spp\": " << r.spp << ",\n";
+		f << "      \"render_seconds\": " << r.render_seconds << ",\n";
+		f << "      \"rays\": " << r.rays << ",\n";
+		f << "      \"rays_per_sec\": " << double(r.rays) / r.render_seconds << ",\n";
+		f << "      \"paths_per_sec\": " << paths / r.render_seconds << ",\n";
+		f << "      \"ms_per_spp\": " << r.ms_per_spp_median << ",\n";
+		f << "      \"ms_per_spp_mean\": " << r.ms_per_spp_mean << ",\n";
+		f << "      \"peak_memory_bytes\": " << r.peak_memory << ",\n";
+		f << "      \"counters\": " << pathtracer::stats::toJSON(r.counters, "      ") << ",\n";
+		f << "      \"convergence\": [";
+		for(size_t j = 0; j < r.convergence.size(); j++)
+		{
+			const ConvergencePoint& p = r.convergence[j];
+			f << (j == 0 ? "\n" : ",\n") << "        { \"budget_seconds\": " << p.budget
+			  << ", \"seconds\": " << p.time << ", \"spp\": " << p.spp;
+			if(p.rmse >= 0.0)
+				f << ", \"rmse\": " << p.rmse << ", \"relmse\": " << p.relmse;
+			f << " }";
+		}
+		f << "\n      ]\n    }" << (i + 1 < reports.size() ? ",\n" : "\n");
+	}
+	f << "  ]\n}\n";
+	cout << "Wrote " << filename << "\n";
+}
+
+void writeScalingJSON(const string& filename, const vector<ScalingReport>& reports)
+{
+	ofstream f(filename);
+	if(!f)
+	{
+		cout << "Could not write " << filename << "\n";
+		return;
+	}
+	writeMeta(f);
+	f << "  \"scaling\": {\n";
+	f << "    \"mode\": \"" << options.scaling << "\",\n";
+	f << "    \"spp\": " << options.scaling_spp << ",\n";
+	f << "    \"pin\": " << (options.pin ? "true" : "false") << ",\n";
+	f << "    \"num_procs\": " << omp_get_num_procs() << "\n  },\n";
+	f << "  \"scenes\": [\n";
+	for(size_t i = 0; i < reports.size(); i++)
+	{
+		const ScalingReport& r = reports[i];
+		f << "    {\n      \"scene\": \"" << jsonEscape(r.scene) << "\",\n      \"runs\": [";
+		for(size_t j = 0; j < r.points.size(); j++)
+		{
+			const ScalingPoint& p = r.points[j];
+			f << (j == 0 ? "\n" : ",\n") << "        { \"threads\": " << p.threads << ", \"width\": " << p.width
+			  << ", \"height\": " << p.height << ", \"seconds\": " << p.seconds
+			  << ", \"rays_per_sec\": " << double(p.rays) / p.seconds
+			  << ", \"paths_per_sec\": " << p.paths_per_sec
+			  << ", \"speedup\": " << p.paths_per_sec / r.points.front().paths_per_sec
+			  << ", \"efficiency\": " << p.efficiency << " }";
+		}
+		f << "\n      ]\n    }" << (i + 1 < reports.size() ? ",\n" : "\n");
+	}
+	f << "  ]\n}\n";
+	cout << "Wrote " << filename << "\n";
+}
+
+void usage()
+{
+	cout << "Usage: pathtracer_render_bench [--out file.json] [--scene name] [--size WxH]\n"
+	        "           [--budgets s1,s2,...] [--references dir] [--make-references spp]\n"
+	        "           [--seed N] [--label text] [--integrator pt|bdpt|sppm] [--guiding 0|1]\n"
+	        "           [--radiance-cache 0|1] [--cache-bounces N] [--specialize 0|1]\n"
+	        "           [--roulette 0|1] [--roulette-depth N] [--split N]\n"
+	        "           [--primary-cache 0|1] [--strata N]\n"
+	        "       pathtracer_render_bench --scaling strong|weak [--threads 1,2,4,...] [--spp N]\n"
+	        "           [--pin 0|1] [--first-touch 0|1] [...]\n";
+	exit(1);
+}
+
+void parseArguments(int argc, char* argv[])
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+			usage();
+		string value = argv[++i];
+		if(arg == "--out")
+			options.out = value;
+		else if(arg == "--scene")
+			options.scene = value;
+		else if(arg == "--label")
+			options.label = value;
+		else if(arg == "--references")
+			options.references = value.back() == '/' ? value : value + "/";
+		else if(arg == "--make-references")
+			options.reference_spp = atoi(value.c_str());
+		else if(arg == "--seed")
+			options.seed = uint32_t(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--integrator")
+		{
+			if(value == "pt")
+				options.integrator = pathtracer::PathTracing;
+			else if(value == "bdpt")
+				options.integrator = pathtracer::Bidirectional;
+			else if(value == "sppm")
+				options.integrator = pathtracer::PhotonMapping;
+			else
+				usage();
+		}
+		else if(arg == "--guiding")
+			options.guiding = atoi(value.c_str()) != 0;
+		else if(arg == "--radiance-cache")
+			options.radiance_cache = atoi(value.c_str()) != 0;
+		else if(arg == "--cache-bounces")
+			options.cache_bounces = atoi(value.c_str());
+		else if(arg == "--specialize")
+			options.specialize = atoi(value.c_str()) != 0;
+		else if(arg == "--roulette")
+			options.roulette = atoi(value.c_str()) != 0;
+		else if(arg == "--roulette-depth")
+			options.roulette_depth = atoi(value.c_str());
+		else if(arg == "--split")
+			options.split = std::max(1, atoi(value.c_str()));
+		else if(arg == "--primary-cache")
+			options.primary_cache = atoi(value.c_str()) != 0;
+		else if(arg == "--strata")
+			options.strata = std::max(1, std::min(4, atoi(value.c_str())));
+		else if(arg == "--size")
+		{
+			if(sscanf(value.c_str(), "%dx%d", &options.width, &options.height) != 2 || options.width <= 0
+			   || options.height <= 0)
+				usage();
+		}
+		else if(arg == "--budgets")
+		{
+			options.budgets.clear();
+			stringstream ss(value);
+			string item;
+			while(getline(ss, item, ','))
+				options.budgets.push_back(atof(item.c_str()));
+			sort(options.budgets.begin(), options.budgets.end());
+			if(options.budgets.empty() || options.budgets.front() <= 0.0)
+				usage();
+		}
+		else if(arg == "--scaling")
+		{
+			options.scaling = value;
+			if(value != "strong" && value != "weak")
+				usage();
+		}
+		else if(arg == "--threads")
+		{
+			options.threads.clear();
+			stringstream ss(value);
+			string item;
+			while(getline(ss, item, ','))
+				options.threads.push_back(std::max(1, atoi(item.c_str())));
+			if(options.threads.empty())
+				usage();
+		}
+		else if(arg == "--spp")
+			options.scaling_spp = std::max(1, atoi(value.c_str()));
+		else if(arg == "--pin")
+			options.pin = atoi(value.c_str()) != 0;
+		else if(arg == "--first-touch")
+			options.first_touch = atoi(value.c_str()) != 0;
+		else
+			usage();
+	}
+	if(options.threads.empty())
+	{
+		// Powers of two up to all logical CPUs
+		const int max_threads = omp_get_num_procs();
+		for(int t = 1; t < max_threads; t *= 2)
+			options.threads.push_back(t);
+		options.threads.push_back(max_threads);
+	}
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	parseArguments(argc, argv);
+
+	// Models are uploaded to GL when loaded, so we need a (hidden) context
+	SDL_Window* window = labhelper::init_window_SDL("pathtracer_render_bench", 64, 64, true);
+
+	initPathtracerDefaults();
+	std::map<std::string, scene_t> scenes;
+	loadScenes(scenes);
+
+	vector<SceneReport> reports;
+	vector<ScalingReport> scaling_reports;
+	for(auto& it : scenes)
+	{
+		if(!options.scene.empty() && it.first != options.scene)
+			continue;
+		if(!options.scaling.empty())
+			scaling_reports.push_back(scalingScene(it.first, it.second));
+		else if(options.reference_spp > 0)
+			makeReference(it.first, it.second);
+		else
+			reports.push_back(benchmarkScene(it.first, it.second));
+	}
+	if(!options.scaling.empty())
+		writeScalingJSON(options.out, scaling_reports);
+	else if(options.reference_spp <= 0)
+		writeJSON(options.out, reports);
+
+	cleanupScenes(scenes);
+	labhelper::shutDown(window);
+	return 0;
+}
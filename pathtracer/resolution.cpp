@@ -0,0 +1,77 @@
+#include "resolution.h"
+#include <algorithm>
+#include <cmath>
+#include "Pathtracer.h"
+
+namespace pathtracer
+{
+const float MIN_SUBSAMPLING = 1.0f;
+const float MAX_SUBSAMPLING = 16.0f;
+
+void ResolutionController::frameTraced(float trace_ms,
+                                       int traced_pixels,
+                                       bool restarted,
+                                       int window_width,
+                                       int window_height)
+{
+	if(traced_pixels <= 0 || trace_ms <= 0.0f)
+		return;
+	// Exponential moving average, so that one slow frame doesn't make the
+	// resolution jump
+	const float cost = trace_ms / float(traced_pixels);
+	ms_per_path = ms_per_path == 0.0f ? cost : 0.8f * ms_per_path + 0.2f * cost;
+	if(!settings.dynamic_resolution)
+		return;
+
+	const float affordable_pixels = std::max(1.0f, settings.target_frame_ms / ms_per_path);
+	float wanted = std::sqrt(float(window_width) * float(window_height) / affordable_pixels);
+	// Quarter steps, so that the image isn't reallocated for tiny changes
+	wanted = std::ceil(wanted * 4.0f) / 4.0f;
+	wanted = std::min(MAX_SUBSAMPLING, std::max(MIN_SUBSAMPLING, wanted));
+
+	const float current = settings.subsampling;
+	if(restarted)
+	{
+		// Hysteresis: ignore changes of less than ~20% in pixel count
+		if(std::abs(wanted - current) > 0.1f * current)
+			settings.subsampling = wanted;
+	}
+	else if(wanted < current / 1.15f)
+	{
+		// Only sharpen while accumulating, and only for >30% more pixels
+		settings.subsampling = wanted;
+	}
+}
+
+bool MotionQualityController::update(const glm::vec3& camera_position,
+                                     const glm::vec3& camera_direction,
+                                     float delta_ms)
+{
+	float movement = 0.0f;
+	if(has_last)
+	{
+		const float cos_angle = glm::dot(glm::normalize(camera_direction), glm::normalize(last_direction));
+		movement = glm::length(camera_position - last_position) + std::acos(std::min(1.0f, cos_angle));
+	}
+	last_position = camera_position;
+	last_direction = camera_direction;
+	has_last = true;
+
+	if(!settings.motion_adaptive)
+	{
+		is_moving = false;
+	}
+	else if(movement > settings.motion_threshold)
+	{
+		is_moving = true;
+		still_ms = 0.0f;
+	}
+	else if(is_moving)
+	{
+		still_ms += delta_ms;
+		if(still_ms >= settings.settle_ms)
+			is_moving = false;
+	}
+	return is_moving;
+}
+} // namespace pathtracer
@@ -0,0 +1,61 @@
+#pragma once
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Dynamic resolution for the interactive viewer: picks
+// settings.subsampling from the measured cost of tracePaths() so that a
+// frame takes about settings.target_frame_ms.
+//
+// The resolution only gets coarser when the image was restarted anyway
+// (camera moved, settings changed), so accumulated samples are never
+// thrown away to save time. It gets finer whenever there is clear
+// headroom, which restarts accumulation once at the sharper resolution.
+///////////////////////////////////////////////////////////////////////////
+class ResolutionController
+{
+public:
+	// Call after each tracePaths() with its duration, the size of the image
+	// it traced, whether the image had been restarted before it (sample
+	// count 0) and the window size.
+	void frameTraced(float trace_ms, int traced_pixels, bool restarted, int window_width, int window_height);
+
+	// Smoothed cost of one path, in nanoseconds
+	float nanosecondsPerPath() const
+	{
+		return ms_per_path * 1e6f;
+	}
+
+private:
+	float ms_per_path = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Motion-adaptive quality for the interactive viewer. Every sample traced
+// while the camera moves is thrown away on the next frame, so those frames
+// use the cheaper motion_* settings. Reduced quality starts on the first
+// frame the camera moves, but full quality only returns once it has been
+// still for settings.settle_ms, so that short pauses while navigating
+// don't flip between the two.
+///////////////////////////////////////////////////////////////////////////
+class MotionQualityController
+{
+public:
+	// Call once per frame, before tracing. Returns true if this frame
+	// should use the reduced quality.
+	bool update(const glm::vec3& camera_position, const glm::vec3& camera_direction, float delta_ms);
+
+	bool moving() const
+	{
+		return is_moving;
+	}
+
+private:
+	glm::vec3 last_position = glm::vec3(0.0f);
+	glm::vec3 last_direction = glm::vec3(0.0f);
+	bool has_last = false;
+	bool is_moving = false;
+	float still_ms = 0.0f;
+};
+} // namespace pathtracer
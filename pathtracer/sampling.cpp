@@ -1,8 +1,9 @@
 #include "sampling.h"
-#include <random>
 #include "labhelper.h"
+#include "fastmath.h"
 #include <omp.h>
 #include <iostream>
+#include <vector>
 #include <glm/glm.hpp>
 
 using namespace glm;
@@ -12,11 +13,74 @@ namespace pathtracer
 ///////////////////////////////////////////////////////////////////////////////
 // Get a random float. Note that we need one "generator" per thread, or we
 // would need to lock everytime someone called randf().
+//
+// The generators are PCG32 states, small enough to be reseeded for every
+// pixel sample (beginSample()). The random numbers of a sample then depend
+// on (seed, pixel, sample index) only, and not on which thread or process
+// renders it.
 ///////////////////////////////////////////////////////////////////////////////
-std::mt19937 generators[24]; // Assuming no more than 24 cores
+struct alignas(64) Generator
+{
+	uint64_t state = 0x853c49e6748fea9bULL;
+	uint64_t inc = 0xda3e39cb94b95bdbULL;
+};
+// One per thread, see prepareRandomThreads()
+std::vector<Generator, fastmath::aligned_allocator<Generator>> generators(1);
+uint32_t seed_value = 0;
+uint64_t sample_seed = 0;
+
+static inline uint32_t nextRandom(Generator& g)
+{
+	uint64_t old = g.state;
+	g.state = old * 6364136223846793005ULL + g.inc;
+	uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+	uint32_t rot = uint32_t(old >> 59u);
+	return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+}
+
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t z)
+{
+	z += 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
 float randf()
 {
-	return float(generators[omp_get_thread_num()]() / double(generators[omp_get_thread_num()].max()));
+	// 24 random bits, uniform in [0, 1)
+	return float(nextRandom(generators[omp_get_thread_num()]) >> 8) * (1.0f / 16777216.0f);
+}
+
+void seedRandom(uint32_t seed)
+{
+	seed_value = seed;
+	sample_seed = mix64(seed);
+	generators.clear();
+	prepareRandomThreads();
+}
+
+void prepareRandomThreads()
+{
+	for(size_t i = generators.size(); i < size_t(omp_get_max_threads()); i++)
+	{
+		generators.push_back(Generator());
+		generators[i].state = mix64(sample_seed + uint64_t(i));
+		nextRandom(generators[i]);
+	}
+}
+
+uint32_t getRandomSeed()
+{
+	return seed_value;
+}
+
+void beginSample(uint32_t pixel, uint32_t sample)
+{
+	Generator& g = generators[omp_get_thread_num()];
+	g.state = mix64(((uint64_t(sample) << 32) | pixel) ^ sample_seed);
+	nextRandom(g);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -66,7 +130,9 @@ glm::vec2 concentricSampleDisk()
 		}
 	}
 	theta *= float(M_PI) / 4.0f;
-	return r * glm::vec2(cosf(theta), sinf(theta));
+	float sin_theta, cos_theta;
+	fast_sincos(theta, sin_theta, cos_theta);
+	return r * glm::vec2(cos_theta, sin_theta);
 }
 
 ///////////////////////////////////////////////////////////////////////////
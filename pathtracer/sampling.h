@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <glm/glm.hpp>
 
 namespace pathtracer
@@ -8,6 +9,19 @@ namespace pathtracer
 ///////////////////////////////////////////////////////////////////////////
 float randf();
 
+// Reseed the per-thread generators, for reproducible renders
+void seedRandom(uint32_t seed);
+uint32_t getRandomSeed();
+
+// Add generators up to omp_get_max_threads(), for the parallel regions to
+// come. Not thread safe: tracePaths() calls it before it starts threads.
+void prepareRandomThreads();
+
+// Reseed the calling thread's generator for sample number `sample` of a
+// pixel, so that the sample is the same whichever thread or process
+// renders it
+void beginSample(uint32_t pixel, uint32_t sample);
+
 ///////////////////////////////////////////////////////////////////////////
 // Generate uniform points on a disc
 ///////////////////////////////////////////////////////////////////////////
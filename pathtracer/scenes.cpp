@@ -0,0 +1,209 @@
+#include "scenes.h"
+#include <list>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "guiding.h"
+#include "radiance_cache.h"
+
+using namespace glm;
+
+void loadScenes(std::map<std::string, scene_t>& scenes)
+{
+	labhelper::Model* sphere = labhelper::loadModelFromOBJ("../scenes/sphere.obj");
+	scenes["Sphere"] = { {
+		                     // Models. The tessellated sphere is only rasterized,
+		                     // the pathtracer traces the exact one below.
+		                     { sphere, mat4(1.f), true },
+		                 },
+		                 {
+		                     // Camera
+		                     vec3(-15, 0, 15),
+		                     normalize(-vec3(-15, 0, 15)),
+		                 },
+		                 {
+		                     // Primitives. With the material of the model, so that
+		                     // it can be edited in the GUI.
+		                     pathtracer::makeSphere(vec3(0.f), 5.f,
+		                                            &sphere->m_materials[sphere->m_meshes[0].m_material_idx]),
+		                 },
+		                 nullptr };
+	scenes["Ship"] = { {
+		                   // Models
+		                   { labhelper::loadModelFromOBJ("../scenes/space-ship.obj"),
+		                     translate(vec3(0.f, 8.f, 0.f)), false },
+		                   { labhelper::loadModelFromOBJ("../scenes/landingpad.obj"), mat4(1.f), false },
+		               },
+		               {
+		                   // Camera
+		                   vec3(-30, 15, 30),
+		                   normalize(-vec3(-30, 8, 30)),
+		               },
+		               {},
+		               nullptr };
+	// Modify the landingpad screen's color
+	scenes["Ship"].models[1].model->m_materials[8].m_color = glm::vec3(0.380392, 0.588235, 0.266667);
+
+	scenes["Refractions"] = { {
+		                          // Models
+		                          { labhelper::loadModelFromOBJ("../scenes/refractions.obj"), mat4(1.f),
+		                            false },
+		                      },
+		                      {
+		                          // Camera
+		                          vec3(7.3, 3.2, 7.2),
+		                          normalize(vec3(-0.43, -0.27, -0.85)),
+		                      },
+		                      {},
+		                      nullptr };
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scenes with a built embree scene, most recently used first
+///////////////////////////////////////////////////////////////////////////////
+static std::list<const scene_t*> built_scenes;
+static size_t scene_cache_budget = size_t(1) << 30;
+
+static void evictScenes()
+{
+	size_t size = getSceneCacheSize();
+	while(size > scene_cache_budget && built_scenes.size() > 1)
+	{
+		const scene_t* scene = built_scenes.back();
+		size -= scene->built->bytes;
+		scene->built.reset();
+		built_scenes.pop_back();
+	}
+}
+
+void buildPathtracerScene(const scene_t& scene)
+{
+	built_scenes.remove(&scene);
+	if(scene.built)
+	{
+		pathtracer::setCurrentScene(scene.built);
+	}
+	else
+	{
+		pathtracer::reinitScene(pathtracer::settings.preview_bvh);
+
+		// Add models to pathtracer scene
+		for(auto& o : scene.models)
+		{
+			if(!o.raster_only)
+			{
+				pathtracer::addModel(o.model, o.modelMat);
+			}
+		}
+		pathtracer::addPrimitives(scene.primitives);
+		pathtracer::buildBVH();
+		scene.built = pathtracer::getCurrentScene();
+	}
+	built_scenes.push_front(&scene);
+	evictScenes();
+	pathtracer::resetGuiding();
+	pathtracer::clearRadianceCache();
+}
+
+void setSceneCacheBudget(size_t bytes)
+{
+	scene_cache_budget = bytes;
+	evictScenes();
+}
+
+size_t getSceneCacheBudget()
+{
+	return scene_cache_budget;
+}
+
+size_t getSceneCacheSize()
+{
+	size_t size = 0;
+	for(const scene_t* scene : built_scenes)
+	{
+		size += scene->built->bytes;
+	}
+	return size;
+}
+
+void cleanupScenes(std::map<std::string, scene_t>& scenes)
+{
+	pathtracer::setCurrentScene(nullptr);
+	built_scenes.clear();
+	for(auto& it : scenes)
+	{
+		it.second.built.reset();
+		for(auto m : it.second.models)
+		{
+			labhelper::freeModel(m.model);
+		}
+	}
+}
+
+void initPathtracerDefaults()
+{
+	///////////////////////////////////////////////////////////////////////////
+	// Initial path-tracer settings
+	///////////////////////////////////////////////////////////////////////////
+	pathtracer::settings.integrator = pathtracer::PathTracing;
+	pathtracer::settings.path_guiding = false;
+	pathtracer::settings.preview_bvh = false;
+	pathtracer::settings.radiance_cache = false;
+	pathtracer::settings.radiance_cache_bounces = 2;
+	pathtracer::settings.specialize_li = true;
+	pathtracer::settings.russian_roulette = true;
+	pathtracer::settings.roulette_depth = 3;
+	pathtracer::settings.split_paths = 1;
+	pathtracer::settings.primary_hit_cache = false;
+	pathtracer::settings.primary_strata = 2;
+	pathtracer::settings.max_bounces = 8;
+	pathtracer::settings.max_paths_per_pixel = 0; // 0 = Infinite
+	pathtracer::settings.numa_first_touch = true;
+#ifdef _DEBUG
+	pathtracer::settings.subsampling = 16;
+#else
+	pathtracer::settings.subsampling = 4;
+#endif
+	pathtracer::settings.dynamic_resolution = true;
+	pathtracer::settings.target_frame_ms = 33.0f;
+	pathtracer::settings.edge_aware_upscaling = true;
+	pathtracer::settings.motion_adaptive = true;
+	pathtracer::settings.motion_max_bounces = 1;
+	pathtracer::settings.motion_subsampling = 2.0f;
+	pathtracer::settings.motion_threshold = 1e-4f;
+	pathtracer::settings.settle_ms = 150.0f;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Set up light sources
+	///////////////////////////////////////////////////////////////////////////
+	pathtracer::point_light.intensity_multiplier = 2500.0f;
+	pathtracer::point_light.color = vec3(1.f, 1.f, 1.f);
+	pathtracer::point_light.position = vec3(10.0f, 25.0f, 20.0f);
+
+	// float intensity_multiplier;
+	// vec3 color;
+	// vec3 position;
+	// vec3 direction;
+	// float radius;
+	/*
+	pathtracer::disc_lights.push_back( pathtracer::DiscLight{
+									   1000,
+									   {1, 0.8, 0},
+									   {-8, 10, 8},
+									   glm::normalize(glm::vec3(10, -2, 10)),
+									   8.0 } );
+	pathtracer::disc_lights.push_back( pathtracer::DiscLight{
+									   1000,
+									   {0.1, 0.3, 1},
+									   {-10, 20, -5},
+									   glm::normalize(-glm::vec3(-10, 20, -5)),
+									   10.0 } );
+	*/
+
+	///////////////////////////////////////////////////////////////////////////
+	// Load environment map
+	///////////////////////////////////////////////////////////////////////////
+	pathtracer::environment.map.load("../scenes/envmaps/001.hdr");
+	pathtracer::buildEnvironmentLookup();
+	pathtracer::environment.multiplier = 1.0f;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Model.h>
+#include "primitives.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Scene definitions, shared by the interactive pathtracer and the headless
+// tools (benchmarks etc.)
+///////////////////////////////////////////////////////////////////////////////
+namespace pathtracer
+{
+struct EmbreeScene;
+}
+
+struct camera_t
+{
+	glm::vec3 position;
+	glm::vec3 direction;
+};
+
+struct scene_t
+{
+	struct scene_object_t
+	{
+		labhelper::Model* model;
+		glm::mat4 modelMat;
+		// Only rasterized (and listed in the GUI), not added to the embree
+		// scene. For models that a primitive stands in for.
+		bool raster_only;
+	};
+	std::vector<scene_object_t> models;
+
+	camera_t camera;
+
+	// Analytic primitives, only traced
+	std::vector<pathtracer::Primitive> primitives;
+
+	// The embree scene built from `models` and `primitives`, kept by buildPathtracerScene()
+	// while it fits in the scene cache budget
+	mutable std::shared_ptr<pathtracer::EmbreeScene> built;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Load the .obj models of all scenes. Needs a GL context.
+///////////////////////////////////////////////////////////////////////////////
+void loadScenes(std::map<std::string, scene_t>& scenes);
+
+///////////////////////////////////////////////////////////////////////////////
+// Make a scene the pathtracer's: add its models and primitives to a fresh
+// embree scene and build the BVH, or switch back to the one built before if
+// it was kept.
+// Built scenes are kept while they fit in the budget, the least recently
+// used are deleted first (the current one is always kept).
+///////////////////////////////////////////////////////////////////////////////
+void buildPathtracerScene(const scene_t& scene);
+
+void setSceneCacheBudget(size_t bytes);
+size_t getSceneCacheBudget();
+// Memory used by the kept scenes, including the current one
+size_t getSceneCacheSize();
+
+///////////////////////////////////////////////////////////////////////////////
+// Free the models loaded by loadScenes()
+///////////////////////////////////////////////////////////////////////////////
+void cleanupScenes(std::map<std::string, scene_t>& scenes);
+
+///////////////////////////////////////////////////////////////////////////////
+// Default settings, point light and environment map of the pathtracer
+///////////////////////////////////////////////////////////////////////////////
+void initPathtracerDefaults();
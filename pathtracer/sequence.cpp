@@ -0,0 +1,279 @@
+///////////////////////////////////////////////////////////////////////////
+// pathtracer_sequence: renders an animation of a static scene, a camera
+// moving along a path (a turntable or a fly-through), to numbered PFM
+// files.
+//
+// Usage: pathtracer_sequence [--scene name] [--frames N] [--orbit degrees]
+//            [--path file] [--size WxH] [--spp N] [--bounces N]
+//            [--fov degrees] [--concurrent N] [--seed N] [--out prefix]
+//
+// Without --path the camera of the scene turns around the y axis, by
+// `orbit` degrees (default 360) over the whole sequence. A path file has
+// one keyframe per line, "px py pz dx dy dz" (position and direction,
+// lines starting with # are skipped); the keyframes are spread evenly over
+// the frames, and the camera is interpolated linearly between them.
+// Frame i is written to <prefix><i, 4 digits>.pfm (default prefix frame).
+//
+// The scene is built once and every frame traces against it. Rendering
+// the frames one after the other leaves cores idle at the end of every
+// pass, waiting for the slowest rows of a frame, so `concurrent` frames
+// (default 4) render together: each pass traces one sample of all of them
+// in a single loop over all their rows (see tracePaths(views)). A frame is
+// the same as if rendered alone with the same seed. Finished frames are
+// written by another thread while the next ones render.
+///////////////////////////////////////////////////////////////////////////
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <labhelper.h>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "pfm.h"
+#include "sampling.h"
+#include "scenes.h"
+
+using namespace glm;
+using namespace std;
+
+namespace
+{
+struct SequenceOptions
+{
+	string scene = "Ship";
+	int frames = 36;
+	float orbit = 360.0f;
+	string path;
+	int width = 640, height = 480;
+	int spp = 64;
+	int max_bounces = -1; // -1: the default
+	float fov = 45.0f;
+	int concurrent = 4;
+	uint32_t seed = 1;
+	string out = "frame";
+};
+SequenceOptions options;
+
+///////////////////////////////////////////////////////////////////////////
+// The camera of each frame
+///////////////////////////////////////////////////////////////////////////
+bool readPath(const string& filename, vector<camera_t>& keyframes)
+{
+	ifstream file(filename);
+	if(!file)
+		return false;
+	string line;
+	while(getline(file, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+		istringstream fields(line);
+		camera_t c;
+		if(!(fields >> c.position.x >> c.position.y >> c.position.z >> c.direction.x >> c.direction.y
+		     >> c.direction.z))
+			return false;
+		c.direction = normalize(c.direction);
+		keyframes.push_back(c);
+	}
+	return !keyframes.empty();
+}
+
+camera_t frameCamera(const scene_t& scene, const vector<camera_t>& keyframes, int frame)
+{
+	if(keyframes.empty())
+	{
+		// Turntable. The last frame is one step short of `orbit`, so that a
+		// full turn loops.
+		const float angle = radians(options.orbit) * float(frame) / float(options.frames);
+		const mat3 rotation = mat3(rotate(angle, vec3(0.0f, 1.0f, 0.0f)));
+		camera_t c;
+		c.position = rotation * scene.camera.position;
+		c.direction = rotation * scene.camera.direction;
+		return c;
+	}
+	const float t = options.frames > 1 ? float(frame) / float(options.frames - 1) : 0.0f;
+	const float k = t * float(keyframes.size() - 1);
+	const int i = std::min(int(k), int(keyframes.size()) - 1);
+	const int j = std::min(i + 1, int(keyframes.size()) - 1);
+	camera_t c;
+	c.position = mix(keyframes[i].position, keyframes[j].position, k - float(i));
+	c.direction = normalize(mix(keyframes[i].direction, keyframes[j].direction, k - float(i)));
+	return c;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Frames waiting to be written, written by their own thread so that
+// rendering goes on meanwhile
+///////////////////////////////////////////////////////////////////////////
+mutex writer_mutex;
+condition_variable writer_changed;
+deque<pair<string, pathtracer::Image>> to_write;
+bool rendering_done = false;
+int write_failures = 0;
+
+void writeFrames()
+{
+	unique_lock<mutex> lock(writer_mutex);
+	for(;;)
+	{
+		writer_changed.wait(lock, [] { return !to_write.empty() || rendering_done; });
+		if(to_write.empty())
+			return;
+		pair<string, pathtracer::Image> frame = std::move(to_write.front());
+		to_write.pop_front();
+		lock.unlock();
+		const pathtracer::Image& image = frame.second;
+		const bool ok = writePFM(frame.first, image.width, image.height, &image.data[0]);
+		cout << (ok ? "wrote " : "could not write ") << frame.first << endl;
+		lock.lock();
+		write_failures += ok ? 0 : 1;
+	}
+}
+
+void write(const string& filename, pathtracer::Image& image)
+{
+	lock_guard<mutex> lock(writer_mutex);
+	to_write.push_back(make_pair(filename, pathtracer::Image()));
+	std::swap(to_write.back().second, image);
+	writer_changed.notify_one();
+}
+
+string frameFilename(int frame)
+{
+	char number[16];
+	snprintf(number, sizeof(number), "%04d", frame);
+	return options.out + number + ".pfm";
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Render all frames, `concurrent` at a time
+///////////////////////////////////////////////////////////////////////////
+int render(const scene_t& scene, const vector<camera_t>& keyframes)
+{
+	typedef chrono::high_resolution_clock clock;
+	pathtracer::settings.subsampling = 1;
+	pathtracer::settings.max_paths_per_pixel = 0;
+	pathtracer::settings.integrator = pathtracer::PathTracing;
+	if(options.max_bounces >= 0)
+		pathtracer::settings.max_bounces = options.max_bounces;
+	pathtracer::seedRandom(options.seed);
+	buildPathtracerScene(scene);
+
+	thread writer(writeFrames);
+	const float aspect = float(options.width) / float(options.height);
+	const mat4 P = perspective(radians(options.fov), aspect, 0.1f, 100.0f);
+	auto start = clock::now();
+	for(int first = 0; first < options.frames; first += options.concurrent)
+	{
+		auto group_start = clock::now();
+		vector<pathtracer::View> views(std::min(options.concurrent, options.frames - first));
+		for(size_t i = 0; i < views.size(); i++)
+		{
+			const camera_t c = frameCamera(scene, keyframes, first + int(i));
+			views[i].V = lookAt(c.position, c.position + c.direction, vec3(0.0f, 1.0f, 0.0f));
+			views[i].P = P;
+			views[i].image.width = options.width;
+			views[i].image.height = options.height;
+			views[i].image.data.assign(size_t(options.width) * options.height, vec3(0.0f));
+		}
+		for(int s = 0; s < options.spp; s++)
+			pathtracer::tracePaths(views, s);
+		for(size_t i = 0; i < views.size(); i++)
+			write(frameFilename(first + int(i)), views[i].image);
+		const double seconds = chrono::duration<double>(clock::now() - group_start).count();
+		printf("frames %d-%d: %.2f s\n", first, first + int(views.size()) - 1, seconds);
+		fflush(stdout);
+	}
+	{
+		lock_guard<mutex> lock(writer_mutex);
+		rendering_done = true;
+		writer_changed.notify_one();
+	}
+	writer.join();
+	const double seconds = chrono::duration<double>(clock::now() - start).count();
+	printf("%d frames: %.2f s, %.2f s per frame\n", options.frames, seconds, seconds / options.frames);
+	return write_failures == 0 ? 0 : 1;
+}
+
+void usage()
+{
+	cout << "Usage: pathtracer_sequence [--scene name] [--frames N] [--orbit degrees]\n"
+	        "           [--path file] [--size WxH] [--spp N] [--bounces N]\n"
+	        "           [--fov degrees] [--concurrent N] [--seed N] [--out prefix]\n";
+	exit(1);
+}
+
+void parseArguments(int argc, char* argv[])
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+			usage();
+		string value = argv[++i];
+		bool ok = true;
+		if(arg == "--scene")
+			options.scene = value;
+		else if(arg == "--frames")
+			ok = (options.frames = atoi(value.c_str())) > 0;
+		else if(arg == "--orbit")
+			options.orbit = float(atof(value.c_str()));
+		else if(arg == "--path")
+			options.path = value;
+		else if(arg == "--size")
+			ok = sscanf(value.c_str(), "%dx%d", &options.width, &options.height) == 2 && options.width > 0
+			     && options.height > 0;
+		else if(arg == "--spp")
+			ok = (options.spp = atoi(value.c_str())) > 0;
+		else if(arg == "--bounces")
+			ok = (options.max_bounces = atoi(value.c_str())) >= 0;
+		else if(arg == "--fov")
+			ok = (options.fov = float(atof(value.c_str()))) > 0.0f && options.fov < 180.0f;
+		else if(arg == "--concurrent")
+			ok = (options.concurrent = atoi(value.c_str())) > 0;
+		else if(arg == "--seed")
+			options.seed = uint32_t(strtoul(value.c_str(), nullptr, 10));
+		else if(arg == "--out")
+			options.out = value;
+		else
+			ok = false;
+		if(!ok)
+			usage();
+	}
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	parseArguments(argc, argv);
+	vector<camera_t> keyframes;
+	if(!options.path.empty() && !readPath(options.path, keyframes))
+	{
+		cerr << "Could not read the camera path " << options.path << endl;
+		return 1;
+	}
+	// Models are uploaded to GL when loaded, so we need a (hidden) context
+	SDL_Window* window = labhelper::init_window_SDL("pathtracer_sequence", 64, 64, true);
+	initPathtracerDefaults();
+	std::map<std::string, scene_t> scenes;
+	loadScenes(scenes);
+	int result = 1;
+	if(scenes.count(options.scene))
+		result = render(scenes[options.scene], keyframes);
+	else
+		cerr << "Unknown scene " << options.scene << endl;
+	cleanupScenes(scenes);
+	labhelper::shutDown(window);
+	return result;
+}
@@ -0,0 +1,514 @@
+///////////////////////////////////////////////////////////////////////////
+// pathtracer_server: a long-lived render process for many small jobs
+// (turntables, material variants...). The models of all scenes are loaded
+// once at startup and built embree scenes are kept between jobs (see
+// buildPathtracerScene()), so a job only pays for its samples.
+//
+// Usage: pathtracer_server [--interleave N] [--scene-cache MB]
+//
+// Jobs are read from stdin, one command per line, and the server answers
+// on stdout, one line per event. Put it behind a pipe, or a UNIX socket
+// with e.g. `socat UNIX-LISTEN:/tmp/pathtracer.sock,fork EXEC:...` if the
+// pipeline wants to connect to it. Commands:
+//
+//   render id=<name> scene=<name> [size=WxH] [spp=N] [seconds=S]
+//          [bounces=N] [integrator=pt|bdpt|sppm] [seed=N] [update=N]
+//          [camera=px,py,pz,dx,dy,dz] [fov=degrees] [light=multiplier]
+//          [environment=multiplier] [out=file.pfm]
+//          [material:<material name>.<field>=value ...]
+//   cancel id=<name>
+//   quit
+//
+// A job renders until it has `spp` samples per pixel or has been rendered
+// for `seconds` (0 = no limit). <field> is one of color, emission (r,g,b),
+// shininess, metalness, fresnel, transparency or ior; the override applies
+// to every material of that name in the scene, while the job's passes
+// render. Answers:
+//
+//   ready                           (once the scenes are loaded)
+//   accepted <id>
+//   progress <id> <spp> <seconds>   (every `update` samples, with `out`
+//                                    rewritten)
+//   done <id> <spp> <seconds> <out>
+//   cancelled <id>
+//   error <id> <message>
+//
+// Jobs are queued in the order they came in, and up to `interleave` of
+// them are active. The active jobs take turns pass by pass, one pass at a
+// time on the main thread, each with its own render context (see
+// swapRenderContext()); each pass of tracePaths() already uses every
+// core. A small job then finishes without waiting for a large one ahead
+// of it.
+// Since the random numbers of a sample only depend on the seed, the pixel
+// and the sample index, a job's image does not depend on what else was
+// rendering.
+//
+// At the end of stdin the server finishes the jobs it has and exits.
+///////////////////////////////////////////////////////////////////////////
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <labhelper.h>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "pfm.h"
+#include "sampling.h"
+#include "scenes.h"
+
+using namespace glm;
+using namespace std;
+
+namespace
+{
+struct ServerOptions
+{
+	int interleave = 2;
+	int scene_cache_mb = 2048;
+};
+ServerOptions options;
+
+///////////////////////////////////////////////////////////////////////////
+// Commands, read from stdin by their own thread so that jobs can be
+// queued and cancelled while others render
+///////////////////////////////////////////////////////////////////////////
+mutex commands_mutex;
+condition_variable commands_changed;
+deque<string> commands;
+bool input_closed = false;
+
+void readCommands()
+{
+	string line;
+	while(getline(cin, line))
+	{
+		lock_guard<mutex> lock(commands_mutex);
+		commands.push_back(line);
+		commands_changed.notify_one();
+	}
+	lock_guard<mutex> lock(commands_mutex);
+	input_closed = true;
+	commands_changed.notify_one();
+}
+
+void answer(const string& line)
+{
+	cout << line << endl;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Jobs
+///////////////////////////////////////////////////////////////////////////
+struct MaterialOverride
+{
+	float* field; // into a labhelper::Material of the scene's models
+	int size;     // floats
+	vec3 value;
+	vec3 saved;   // while applied
+};
+
+struct ServerJob
+{
+	string id;
+	string scene_name;
+	const scene_t* scene;
+	string out;
+	int spp = 64;
+	double seconds = 0.0;
+	int update_every = 16;
+	mat4 V, P;
+	vector<MaterialOverride> overrides;
+	bool overrides_emission = false; // lights are collected again around each pass
+	pathtracer::RenderContext context;
+	double render_seconds = 0.0;
+};
+
+std::map<std::string, scene_t> scenes;
+// Settings, lights and environment after initPathtracerDefaults(), that
+// every job starts from
+pathtracer::RenderContext defaults;
+
+// The parameter of a material that a job may override
+float* materialField(labhelper::Material& m, const string& field, int& size)
+{
+	size = 3;
+	if(field == "color")
+		return &m.m_color.x;
+	if(field == "emission")
+		return &m.m_emission.x;
+	size = 1;
+	if(field == "shininess")
+		return &m.m_shininess;
+	if(field == "metalness")
+		return &m.m_metalness;
+	if(field == "fresnel")
+		return &m.m_fresnel;
+	if(field == "transparency")
+		return &m.m_transparency;
+	if(field == "ior")
+		return &m.m_ior;
+	return nullptr;
+}
+
+// Comma separated floats
+bool parseFloats(const string& text, float* values, int count)
+{
+	stringstream ss(text);
+	for(int i = 0; i < count; i++)
+	{
+		string item;
+		if(!getline(ss, item, ','))
+			return false;
+		char* end;
+		values[i] = strtof(item.c_str(), &end);
+		if(end == item.c_str() || *end != '\0')
+			return false;
+	}
+	string rest;
+	return !getline(ss, rest, ',');
+}
+
+bool addOverride(ServerJob& job, const string& key, const string& value, string& error)
+{
+	// key is material:<name>.<field>
+	const size_t dot = key.rfind('.');
+	if(dot == string::npos || dot <= 9)
+	{
+		error = "expected material:<name>.<field>, got " + key;
+		return false;
+	}
+	const string name = key.substr(9, dot - 9);
+	const string field = key.substr(dot + 1);
+	labhelper::Material probe;
+	int size;
+	if(!materialField(probe, field, size))
+	{
+		error = "unknown material field " + field;
+		return false;
+	}
+	vec3 v;
+	if(!parseFloats(value, &v.x, size))
+	{
+		error = "expected " + to_string(size) + " numbers for " + key;
+		return false;
+	}
+	bool found = false;
+	for(const auto& o : job.scene->models)
+	{
+		for(labhelper::Material& m : o.model->m_materials)
+		{
+			if(m.m_name == name)
+			{
+				job.overrides.push_back({ materialField(m, field, size), size, v, vec3(0.0f) });
+				job.overrides_emission |= field == "emission";
+				found = true;
+			}
+		}
+	}
+	if(!found)
+		error = "no material " + name + " in scene " + job.scene_name;
+	return found;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Parse the arguments of a render command into a job that is ready to
+// render, with its image sized
+///////////////////////////////////////////////////////////////////////////
+bool makeJob(istream& arguments, ServerJob& job, string& error)
+{
+	std::map<string, string> values;
+	vector<pair<string, string>> materials;
+	string token;
+	while(arguments >> token)
+	{
+		const size_t equals = token.find('=');
+		if(equals == string::npos)
+		{
+			error = "expected key=value, got " + token;
+			return false;
+		}
+		const string key = token.substr(0, equals), value = token.substr(equals + 1);
+		if(key.compare(0, 9, "material:") == 0)
+			materials.push_back(make_pair(key, value));
+		else
+			values[key] = value;
+	}
+	job.id = values["id"];
+	if(job.id.empty())
+	{
+		error = "missing id";
+		return false;
+	}
+	job.scene_name = values["scene"];
+	auto scene = scenes.find(job.scene_name);
+	if(scene == scenes.end())
+	{
+		error = "unknown scene " + job.scene_name;
+		return false;
+	}
+	job.scene = &scene->second;
+	job.out = values.count("out") ? values["out"] : job.id + ".pfm";
+
+	job.context = defaults;
+	pathtracer::Settings& settings = job.context.settings;
+	settings.subsampling = 1;
+	settings.max_paths_per_pixel = 0;
+	// Learned state would be forgotten between the passes of jobs that
+	// take turns, see swapRenderContext()
+	settings.path_guiding = false;
+	settings.radiance_cache = false;
+	settings.primary_hit_cache = false;
+	int width = 256, height = 256;
+	uint32_t seed = 1;
+	float fov = 45.0f;
+	camera_t camera = job.scene->camera;
+	bool ok = true;
+	for(const auto& kv : values)
+	{
+		const string& key = kv.first;
+		const char* value = kv.second.c_str();
+		if(key == "id" || key == "scene" || key == "out" || key == "camera")
+			continue;
+		else if(key == "size")
+			ok = sscanf(value, "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+		else if(key == "spp")
+			ok = (job.spp = atoi(value)) > 0;
+		else if(key == "seconds")
+			ok = (job.seconds = atof(value)) >= 0.0;
+		else if(key == "update")
+			ok = (job.update_every = atoi(value)) > 0;
+		else if(key == "bounces")
+			ok = (settings.max_bounces = atoi(value)) >= 0;
+		else if(key == "seed")
+			seed = uint32_t(strtoul(value, nullptr, 10));
+		else if(key == "fov")
+			ok = (fov = float(atof(value))) > 0.0f && fov < 180.0f;
+		else if(key == "light")
+			job.context.point_light.intensity_multiplier = float(atof(value));
+		else if(key == "environment")
+			job.context.environment_multiplier = float(atof(value));
+		else if(key == "integrator")
+		{
+			if(kv.second == "pt")
+				settings.integrator = pathtracer::PathTracing;
+			else if(kv.second == "bdpt")
+				settings.integrator = pathtracer::Bidirectional;
+			else if(kv.second == "sppm")
+				settings.integrator = pathtracer::PhotonMapping;
+			else
+				ok = false;
+		}
+		else
+		{
+			error = "unknown key " + key;
+			return false;
+		}
+		if(!ok)
+		{
+			error = "bad value for " + key + ": " + kv.second;
+			return false;
+		}
+	}
+	if(values.count("camera"))
+	{
+		float c[6];
+		if(!parseFloats(values["camera"], c, 6))
+		{
+			error = "expected camera=px,py,pz,dx,dy,dz";
+			return false;
+		}
+		camera.position = vec3(c[0], c[1], c[2]);
+		camera.direction = normalize(vec3(c[3], c[4], c[5]));
+	}
+	for(const auto& m : materials)
+	{
+		if(!addOverride(job, m.first, m.second, error))
+			return false;
+	}
+
+	job.V = lookAt(camera.position, camera.position + camera.direction, vec3(0.0f, 1.0f, 0.0f));
+	job.P = perspective(radians(fov), float(width) / float(height), 0.1f, 100.0f);
+	// Size the image and seed with the job's context current
+	pathtracer::swapRenderContext(job.context);
+	pathtracer::resize(width, height);
+	pathtracer::seedRandom(seed);
+	pathtracer::swapRenderContext(job.context);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Render one pass of a job. Returns true when the job is done.
+///////////////////////////////////////////////////////////////////////////
+const scene_t* current_scene = nullptr;
+
+bool renderPass(ServerJob& job)
+{
+	typedef chrono::high_resolution_clock clock;
+	auto start = clock::now();
+	if(job.scene != current_scene)
+	{
+		buildPathtracerScene(*job.scene);
+		current_scene = job.scene;
+	}
+	for(MaterialOverride& o : job.overrides)
+	{
+		memcpy(&o.saved.x, o.field, o.size * sizeof(float));
+		memcpy(o.field, &o.value.x, o.size * sizeof(float));
+	}
+	// Meshes may have become light sources or stopped being them, which
+	// bidirectional and photon mapping jobs sample
+	if(job.overrides_emission)
+		pathtracer::updateEmissiveTriangles();
+	pathtracer::swapRenderContext(job.context);
+	pathtracer::tracePaths(job.V, job.P, pathtracer::rendered_image.number_of_samples);
+	pathtracer::swapRenderContext(job.context);
+	// In reverse, in case a field was overridden twice
+	for(auto o = job.overrides.rbegin(); o != job.overrides.rend(); ++o)
+		memcpy(o->field, &o->saved.x, o->size * sizeof(float));
+	if(job.overrides_emission)
+		pathtracer::updateEmissiveTriangles();
+	job.render_seconds += chrono::duration<double>(clock::now() - start).count();
+
+	const pathtracer::Image& image = job.context.image;
+	const bool done =
+	    image.number_of_samples >= job.spp || (job.seconds > 0.0 && job.render_seconds >= job.seconds);
+	if(done || image.number_of_samples % job.update_every == 0)
+	{
+		if(!writePFM(job.out, image.width, image.height, &image.data[0]))
+			answer("error " + job.id + " could not write " + job.out);
+		answer((done ? "done " : "progress ") + job.id + " " + to_string(image.number_of_samples) + " "
+		       + to_string(job.render_seconds) + (done ? " " + job.out : ""));
+	}
+	return done;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The main loop: take commands, then render a pass of every active job
+///////////////////////////////////////////////////////////////////////////
+int serve()
+{
+	list<ServerJob> waiting, active;
+	thread reader(readCommands);
+	// Nothing interrupts the blocking read, so the reader is left to end
+	// with the process
+	reader.detach();
+	bool quit = false;
+	while(!quit)
+	{
+		deque<string> received;
+		{
+			unique_lock<mutex> lock(commands_mutex);
+			while(commands.empty() && active.empty() && waiting.empty() && !input_closed)
+				commands_changed.wait(lock);
+			received.swap(commands);
+			if(input_closed && received.empty() && active.empty() && waiting.empty())
+				break;
+		}
+		for(const string& line : received)
+		{
+			istringstream ss(line);
+			string command;
+			if(!(ss >> command))
+				continue;
+			if(command == "render")
+			{
+				waiting.push_back(ServerJob());
+				string error;
+				if(makeJob(ss, waiting.back(), error))
+					answer("accepted " + waiting.back().id);
+				else
+				{
+					answer("error " + (waiting.back().id.empty() ? "-" : waiting.back().id) + " " + error);
+					waiting.pop_back();
+				}
+			}
+			else if(command == "cancel")
+			{
+				string token;
+				ss >> token;
+				const string id = token.compare(0, 3, "id=") == 0 ? token.substr(3) : token;
+				size_t before = waiting.size() + active.size();
+				waiting.remove_if([&](const ServerJob& j) { return j.id == id; });
+				active.remove_if([&](const ServerJob& j) { return j.id == id; });
+				if(waiting.size() + active.size() < before)
+					answer("cancelled " + id);
+				else
+					answer("error " + id + " no such job");
+			}
+			else if(command == "quit")
+			{
+				quit = true;
+			}
+			else
+			{
+				answer("error - unknown command " + command);
+			}
+		}
+		if(quit)
+			break;
+		while(int(active.size()) < options.interleave && !waiting.empty())
+			active.splice(active.end(), waiting, waiting.begin());
+		for(auto job = active.begin(); job != active.end();)
+		{
+			if(renderPass(*job))
+				job = active.erase(job);
+			else
+				++job;
+		}
+	}
+	return 0;
+}
+
+void usage()
+{
+	cout << "Usage: pathtracer_server [--interleave N] [--scene-cache MB]\n"
+	        "Reads render/cancel/quit commands from stdin, see server.cpp\n";
+	exit(1);
+}
+
+void parseArguments(int argc, char* argv[])
+{
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(i + 1 >= argc)
+			usage();
+		string value = argv[++i];
+		if(arg == "--interleave")
+			options.interleave = std::max(1, atoi(value.c_str()));
+		else if(arg == "--scene-cache")
+			options.scene_cache_mb = std::max(0, atoi(value.c_str()));
+		else
+			usage();
+	}
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	parseArguments(argc, argv);
+	// Models are uploaded to GL when loaded, so we need a (hidden) context
+	SDL_Window* window = labhelper::init_window_SDL("pathtracer_server", 64, 64, true);
+	initPathtracerDefaults();
+	setSceneCacheBudget(size_t(options.scene_cache_mb) << 20);
+	loadScenes(scenes);
+	defaults = pathtracer::currentRenderContext();
+	answer("ready");
+	int result = serve();
+	cleanupScenes(scenes);
+	labhelper::shutDown(window);
+	return result;
+}
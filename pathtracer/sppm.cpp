@@ -0,0 +1,402 @@
+#include "sppm.h"
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+#include <labhelper.h>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "lights.h"
+#include "material.h"
+#include "sampling.h"
+#include "stats.h"
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+SPPMState sppm_state;
+
+namespace
+{
+// Fraction of the photons a pixel keeps each pass (alpha in the paper)
+const float ALPHA = 2.0f / 3.0f;
+// Initial radius, in pixel footprints at the visible point
+const float INITIAL_RADIUS = 2.0f;
+// Keeps the random sequences of photons apart from those of the pixels
+const uint32_t PHOTON_SEED_BIT = 0x80000000u;
+
+
+inline float luminance(const vec3& c)
+{
+	return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Hash grid of the visible points. Every point is listed under each cell
+// its radius overlaps, sorted by the hash of the cell (a counting sort),
+// so a photon reads one contiguous range.
+///////////////////////////////////////////////////////////////////////////
+struct Grid
+{
+	vec3 lo;
+	float cell_size;
+	ivec3 resolution;
+	vector<int> offsets; // size + 1, into entries
+	vector<int> entries; // pixels
+};
+Grid grid;
+
+inline uint32_t hashCell(const ivec3& c, uint32_t size)
+{
+	return ((uint32_t(c.x) * 73856093u) ^ (uint32_t(c.y) * 19349663u) ^ (uint32_t(c.z) * 83492791u)) % size;
+}
+
+inline ivec3 cellOf(const vec3& p)
+{
+	ivec3 c = ivec3((p - grid.lo) / grid.cell_size);
+	return clamp(c, ivec3(0), grid.resolution - 1);
+}
+
+void buildGrid()
+{
+	vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	float max_radius = 0.0f;
+	for(const SPPMPixel& px : sppm_state.pixels)
+	{
+		if(!px.has_vp)
+			continue;
+		lo = min(lo, px.vp.p - px.radius);
+		hi = max(hi, px.vp.p + px.radius);
+		max_radius = std::max(max_radius, px.radius);
+	}
+	grid.entries.clear();
+	if(max_radius <= 0.0f)
+		return;
+	grid.lo = lo;
+	grid.cell_size = max_radius;
+	grid.resolution = max(ivec3(1), ivec3(ceil((hi - lo) / max_radius)));
+
+	const int size = int(sppm_state.pixels.size());
+	vector<int> counts(size, 0);
+#pragma omp parallel for schedule(static)
+	for(int i = 0; i < size; i++)
+	{
+		const SPPMPixel& px = sppm_state.pixels[i];
+		if(!px.has_vp)
+			continue;
+		ivec3 c0 = cellOf(px.vp.p - px.radius), c1 = cellOf(px.vp.p + px.radius);
+		for(int z = c0.z; z <= c1.z; z++)
+			for(int y = c0.y; y <= c1.y; y++)
+				for(int x = c0.x; x <= c1.x; x++)
+				{
+					uint32_t h = hashCell(ivec3(x, y, z), size);
+#pragma omp atomic
+					counts[h]++;
+				}
+	}
+	grid.offsets.resize(size + 1);
+	grid.offsets[0] = 0;
+	for(int h = 0; h < size; h++)
+		grid.offsets[h + 1] = grid.offsets[h] + counts[h];
+	grid.entries.resize(grid.offsets[size]);
+	// counts becomes the next free slot of each hash
+	copy(grid.offsets.begin(), grid.offsets.end() - 1, counts.begin());
+#pragma omp parallel for schedule(static)
+	for(int i = 0; i < size; i++)
+	{
+		const SPPMPixel& px = sppm_state.pixels[i];
+		if(!px.has_vp)
+			continue;
+		ivec3 c0 = cellOf(px.vp.p - px.radius), c1 = cellOf(px.vp.p + px.radius);
+		for(int z = c0.z; z <= c1.z; z++)
+			for(int y = c0.y; y <= c1.y; y++)
+				for(int x = c0.x; x <= c1.x; x++)
+				{
+					uint32_t h = hashCell(ivec3(x, y, z), size);
+					int slot;
+#pragma omp atomic capture
+					slot = counts[h]++;
+					grid.entries[slot] = i;
+				}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A photon with flux beta arrived at p from direction wi
+///////////////////////////////////////////////////////////////////////////
+void deposit(const vec3& p, const vec3& wi, const vec3& beta)
+{
+	if(grid.entries.empty())
+		return;
+	vec3 cell = (p - grid.lo) / grid.cell_size;
+	if(any(lessThan(cell, vec3(0.0f))) || any(greaterThanEqual(cell, vec3(grid.resolution))))
+		return;
+	uint32_t h = hashCell(ivec3(cell), uint32_t(sppm_state.pixels.size()));
+	for(int k = grid.offsets[h]; k < grid.offsets[h + 1]; k++)
+	{
+		SPPMPixel& px = sppm_state.pixels[grid.entries[k]];
+		vec3 d = px.vp.p - p;
+		if(dot(d, d) > px.radius * px.radius)
+			continue;
+		Diffuse diffuse(px.vp.color);
+		vec3 phi = beta * diffuse.f(wi, px.vp.wo, px.vp.n);
+		if(phi == vec3(0.0f))
+			continue;
+#pragma omp atomic
+		px.phi.x += phi.x;
+#pragma omp atomic
+		px.phi.y += phi.y;
+#pragma omp atomic
+		px.phi.z += phi.z;
+#pragma omp atomic
+		px.M++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Follow the camera path of a pixel through glass to its first diffuse
+// hit. Adds the same emission, environment and direct light as Li() on
+// the way.
+///////////////////////////////////////////////////////////////////////////
+void traceCameraPath(Ray ray, float footprint, SPPMPixel& px)
+{
+	vec3 beta(1.0f);
+	float distance = 0.0f;
+	px.has_vp = false;
+	stats::local().camera_rays++;
+	int bounces = 0;
+	for(;; bounces++)
+	{
+		// As in Li(), the environment is still seen after the last bounce
+		if(!intersect(ray))
+		{
+			px.Ld += beta * Lenvironment(ray.d);
+			break;
+		}
+		if(bounces >= settings.max_bounces)
+			break;
+		Intersection hit = getIntersection(ray);
+		distance += ray.tfar;
+		GlassBTDF glass(hit.material->m_ior);
+		Diffuse diffuse(hit.material->m_color);
+		BTDFLinearBlend glassblend(hit.material->m_transparency, &glass, &diffuse);
+
+		const float distance_to_light = length(point_light.position - hit.position);
+		Ray shadow_ray;
+		shadow_ray.o = hit.position + EPSILON * hit.shading_normal;
+		shadow_ray.d = (point_light.position - hit.position) / distance_to_light;
+		// Unlike Li(), stop at the light: photons aren't blocked by what is
+		// behind it either
+		shadow_ray.tfar = distance_to_light;
+		if(!occluded(shadow_ray))
+		{
+			stats::ScopedCycles timer(stats::Shading);
+			vec3 Li = point_light.intensity_multiplier * point_light.color
+			          / (distance_to_light * distance_to_light);
+			vec3 wi = shadow_ray.d;
+			px.Ld += beta * glassblend.f(wi, hit.wo, hit.shading_normal) * Li
+			         * std::max(0.0f, dot(wi, hit.shading_normal));
+		}
+		px.Ld += beta * hit.material->m_emission;
+
+		// The diffuse lobe is picked with probability 1 - m_transparency,
+		// which cancels its weight in the blend
+		if(randf() >= hit.material->m_transparency)
+		{
+			px.vp = { hit.position, hit.shading_normal, hit.wo, beta, hit.material->m_color };
+			px.has_vp = true;
+			if(px.radius == 0.0f)
+				px.radius = INITIAL_RADIUS * footprint * distance;
+			bounces++;
+			break;
+		}
+		WiSample r;
+		{
+			stats::ScopedCycles timer(stats::Shading);
+			r = glass.sample_wi(hit.wo, hit.shading_normal);
+		}
+		if(r.pdf < EPSILON)
+		{
+			stats::local().pdf_terminations++;
+			bounces++;
+			break;
+		}
+		beta *= r.f * abs(dot(r.wi, hit.shading_normal)) / r.pdf;
+		ray = Ray();
+		ray.o = hit.position + (dot(r.wi, hit.geometry_normal) < 0.0f ? -EPSILON : EPSILON) * hit.geometry_normal;
+		ray.d = r.wi;
+		stats::local().extension_rays++;
+	}
+	stats::recordDepth(bounces);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Photons come from the lights and from the environment, the latter
+// entering the scene's bounding sphere through a disc facing the photon.
+///////////////////////////////////////////////////////////////////////////
+float environmentPower(float radius)
+{
+	// Average radiance over a fixed set of directions
+	const int N = 256;
+	float sum = 0.0f;
+	for(int i = 0; i < N; i++)
+	{
+		float z = 1.0f - (2.0f * i + 1.0f) / N;
+		float r = sqrt(std::max(0.0f, 1.0f - z * z));
+		float phi = i * 2.39996323f;
+		sum += luminance(Lenvironment(vec3(r * cos(phi), r * sin(phi), z)));
+	}
+	return sum / N * 4.0f * M_PI * M_PI * radius * radius;
+}
+
+void tracePhoton(float environment_probability, const vec3& center, float radius)
+{
+	Ray ray;
+	vec3 beta;
+	// Light from the point light that reaches a surface directly is
+	// already counted by the camera paths
+	bool deposit_direct = true;
+	if(randf() < environment_probability)
+	{
+		vec3 w = uniformSampleSphere();
+		vec2 disc = concentricSampleDisk() * radius;
+		ray.o = center - w * radius + labhelper::tangentSpace(w) * vec3(disc, 0.0f);
+		ray.d = w;
+		// pdf = probability * 1 / (pi r^2) * 1 / (4 pi)
+		beta = Lenvironment(-w) * (4.0f * M_PI * M_PI * radius * radius / environment_probability);
+	}
+	else
+	{
+		float light_pdf;
+		int light = sampleLight(randf(), light_pdf);
+		if(light < 0)
+			return;
+		vec3 p, n, w, Le;
+		float pdf_pos, pdf_dir;
+		if(!sampleLe(lights[light], p, n, w, Le, pdf_pos, pdf_dir))
+			return;
+		float pdf = (1.0f - environment_probability) * light_pdf * pdf_pos * pdf_dir;
+		beta = Le / pdf;
+		if(n != vec3(0.0f))
+		{
+			beta *= abs(dot(n, w));
+			p += (dot(w, n) < 0.0f ? -EPSILON : EPSILON) * n;
+		}
+		ray.o = p;
+		ray.d = w;
+		deposit_direct = lights[light].type != PointLightSource;
+	}
+
+	for(int depth = 0; depth < settings.max_bounces; depth++)
+	{
+		stats::local().extension_rays++;
+		if(!intersect(ray))
+			return;
+		Intersection hit = getIntersection(ray);
+		if(depth > 0 || deposit_direct)
+			deposit(hit.position, hit.wo, beta);
+
+		WiSample r;
+		{
+			stats::ScopedCycles timer(stats::Shading);
+			if(randf() < hit.material->m_transparency)
+				r = GlassBTDF(hit.material->m_ior).sample_wi(hit.wo, hit.shading_normal);
+			else
+				r = Diffuse(hit.material->m_color).sample_wi(hit.wo, hit.shading_normal);
+		}
+		if(r.pdf < EPSILON)
+			return;
+		vec3 next_beta = beta * r.f * abs(dot(r.wi, hit.shading_normal)) / r.pdf;
+		// Russian roulette, so that photons keep about the same flux
+		float q = std::max(0.0f, 1.0f - luminance(next_beta) / luminance(beta));
+		if(randf() < q)
+			return;
+		beta = next_beta / (1.0f - q);
+		ray = Ray();
+		ray.o = hit.position + (dot(r.wi, hit.geometry_normal) < 0.0f ? -EPSILON : EPSILON) * hit.geometry_normal;
+		ray.d = r.wi;
+	}
+}
+} // namespace
+
+void traceSPPM(const mat4& V, const mat4& P, int sample_index)
+{
+	const int width = rendered_image.width, height = rendered_image.height;
+	if(rendered_image.number_of_samples == 0 || width != sppm_state.width || height != sppm_state.height)
+	{
+		SPPMPixel initial = {};
+		sppm_state.pixels.assign(size_t(width) * height, initial);
+		sppm_state.width = width;
+		sppm_state.height = height;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Visible points
+	///////////////////////////////////////////////////////////////////////
+	const vec3 camera_pos = vec3(inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	const mat4 inverse_view_projection = inverse(P * V);
+	// Height of a pixel at distance 1
+	const float footprint = 2.0f / (P[1][1] * float(height));
+#pragma omp parallel for schedule(dynamic, 4)
+	for(int y = 0; y < height; y++)
+	{
+		for(int x = 0; x < width; x++)
+		{
+			const int pixel = y * width + x;
+			beginSample(uint32_t(pixel), uint32_t(sample_index));
+			vec2 screen = vec2((float(x) + randf()) / float(width), (float(y) + randf()) / float(height));
+			vec4 target = inverse_view_projection * vec4(screen * 2.0f - 1.0f, 1.0f, 1.0f);
+			Ray ray;
+			ray.o = camera_pos;
+			ray.d = normalize(vec3(target) / target.w - camera_pos);
+			traceCameraPath(ray, footprint, sppm_state.pixels[pixel]);
+		}
+	}
+	buildGrid();
+
+	///////////////////////////////////////////////////////////////////////
+	// Photons, as many as there are pixels
+	///////////////////////////////////////////////////////////////////////
+	const float lights_power = buildLights();
+	vec3 lo, hi;
+	getSceneBounds(lo, hi);
+	const vec3 center = (lo + hi) * 0.5f;
+	const float radius = length(hi - lo) * 0.5f + EPSILON;
+	const float env_power = environmentPower(radius);
+	float environment_probability = 1.0f;
+	if(!lights.empty())
+		environment_probability = env_power + lights_power > 0.0f ? env_power / (env_power + lights_power) : 0.0f;
+	const int num_photons = width * height;
+#pragma omp parallel for schedule(dynamic, 64)
+	for(int i = 0; i < num_photons; i++)
+	{
+		beginSample(PHOTON_SEED_BIT | uint32_t(i), uint32_t(sample_index));
+		tracePhoton(environment_probability, center, radius);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Shrink the radii and write the estimate
+	///////////////////////////////////////////////////////////////////////
+	const float passes = float(rendered_image.number_of_samples + 1);
+#pragma omp parallel for schedule(static)
+	for(int pixel = 0; pixel < width * height; pixel++)
+	{
+		SPPMPixel& px = sppm_state.pixels[pixel];
+		if(px.M > 0)
+		{
+			float N = px.N + ALPHA * px.M;
+			float radius = px.radius * sqrt(N / (px.N + px.M));
+			px.tau = (px.tau + px.vp.beta * px.phi) * (radius * radius) / (px.radius * px.radius);
+			px.N = N;
+			px.radius = radius;
+		}
+		px.phi = vec3(0.0f);
+		px.M = 0;
+		vec3 L = px.Ld / passes;
+		if(px.radius > 0.0f)
+			L += px.tau / (passes * float(num_photons) * M_PI * px.radius * px.radius);
+		rendered_image.data[pixel] = L;
+	}
+}
+} // namespace pathtracer
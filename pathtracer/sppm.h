@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Stochastic progressive photon mapping (settings.integrator ==
+// PhotonMapping), after Hachisuka and Jensen (2009).
+//
+// Each pass follows the camera path of every pixel through glass to its
+// first diffuse hit (the visible point), adding what Li() would add on the
+// way: emission, the environment and direct light from the point light.
+// Then as many photons as there are pixels are traced from the lights
+// and the environment. Wherever a photon hits a surface, it is added to
+// the visible points within their radius, found in a hash grid that is
+// rebuilt each pass. The radii shrink as photons come in, so the estimate
+// converges.
+//
+// Light that reaches a diffuse surface through glass (caustics, and
+// diffuse-glass-diffuse paths) comes from the photons, which Li() only
+// finds by chance.
+///////////////////////////////////////////////////////////////////////////
+
+struct SPPMVisiblePoint
+{
+	glm::vec3 p, n, wo;
+	glm::vec3 beta;  // throughput from the camera
+	glm::vec3 color; // of the diffuse BTDF
+};
+
+struct SPPMPixel
+{
+	bool has_vp;
+	SPPMVisiblePoint vp; // of this pass
+	float radius;        // 0 until the pixel found its first visible point
+	float N;             // number of photons, after reduction
+	glm::vec3 tau;       // flux, after reduction
+	glm::vec3 Ld;        // sum over passes of what the camera paths found
+	glm::vec3 phi;       // flux of this pass
+	int M;               // photons of this pass
+};
+
+// What the passes of one render accumulate, for its width x height
+// pixels. Part of RenderContext.
+struct SPPMState
+{
+	std::vector<SPPMPixel> pixels;
+	int width = 0, height = 0;
+};
+extern SPPMState sppm_state;
+
+// Trace one pass and write the current estimate to rendered_image.
+// Called by tracePaths(). Starts sppm_state over on the first pass of a
+// render (number_of_samples == 0) or when the image size changed.
+void traceSPPM(const glm::mat4& V, const glm::mat4& P, int sample_index);
+} // namespace pathtracer
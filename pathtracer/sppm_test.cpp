@@ -0,0 +1,200 @@
+///////////////////////////////////////////////////////////////////////////
+// sppm_test: renders two photon mapping jobs of different sizes, first
+// each on its own and then taking turns pass by pass through their render
+// contexts (as pathtracer_server does), and checks that taking turns does
+// not change either image. Then renders a bidirectional job with the
+// emission of a mesh overridden around each pass, as the server does, and
+// checks it against the mesh being emissive for real. The scene is built
+// in code, so no files are needed. Exits with 1 if any pixel differs.
+///////////////////////////////////////////////////////////////////////////
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <omp.h>
+#include <glm/gtx/transform.hpp>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "primitives.h"
+#include "sampling.h"
+
+using namespace glm;
+using namespace pathtracer;
+
+namespace
+{
+const int kPasses = 8;
+
+labhelper::Material makeMaterial(const vec3& color, float transparency, const vec3& emission)
+{
+	labhelper::Material m;
+	m.m_color = color;
+	m.m_shininess = 0.0f;
+	m.m_metalness = 0.0f;
+	m.m_fresnel = 0.0f;
+	m.m_emission = emission;
+	m.m_transparency = transparency;
+	m.m_ior = 1.5f;
+	return m;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A glass sphere on a diffuse floor, under an area light and a dim
+// constant environment, so that both the camera paths and the photons
+// (caustics) add to the image
+///////////////////////////////////////////////////////////////////////////
+labhelper::Material floor_material = makeMaterial(vec3(0.8f), 0.0f, vec3(0.0f));
+labhelper::Material glass_material = makeMaterial(vec3(1.0f), 1.0f, vec3(0.0f));
+labhelper::Material light_material = makeMaterial(vec3(0.0f), 0.0f, vec3(20.0f));
+
+// A panel of two triangles behind the sphere, which is only lit and not a
+// light unless its emission is set. Never freed, ~Model() needs OpenGL.
+labhelper::Model* makePanel()
+{
+	labhelper::Model* panel = new labhelper::Model;
+	panel->m_name = "panel";
+	panel->m_materials.push_back(makeMaterial(vec3(0.5f), 0.0f, vec3(0.0f)));
+	const vec3 corners[4] = { vec3(-2.0f, 0.0f, -3.0f), vec3(2.0f, 0.0f, -3.0f), vec3(2.0f, 3.0f, -3.0f),
+		                      vec3(-2.0f, 3.0f, -3.0f) };
+	const int indices[6] = { 0, 1, 2, 0, 2, 3 };
+	for(int i : indices)
+	{
+		panel->m_positions.push_back(corners[i]);
+		panel->m_normals.push_back(vec3(0.0f, 0.0f, 1.0f));
+		panel->m_texture_coordinates.push_back(vec2(0.0f));
+	}
+	labhelper::Mesh mesh;
+	mesh.m_name = "panel";
+	mesh.m_material_idx = 0;
+	mesh.m_start_index = 0;
+	mesh.m_number_of_vertices = 6;
+	panel->m_meshes.push_back(mesh);
+	return panel;
+}
+labhelper::Model* panel = makePanel();
+labhelper::Material& panel_material = panel->m_materials[0];
+const vec3 kPanelEmission = vec3(5.0f);
+
+void buildScene()
+{
+	reinitScene();
+	std::vector<Primitive> primitives;
+	primitives.push_back(makeQuad(vec3(-5.0f, 0.0f, 5.0f), vec3(10.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, -10.0f),
+	                              &floor_material));
+	primitives.push_back(makeSphere(vec3(0.0f, 1.0f, 0.0f), 1.0f, &glass_material));
+	primitives.push_back(makeDisc(vec3(1.0f, 5.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f), 1.0f, &light_material));
+	addPrimitives(primitives);
+	addModel(panel, mat4(1.0f));
+	buildBVH();
+
+	// 1x1, freed by HDRImage
+	environment.map.width = environment.map.height = 1;
+	environment.map.components = 3;
+	environment.map.data = static_cast<float*>(malloc(3 * sizeof(float)));
+	environment.map.data[0] = environment.map.data[1] = environment.map.data[2] = 0.1f;
+	buildEnvironmentLookup();
+	environment.multiplier = 1.0f;
+}
+
+struct Job
+{
+	RenderContext context;
+	mat4 V, P;
+};
+
+Job makeJob(int width, int height, uint32_t seed, const vec3& eye)
+{
+	Job job;
+	job.context = currentRenderContext();
+	swapRenderContext(job.context);
+	resize(width, height);
+	seedRandom(seed);
+	swapRenderContext(job.context);
+	job.V = lookAt(eye, vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+	job.P = perspective(radians(45.0f), float(width) / float(height), 0.1f, 100.0f);
+	return job;
+}
+
+void renderPass(Job& job)
+{
+	swapRenderContext(job.context);
+	tracePaths(job.V, job.P, rendered_image.number_of_samples);
+	swapRenderContext(job.context);
+}
+
+// Number of pixels that differ
+int compare(const char* name, const Image& alone, const Image& taking_turns)
+{
+	int differing = 0;
+	for(size_t i = 0; i < alone.data.size(); i++)
+		differing += alone.data[i] == taking_turns.data[i] ? 0 : 1;
+	double sum = 0.0;
+	for(const vec3& c : alone.data)
+		sum += c.x + c.y + c.z;
+	printf("%s %dx%d, %d passes: mean %.4g, %d pixels differ %s\n", name, alone.width, alone.height,
+	       alone.number_of_samples, sum / (3.0 * alone.data.size()), differing, differing == 0 ? "ok" : "FAILED");
+	return differing;
+}
+} // namespace
+
+int main()
+{
+	// Photons are added to the pixels with atomics, which only sum in the
+	// same order on one thread
+	omp_set_num_threads(1);
+	settings.integrator = PhotonMapping;
+	settings.subsampling = 1;
+	settings.max_bounces = 8;
+	settings.max_paths_per_pixel = 0;
+	settings.numa_first_touch = false;
+	buildScene();
+
+	// Each on its own
+	Job a = makeJob(40, 30, 1, vec3(0.0f, 3.0f, 6.0f));
+	Job b = makeJob(24, 24, 2, vec3(4.0f, 4.0f, 4.0f));
+	for(int i = 0; i < kPasses; i++)
+		renderPass(a);
+	for(int i = 0; i < kPasses; i++)
+		renderPass(b);
+
+	// Taking turns
+	Job a2 = makeJob(40, 30, 1, vec3(0.0f, 3.0f, 6.0f));
+	Job b2 = makeJob(24, 24, 2, vec3(4.0f, 4.0f, 4.0f));
+	for(int i = 0; i < kPasses; i++)
+	{
+		renderPass(a2);
+		renderPass(b2);
+	}
+
+	int differing = compare("a", a.context.image, a2.context.image);
+	differing += compare("b", b.context.image, b2.context.image);
+
+	// A bidirectional job that overrides the emission of the panel, which
+	// must be collected as a light while its passes render
+	settings.integrator = Bidirectional;
+	Job overridden = makeJob(32, 24, 3, vec3(0.0f, 3.0f, 6.0f));
+	size_t lights_while_overridden = 0;
+	for(int i = 0; i < kPasses; i++)
+	{
+		panel_material.m_emission = kPanelEmission;
+		updateEmissiveTriangles();
+		lights_while_overridden = getEmissiveTriangles().size();
+		renderPass(overridden);
+		panel_material.m_emission = vec3(0.0f);
+		updateEmissiveTriangles();
+	}
+	const size_t lights_after = getEmissiveTriangles().size();
+
+	// The panel emissive for real
+	panel_material.m_emission = kPanelEmission;
+	restart(LightingChanged);
+	Job emissive = makeJob(32, 24, 3, vec3(0.0f, 3.0f, 6.0f));
+	for(int i = 0; i < kPasses; i++)
+		renderPass(emissive);
+
+	printf("emission override: %d emissive triangles while applied, %d after\n", int(lights_while_overridden),
+	       int(lights_after));
+	if(lights_while_overridden != 2 || lights_after != 0)
+		differing++;
+	differing += compare("emission override", emissive.context.image, overridden.context.image);
+	return differing == 0 ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include "stats.h"
+#include <algorithm>
+#include <sstream>
+
+namespace pathtracer
+{
+namespace stats
+{
+std::vector<ThreadCounters, fastmath::aligned_allocator<ThreadCounters>> thread_counters(1);
+Counters frame;
+Counters total;
+
+Counters& Counters::operator+=(const Counters& o)
+{
+	camera_rays += o.camera_rays;
+	reused_camera_rays += o.reused_camera_rays;
+	extension_rays += o.extension_rays;
+	shadow_rays += o.shadow_rays;
+	occluded_hits += o.occluded_hits;
+	intersections += o.intersections;
+	for(int i = 0; i <= MAX_DEPTH; i++)
+		depth[i] += o.depth[i];
+	pdf_terminations += o.pdf_terminations;
+	cache_terminations += o.cache_terminations;
+	roulette_terminations += o.roulette_terminations;
+	for(int i = 0; i < NumPhases; i++)
+		cycles[i] += o.cycles[i];
+	return *this;
+}
+
+void beginFrame()
+{
+	// One per thread of the parallel regions to come
+	thread_counters.resize(std::max(thread_counters.size(), size_t(omp_get_max_threads())));
+	for(ThreadCounters& c : thread_counters)
+		static_cast<Counters&>(c) = Counters();
+}
+
+void endFrame()
+{
+	frame = Counters();
+	for(const ThreadCounters& c : thread_counters)
+		frame += c;
+	total += frame;
+}
+
+void resetTotal()
+{
+	total = Counters();
+}
+
+std::string toJSON(const Counters& c, const std::string& indent)
+{
+	std::stringstream ss;
+	ss << "{\n";
+	ss << indent << "  \"camera_rays\": " << c.camera_rays << ",\n";
+	ss << indent << "  \"reused_camera_rays\": " << c.reused_camera_rays << ",\n";
+	ss << indent << "  \"extension_rays\": " << c.extension_rays << ",\n";
+	ss << indent << "  \"shadow_rays\": " << c.shadow_rays << ",\n";
+	ss << indent << "  \"occluded_hits\": " << c.occluded_hits << ",\n";
+	ss << indent << "  \"intersections\": " << c.intersections << ",\n";
+	ss << indent << "  \"pdf_terminations\": " << c.pdf_terminations << ",\n";
+	ss << indent << "  \"cache_terminations\": " << c.cache_terminations << ",\n";
+	ss << indent << "  \"roulette_terminations\": " << c.roulette_terminations << ",\n";
+	ss << indent << "  \"depth_histogram\": [";
+	for(int i = 0; i <= MAX_DEPTH; i++)
+		ss << (i == 0 ? "" : ", ") << c.depth[i];
+	ss << "],\n";
+	ss << indent << "  \"cycles\": { \"traversal\": " << c.cycles[Traversal]
+	   << ", \"shading\": " << c.cycles[Shading] << ", \"environment\": " << c.cycles[Environment] << " }\n";
+	ss << indent << "}";
+	return ss.str();
+}
+} // namespace stats
+} // namespace pathtracer
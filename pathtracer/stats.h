@@ -0,0 +1,134 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <omp.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+#include "fastmath.h"
+
+///////////////////////////////////////////////////////////////////////////
+// Hot-path counters of the pathtracer. Every thread counts into its own
+// cache line, so counting is an increment of a thread-private variable.
+// tracePaths() sums them up after each call (stats::frame) and into a
+// running total (stats::total).
+//
+// Cycle counts (rdtsc) cost a little more than the plain counters and can
+// be compiled out with PATHTRACER_CYCLE_COUNTERS=0.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef PATHTRACER_CYCLE_COUNTERS
+#define PATHTRACER_CYCLE_COUNTERS 1
+#endif
+
+namespace pathtracer
+{
+namespace stats
+{
+enum Phase
+{
+	Traversal,   // intersect() and occluded()
+	Shading,     // getIntersection() and the BSDFs
+	Environment, // Lenvironment()
+	NumPhases
+};
+
+// Path depth is bounded by the "Max Bounces" slider (0-16)
+const int MAX_DEPTH = 16;
+
+struct Counters
+{
+	uint64_t camera_rays = 0;
+	// Camera rays whose hit came from the primary hit cache instead (not
+	// in camera_rays)
+	uint64_t reused_camera_rays = 0;
+	uint64_t extension_rays = 0;
+	uint64_t shadow_rays = 0;
+	uint64_t occluded_hits = 0;
+	uint64_t intersections = 0; // getIntersection() calls
+	// Number of paths by the number of surfaces they hit (0 for camera
+	// rays that miss the scene)
+	uint64_t depth[MAX_DEPTH + 1] = {};
+	// Paths ended because the sampled pdf was below EPSILON
+	uint64_t pdf_terminations = 0;
+	// Paths ended at a cached radiance (see radiance_cache.h)
+	uint64_t cache_terminations = 0;
+	// Paths ended by Russian roulette
+	uint64_t roulette_terminations = 0;
+	uint64_t cycles[NumPhases] = {};
+
+	uint64_t rays() const
+	{
+		return camera_rays + extension_rays + shadow_rays;
+	}
+	Counters& operator+=(const Counters& o);
+};
+
+struct alignas(64) ThreadCounters : public Counters
+{
+};
+
+// Sized for omp_get_max_threads() by beginFrame()
+extern std::vector<ThreadCounters, fastmath::aligned_allocator<ThreadCounters>> thread_counters;
+extern Counters frame;                     // Of the last tracePaths() call
+extern Counters total;                     // Since resetTotal()
+
+inline Counters& local()
+{
+	return thread_counters[omp_get_thread_num()];
+}
+
+inline void recordDepth(int depth)
+{
+	local().depth[depth < MAX_DEPTH ? depth : MAX_DEPTH]++;
+}
+
+// Called by tracePaths() before and after tracing
+void beginFrame();
+void endFrame();
+
+void resetTotal();
+
+// As a JSON object; `indent` is prepended to every line but the first
+std::string toJSON(const Counters& c, const std::string& indent = "");
+
+inline uint64_t cycles()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Adds the cycles spent in the enclosing scope to a phase
+///////////////////////////////////////////////////////////////////////////
+class ScopedCycles
+{
+public:
+#if PATHTRACER_CYCLE_COUNTERS
+	explicit ScopedCycles(Phase phase) : phase(phase), start(cycles())
+	{
+	}
+	~ScopedCycles()
+	{
+		local().cycles[phase] += cycles() - start;
+	}
+
+private:
+	Phase phase;
+	uint64_t start;
+#else
+	explicit ScopedCycles(Phase)
+	{
+	}
+#endif
+};
+} // namespace stats
+} // namespace pathtracer
@@ -0,0 +1,60 @@
+#version 420
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// Joint bilateral upsampling of the pathtraced image to the window: each
+// window pixel blends the 2x2 closest image pixels bilinearly, but only
+// those that see the same surface (similar depth and normal in the guide)
+// as the window pixel itself. Edges stay sharp instead of blocky or
+// smeared across depth discontinuities.
+
+layout(location = 0) out vec4 fragmentColor;
+layout(binding = 0) uniform sampler2D image; // pathtraced, low resolution
+layout(binding = 1) uniform sampler2D guide; // window resolution, see gbuffer.frag
+in vec2 texCoord;
+
+const float depth_tolerance = 0.05; // relative
+const float normal_exponent = 16.0;
+
+float similarity(vec4 a, vec4 b)
+{
+	// Background only matches background
+	if(a.w == 0.0 || b.w == 0.0)
+		return (a.w == 0.0 && b.w == 0.0) ? 1.0 : 0.0;
+	float dz = (a.w - b.w) / (depth_tolerance * a.w);
+	return exp(-dz * dz) * pow(max(dot(a.xyz, b.xyz), 0.0), normal_exponent);
+}
+
+void main()
+{
+	ivec2 size = textureSize(image, 0);
+	vec4 g = texture(guide, texCoord);
+
+	vec2 p = texCoord * vec2(size) - 0.5;
+	ivec2 base = ivec2(floor(p));
+	vec2 f = p - vec2(base);
+
+	vec3 sum = vec3(0.0);
+	float weight_sum = 0.0;
+	for(int j = 0; j < 2; j++)
+	{
+		for(int i = 0; i < 2; i++)
+		{
+			ivec2 t = clamp(base + ivec2(i, j), ivec2(0), size - 1);
+			float bilinear = (i == 0 ? 1.0 - f.x : f.x) * (j == 0 ? 1.0 - f.y : f.y);
+			vec4 s = texture(guide, (vec2(t) + 0.5) / vec2(size));
+			float w = bilinear * similarity(g, s);
+			sum += w * texelFetch(image, t, 0).rgb;
+			weight_sum += w;
+		}
+	}
+	// No neighbour sees this surface (thin features): nearest neighbour
+	if(weight_sum < 1e-4)
+	{
+		ivec2 nearest = clamp(ivec2(texCoord * vec2(size)), ivec2(0), size - 1);
+		fragmentColor = vec4(texelFetch(image, nearest, 0).rgb, 1.0);
+		return;
+	}
+	fragmentColor = vec4(sum / weight_sum, 1.0);
+}